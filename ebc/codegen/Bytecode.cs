@@ -98,7 +98,17 @@ public enum Bytecode : Byte{
     wrapctor = 179,
     wrapforeign = 180,
     calldlg = 181,
-    t_ptr = 182
+    t_ptr = 182,
+    // revision 2: 变量下标与字段访问方式以立即数给出
+    ldloci = 183,
+    stloci = 184,
+    ldargi = 185,
+    stargi = 186,
+    ldargai = 187,
+    ldlocai = 188,
+    ldfldh = 189,
+    stfldh = 190,
+    ldfldah = 191
 }
 
 class DataType{
@@ -222,6 +232,41 @@ static class Instructions{
         }
     }
 
+    // <Type> u16，ldargai/ldlocai没有<Type>
+    public class idxinst : RealInst{ 
+        public DataType typ; public UInt16 index;
+        public idxinst(Bytecode code){
+            instbyte = code;
+        }
+        public override string ToString()
+            => instbyte.ToString() + (typ != null ? "." + typ.ToString() : "") + " " + index;
+
+        public override UInt32 getLength() => 1 + (typ != null ? typ.getSize() : 0) + 2;
+        public override void writeToStream(BinaryWriter writer){
+            writer.Write((Byte)instbyte);
+            if(typ != null) typ.writeToStream(writer);
+            writer.Write(index);
+        }
+    }
+
+    // <Type> <Token> u8，ldfldah没有<Type>
+    public class fldinst : RealInst{ 
+        public DataType typ; public Token tok; public Byte hint;
+        public fldinst(Bytecode code){
+            instbyte = code;
+        }
+        public override string ToString()
+            => instbyte.ToString() + (typ != null ? "." + typ.ToString() : "") + " " + tok.QualifiedName() + " " + hint;
+
+        public override UInt32 getLength() => 1 + (typ != null ? typ.getSize() : 0) + 4 + 1;
+        public override void writeToStream(BinaryWriter writer){
+            writer.Write((Byte)instbyte);
+            if(typ != null) typ.writeToStream(writer);
+            writer.Write(tok.id);
+            writer.Write(hint);
+        }
+    }
+
     public class jif : RealInst{ 
         public BasicBlock target;
         public jif(Bytecode code){
@@ -516,6 +561,44 @@ class BasicBlock {
     }
 
 
+    // ILGen先push.u16下标再发出ldloc/stloc等指令，先push.u8访问方式再发出ldfld/stfld/ldflda。
+    // 若上一条指令正是这样的push，将其移除并改为发出带立即数的指令(revision 2)
+    Instructions.push takeImmediate(DataType.Kind kind) {
+        if (instructions.Count > 0 && instructions[^1] is Instructions.push p && p.typ.kind == kind) {
+            instructions.RemoveAt(instructions.Count - 1);
+            return p;
+        }
+        return null;
+    }
+
+    BasicBlock emitIndexed(Bytecode legacy, Bytecode immediate, DataType typ) {
+        var p = takeImmediate(DataType.Kind.U16);
+        if (p != null) {
+            instructions.Add(new Instructions.idxinst(immediate) { typ = typ, index = System.Convert.ToUInt16(p.val) });
+        }
+        else if (typ != null) {
+            instructions.Add(new Instructions.typinst(legacy) { typ = typ });
+        }
+        else {
+            instructions.Add(new Instructions.nopinst(legacy));
+        }
+        return this;
+    }
+
+    BasicBlock emitField(Bytecode legacy, Bytecode immediate, DataType typ, Token tok) {
+        var p = takeImmediate(DataType.Kind.U8);
+        if (p != null) {
+            instructions.Add(new Instructions.fldinst(immediate) { typ = typ, tok = tok, hint = System.Convert.ToByte(p.val) });
+        }
+        else if (typ != null) {
+            instructions.Add(new Instructions.typtokinst(legacy) { typ = typ, tok = tok });
+        }
+        else {
+            instructions.Add(new Instructions.tokinst(legacy) { tok = tok });
+        }
+        return this;
+    }
+
     public BasicBlock markNewline(UInt32 lineNumber) {
         instructions.Add(new Instructions.LineDelimiter(lineNumber));
         return this;
@@ -557,8 +640,7 @@ class BasicBlock {
     }
 
     public BasicBlock ldflda(Token tok) {
-        instructions.Add(new Instructions.tokinst(Bytecode.ldflda) { tok = tok });
-        return this;
+        return emitField(Bytecode.ldflda, Bytecode.ldfldah, null, tok);
     }
 
     public BasicBlock ldsflda(Token tok) {
@@ -582,23 +664,19 @@ class BasicBlock {
     }
 
     public BasicBlock starg(DataType typ) {
-        instructions.Add(new Instructions.typinst(Bytecode.starg) { typ = typ });
-        return this;
+        return emitIndexed(Bytecode.starg, Bytecode.stargi, typ);
     }
 
     public BasicBlock ldarg(DataType typ) {
-        instructions.Add(new Instructions.typinst(Bytecode.ldarg) { typ = typ });
-        return this;
+        return emitIndexed(Bytecode.ldarg, Bytecode.ldargi, typ);
     }
 
     public BasicBlock stloc(DataType typ) {
-        instructions.Add(new Instructions.typinst(Bytecode.stloc) { typ = typ });
-        return this;
+        return emitIndexed(Bytecode.stloc, Bytecode.stloci, typ);
     }
 
     public BasicBlock ldloc(DataType typ) {
-        instructions.Add(new Instructions.typinst(Bytecode.ldloc) { typ = typ });
-        return this;
+        return emitIndexed(Bytecode.ldloc, Bytecode.ldloci, typ);
     }
 
     public BasicBlock stelem(DataType typ, Token tok) {
@@ -727,13 +805,11 @@ class BasicBlock {
     }
 
     public BasicBlock stfld(DataType typ, Token tok) {
-        instructions.Add(new Instructions.typtokinst(Bytecode.stfld) { typ = typ, tok = tok });
-        return this;
+        return emitField(Bytecode.stfld, Bytecode.stfldh, typ, tok);
     }
 
     public BasicBlock ldfld(DataType typ, Token tok) {
-        instructions.Add(new Instructions.typtokinst(Bytecode.ldfld) { typ = typ, tok = tok });
-        return this;
+        return emitField(Bytecode.ldfld, Bytecode.ldfldh, typ, tok);
     }
 
     public BasicBlock stsfld(DataType typ, Token tok) {
@@ -767,13 +843,11 @@ class BasicBlock {
     }
 
     public BasicBlock ldarga() {
-        instructions.Add(new Instructions.nopinst(Bytecode.ldarga));
-        return this;
+        return emitIndexed(Bytecode.ldarga, Bytecode.ldargai, null);
     }
 
     public BasicBlock ldloca() {
-        instructions.Add(new Instructions.nopinst(Bytecode.ldloca));
-        return this;
+        return emitIndexed(Bytecode.ldloca, Bytecode.ldlocai, null);
     }
 
     public BasicBlock arraylength() {
@@ -112,7 +112,24 @@ namespace bytecode{
     wrapctor = 179,
     wrapforeign = 180,
     calldlg = 181,
-    t_ptr = 182;
+    t_ptr = 182,
+    // revision 2±ֶηʷʽپɲջݡ
+    // ɵָʽȻЧͬʱʽ
+    ldloci = 183,
+    stloci = 184,
+    ldargi = 185,
+    stargi = 186,
+    ldargai = 187,
+    ldlocai = 188,
+    ldfldh = 189,
+    stfldh = 190,
+    ldfldah = 191;
+
+    // ldfldh/stfldh/ldfldahķʷʽ
+    const uint8_t
+    hint_instance = 1,
+    hint_handle = 2,
+    hint_record = 3;
 }
 
 
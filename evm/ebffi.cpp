@@ -28,16 +28,15 @@ void FFIEntry::call(Processor *processor){
 	for(int i = 0; i<parameters.size(); i++){
 		if(parameters[i]->getEvalKind() == runtime::EvaluationKind::Byval){
 			if(runtime::instancesOf<runtime::Class>(parameters[i]->getType())){
-				processor->OpRemoveRoot<interop::Instance*>();
 				auto ins = processor->getOperand().pop<interop::Instance*>();
-				if(ins->klass == processor->getLoader().getEBString()){
+				if(ins->getClass() == processor->getLoader().getEBString()){
 					auto str = processor->getLoader().getInteropAgent()->fetchStringFromInstance((interop::StringInstance*)ins);
 					auto cstr = unicode::toPlatform(str);
 					temp_cstr.push_back(cstr);
 					temp_ptr.push_back((uint8_t*)temp_cstr.back().c_str());
 					values[i] = &temp_ptr.back();
 				}
-				else if(isSubtypeOf(ins->klass,processor->getLoader().getEBArray())){
+				else if(isSubtypeOf(ins->getClass(),processor->getLoader().getEBArray())){
 					temp_ptr.push_back((uint8_t*)ins + sizeof(interop::ArrayInstance));
 					values[i] = &temp_ptr.back();
 				}
@@ -47,7 +46,6 @@ void FFIEntry::call(Processor *processor){
 			}
 		}
 		else { // byref
-			processor->OpRemoveRoot<interop::Instance*>();
 			auto itp = processor->getOperand().pop<interop::InteriorPointer>();
 			temp_ptr.push_back(itp.ptr);
 			values[i] = &temp_ptr.back();
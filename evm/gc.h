@@ -1,14 +1,32 @@
 #ifndef EVM_GC
 #define EVM_GC
+#include "gcstats.h"
+#include "gcworkers.h"
+#include "heap.h"
 #include "interop.h"
 #include "runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <csignal>
 #include <cstdint>
+#include <deque>
 #include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
 #include <queue>
+#include <random>
 #include <cstring>
 #include <stdexcept>
 #include <type_traits>
 #include <iomanip>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
 
 class Reference{
     enum class ReferenceKind{InstanceRef,InteriorRef,PinedIns};
@@ -28,28 +46,28 @@ public:
     static inline Reference fromInterior(interop::InteriorPointer *ptr){ return Reference(ptr); }
     static inline Reference fromRefPtr(Ins **ptr){ return Reference(ptr); }
 
-    inline void updateForward(){
+    // 使引用指向移动到target的对象
+    inline void set(Ins *target){
         switch(kind) {
             case ReferenceKind::InstanceRef:
-                if((*ins_ptr)->forward!=nullptr){
-                    *ins_ptr = (*ins_ptr)->forward;
-                }
+                *ins_ptr = target;
                 break;
-            case ReferenceKind::InteriorRef: {
-                auto ins = interop::getInteriorPointerInstance(*interior);
-                if(ins!=nullptr){
-                    if(ins->forward != nullptr){
-                        interior->ptr = (uint8_t*)ins->forward + interior->offset; 
-                    }
-                }
+            case ReferenceKind::InteriorRef:
+                interior->ptr = (uint8_t*)target + interior->offset; 
                 break;
-            }
             case ReferenceKind::PinedIns:
                 throw std::invalid_argument("cannot move pined object");
                 break;
         }
     }
 
+    inline void updateForward(){
+        auto ins = get();
+        if(ins != nullptr && ins->isForwarded()){
+            set(ins->getForward());
+        }
+    }
+
     inline Ins* get() {
         switch (kind) {
             case ReferenceKind::InstanceRef:
@@ -71,111 +89,1265 @@ public:
                 return (uintptr_t)pined_ins;
         }
     }
+};
 
-    inline std::list<Reference> getReferences(){
-        std::list<Reference> ls;
-        Ins *ins = get();
-        if(ins==nullptr)return ls;
-        char *ins_beg_ptr = (char*)ins;  
-        if(auto spec_ary = dynamic_cast<runtime::SpecializedArray*>(ins->klass)){
-            auto ary_ins = (interop::ArrayInstance*)ins;
-            // 获取数组实例存储的引用
-            if(runtime::instancesOf<runtime::Class>(spec_ary->getElementType())){
-                for(int i = 0; i<ary_ins->length; i++){
-                    auto offset = sizeof(interop::ArrayInstance) + i*sizeof(interop::Instance*);
-                    ls.push_back(fromRefPtr((Ins**)(ins_beg_ptr + offset)));
-                }
-            }
-        }
-  
-        // 获取普通实例存储的引用
-        for(auto offset : ins->klass->getInstanceRefFieldOffsets()){
-            ls.push_back(fromRefPtr((Ins**)(ins_beg_ptr + offset)));
-        }
-        
-        return ls;
+
+// 按类的TraceDescriptor对ins中的每个引用槽位调用fn。不分配内存，也不使用RTTI
+template<class F>
+inline void forEachRefSlot(interop::Instance *ins, F &&fn){
+    auto &desc = ins->getClass()->getTraceDescriptor();
+    auto base = (char*)ins;
+    for(auto &run : desc.runs){
+        auto slot = (interop::Instance**)(base + run.offset);
+        for(uint32_t i = 0; i < run.count; i++) fn(slot + i);
+    }
+    if(desc.element_is_ref){
+        auto slot = (interop::Instance**)(base + desc.fixed_size);
+        auto length = ((interop::ArrayInstance*)ins)->length;
+        for(int32_t i = 0; i < length; i++) fn(slot + i);
     }
+}
+
+// 在回收开始时提供根集，如Processor的栈帧与操作栈。
+// 根集只在回收时枚举，执行字节码时不需要维护
+class RootProvider{
+public:
+    virtual void enumerateRoots(std::vector<Reference> &roots) = 0;
 };
 
+// 分配采样。平均每分配interval字节调用一次，bytes为该样本代表的分配量。
+// 在分配完成之前调用，实现中不能在GC堆上分配
+class AllocationSampler{
+public:
+    virtual void sampleAllocation(runtime::Class *klass, uint64_t bytes) = 0;
+};
 
+// 分代回收。新生代为两个半空间，用复制算法回收(minorGC)；
+// 经历tenure_age次minorGC仍存活的对象晋升到老年代，老年代空间不足时用标记-整理回收(majorGC)。
+// 老年代按card_size划分为卡，老年代对象中写入引用时由写屏障标记所在的卡，
+// minorGC只扫描被标记的卡而不是整个老年代，停顿时间与存活对象的数量相关而与老年代的大小无关。
+// 两代都在启动时保留最大的地址范围，按需提交：半空间的大小随存活率与minorGC的频率调整，
+// 老年代在majorGC后按存活数据量调整下一次majorGC的阈值。
+// 不小于options.large_object的对象分配在大对象空间，按页分配、只标记不移动，
+// 大数组在回收时不会被复制，其中的引用同样由卡表记录。
+// options.incremental为true时老年代改用train算法增量回收，见incrementalGC
 class GarbageCollector{
-    char *space_begin,*space_end;
+    static constexpr uint8_t tenure_age = 2;
+    static constexpr uint32_t card_shift = 9;
+    static constexpr uint32_t card_size = 1 << card_shift;
+    static constexpr uint32_t min_semi_space_size = 64 << 10;
+
+    heap::Options options;
+
+    char *space_begin,*space_end;       // 新生代保留的地址范围，两个半空间各占max_semi_space_size
     char *from_semi_space,*to_semi_space;
     char *free_semi;
-    int semi_space_size;
+    char *semi_limit;                   // 新生代中可以分配到的位置，不回收区域中为预留的末尾
+    // 新生代在分配指针之前按zero_chunk分段清零，对象不再逐个清零。
+    // 快速路径只比较一次alloc_limit，它是zeroed、semi_limit与下一个采样点中最近的一个
+    static constexpr uint32_t zero_chunk = 32 << 10;
+    char *zeroed;                       // from_semi_space中[free_semi, zeroed)已清零
+    char *alloc_limit;
+    int semi_space_size;                // 当前每个半空间已提交的大小
+    int max_semi_space_size;
+    std::chrono::steady_clock::time_point last_minor_gc;
+    char *nursery_start;                // 上一次minorGC之后新生代中存活对象的末尾，之后的部分为新分配的对象
+    // 新生代中被原地固定的对象，按地址排序。它们不被复制，相当于在原处晋升：minorGC把它们的槽位作为根，
+    // 两个半空间中的分配都跳过它们；majorGC中未被标记的不再保留，解除固定后在from-space中时照常复制
+    std::vector<interop::Instance*> young_pinned;
+
+    char *old_begin,*old_end;           // old_end为已提交部分的末尾
+    char *old_reserved_end;
+    char *old_free;
+    size_t old_threshold;               // 老年代使用量超过此值时进行majorGC
+    std::vector<uint8_t> cards;         // 非0表示卡中可能有指向新生代的引用
+    std::vector<char*> card_starts;     // 覆盖每张卡第一个字节的对象的起始地址
+
+    char *large_begin,*large_end;       // 大对象空间保留的地址范围
+    char *large_top;                    // 从未分配过的部分的起点
+    size_t large_used = 0;
+    std::map<char*,size_t> large_objects;   // 大对象的起始地址 -> 占用的字节数(按页对齐)
+
+    gcstats::Statistics stats;
+
+    // 不回收区域。嵌套的区域共用最外层区域在新生代中的预留，区域中不进行minorGC与majorGC
+    int nogc_depth = 0;
+    bool budget_exceeded = false;
+
+    // 未设置采样器时倒计数不会耗尽，分配只多一次减法与比较
+    AllocationSampler *sampler = nullptr;
+    int64_t sample_countdown = INT64_MAX;
+    char *sample_mark = nullptr;        // 快速路径的分配在下一次syncSample时从倒计数中扣除
+    uint64_t sample_interval = 0;
+    std::mt19937_64 sample_random;
+    std::exponential_distribution<double> sample_distance;
+    int snapshot_count = 0;
+    inline static volatile std::sig_atomic_t snapshot_requested = 0;
+
+    // 并行minorGC。options.gc_threads大于1时创建线程池，新生代使用量不小于parallel_threshold时并行复制：
+    // 各线程分担根集与卡表，把对象复制到各自在to-space与老年代中的本地分配缓冲区(LAB)，
+    // 用CAS写入转发地址决定由哪个线程复制，待扫描的对象放在本地栈中，多余的放入可被其他线程窃取的队列
+    static constexpr int parallel_threshold = 256 << 10;
+    static constexpr size_t publish_threshold = 64;     // 本地栈超过此数量且共享队列为空时分出一半
+
+    struct Scavenger{
+        char *lab_top = nullptr, *lab_end = nullptr;    // to-space中的LAB
+        char *plab_top = nullptr, *plab_end = nullptr;  // 老年代中存放晋升对象的LAB
+        std::vector<interop::Instance*> local;
+        gcworkers::StealQueue<interop::Instance*> queue;
+        uint64_t root_scan = 0;
+    };
+
+    std::unique_ptr<gcworkers::Pool> pool;
+    std::vector<std::unique_ptr<Scavenger>> scavengers;
+    std::unique_ptr<runtime::FillerClass> filler_word, filler_array;
+    size_t lab_size = 0;
+    std::vector<uint32_t> dirty_old, dirty_large, dirty_pinned;
+
+    // 增量回收(train算法)。老年代按car_size划分为车厢，车厢组成列车，按(列车编号, 车厢编号)排序。
+    // 每次minorGC之后在时间预算内回收最低列车的第一节车厢：被根集引用的对象复制到最年轻的列车，
+    // 被其他列车引用的对象复制到引用者所在的列车，只被本列车引用的对象复制到本列车末尾，之后整节车厢释放。
+    // 环状的垃圾最终会聚集到同一列车，整列没有外部引用时整列释放。
+    // 每节车厢的记忆集记录排在它之后的车厢、大对象与固定空间中指向它的槽位，由写屏障维护；
+    // 新生代在minorGC之后只剩存活对象，与根集一起在每次增量回收时扫描
+    static constexpr uint32_t car_shift = 18;
+    static constexpr uint32_t car_size = 1 << car_shift;
+    static constexpr uint32_t no_car = UINT32_MAX;
+    static constexpr size_t remembered_min_limit = 64;
+
+    struct RememberedSlot{
+        interop::Instance **slot;
+        uint32_t stamp;             // 槽位所在车厢的stamp，不在车厢中时为0
+    };
+
+    struct Car{
+        uint64_t order = 0;         // 列车编号<<32 | 车厢编号，0表示空闲
+        uint32_t stamp = 1;         // 每次释放时加1，使记忆集中来自已释放车厢的槽位失效
+        char *top = nullptr;        // 已分配部分的末尾
+        std::vector<RememberedSlot> remembered;
+        size_t remembered_limit = remembered_min_limit;    // 超过此大小时去重并清除失效的槽位
+    };
+
+    struct Train{
+        uint32_t number;
+        uint32_t next_car = 1;
+        std::deque<uint32_t> cars;  // 按车厢编号递增，最后一节用于分配
+    };
+
+    std::vector<Car> car_table;         // 覆盖老年代的整个保留范围
+    std::vector<uint32_t> free_cars;    // old_end以下已释放的车厢
+    std::deque<Train> trains;           // 编号连续递增，空的列车到达最前面时才移除
+    uint32_t next_train = 1;
+    uint32_t round_end = 0;             // 本轮开始时最年轻的列车，它被移除时按剩余的使用量调整car_threshold
+    uint32_t collecting_car = no_car;   // 正在回收的车厢，不能再向其中分配
+    size_t car_used = 0;                // 车厢中已分配的字节数
+    size_t car_threshold = 0;           // 车厢的使用量超过此值时进行增量回收
+    uint64_t increment_cars = 0, increment_evacuated = 0;
+    std::vector<interop::Instance*> promoted;   // minorGC中晋升到车厢、尚未扫描的对象
+    std::vector<interop::Instance*> evacuated;  // 增量回收中复制出、尚未扫描的对象
+    std::map<char*,size_t> large_free;      // large_top以下已释放的页段，相邻的段已合并
+    std::vector<uint8_t> large_cards;       // 覆盖[large_begin, large_top)，含义与cards相同
+
+    // 固定空间按页划分，每页只存放一种大小的对象。空闲块的对象头为0(类序号0保留)，
+    // 其后8字节为空闲链表中的下一块
+    static constexpr uint32_t pinned_page_size = 64 << 10;
+    static constexpr uint32_t pinned_size_classes[] = {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+    static constexpr uint32_t pinned_class_count = std::size(pinned_size_classes);
+    char *pinned_begin,*pinned_end;         // 固定空间保留的地址范围
+    char *pinned_top;                       // 从未分配过的页的起点
+    size_t pinned_used = 0;
+    std::vector<uint8_t> pinned_page_class;             // 每页存放的对象大小在pinned_size_classes中的序号
+    char *pinned_free[pinned_class_count] = {};         // 每种大小的空闲链表
+    std::vector<uint8_t> pinned_cards;                  // 覆盖[pinned_begin, pinned_top)，含义与cards相同
+
+    std::vector<RootProvider*> providers;
+    std::vector<interop::Instance**> static_roots;
+    interop::Handle handles;        // ProtectedCell持有的引用组成的双向链表，handles为哨兵
+    std::vector<Reference> roots;   // 回收时枚举的根集，复用以避免每次分配
+    std::vector<interop::Instance*> mark_stack;
+
+    // majorGC时老年代每个对齐的字占一位，标记存活对象占据的字。一张卡正好对应一个uint64_t，
+    // 存活对象整理后的地址为所在卡的card_dest加上卡内它之前被标记的字数，对象头不必保存转发地址。
+    // 被固定的存活对象留在原地作为锚点，其后的对象从锚点末尾开始滑动，锚点之前空出的部分填充
+    static_assert(card_size == 64 * interop::object_alignment);
+    std::vector<uint64_t> live_bits;
+    std::vector<char*> card_dest;
+    std::vector<char*> anchors;     // 按地址递增
+
+    inline void setLive(char *ptr, uint32_t size){
+        size_t first = (ptr - old_begin) / interop::object_alignment;
+        size_t last = first + size / interop::object_alignment;
+        for(auto word = first; word < last;){
+            auto low = word % 64;
+            auto high = std::min<size_t>(64, low + (last - word));
+            auto mask = (high == 64 ? ~0ull : (1ull << high) - 1) & ~((1ull << low) - 1);
+            live_bits[word / 64] |= mask;
+            word += high - low;
+        }
+    }
+
+    // 卡内[from, to)之间被标记的字数
+    inline uint32_t liveWordsBetween(size_t card, size_t from, size_t to) const {
+        auto mask = (to == 64 ? ~0ull : (1ull << to) - 1) & ~((1ull << from) - 1);
+        return std::popcount(live_bits[card] & mask);
+    }
+
+    inline interop::Instance *compactedAddress(interop::Instance *ins){
+        size_t word = ((char*)ins - old_begin) / interop::object_alignment;
+        if(!anchors.empty()){
+            auto iter = std::upper_bound(anchors.begin(), anchors.end(), (char*)ins);
+            if(iter != anchors.begin()){
+                auto anchor = *(iter - 1);
+                size_t anchor_word = (anchor - old_begin) / interop::object_alignment;
+                if(anchor_word / 64 == word / 64){
+                    return (interop::Instance*)(anchor + liveWordsBetween(word / 64, anchor_word % 64, word % 64) * interop::object_alignment);
+                }
+            }
+        }
+        return (interop::Instance*)(card_dest[word / 64] + liveWordsBetween(word / 64, 0, word % 64) * interop::object_alignment);
+    }
+
+    inline void collectRoots(){
+        roots.clear();
+        for(auto provider : providers){
+            provider->enumerateRoots(roots);
+        }
+        for(auto ptr : static_roots){
+            roots.push_back(Reference::fromRefPtr(ptr));
+        }
+        for(auto handle = handles.next; handle != &handles; handle = handle->next){
+            roots.push_back(Reference::fromRefPtr(&handle->ins));
+        }
+    }
+
+    inline bool inYoung(void *ptr) const {
+        return (char*)ptr >= space_begin && (char*)ptr < space_end;
+    }
+
+    // minorGC期间正在回收的半空间。已复制到to-space的对象不能再次复制
+    inline bool inFromSpace(void *ptr) const {
+        return (char*)ptr >= from_semi_space && (char*)ptr < from_semi_space + max_semi_space_size;
+    }
+
+    inline bool inOld(void *ptr) const {
+        return (char*)ptr >= old_begin && (char*)ptr < old_end;
+    }
+
+    inline bool inLarge(void *ptr) const {
+        return (char*)ptr >= large_begin && (char*)ptr < large_top;
+    }
+
+    inline uint32_t largeCardOf(void *ptr) const {
+        return ((char*)ptr - large_begin) >> card_shift;
+    }
+
+    inline bool inPinned(void *ptr) const {
+        return (char*)ptr >= pinned_begin && (char*)ptr < pinned_top;
+    }
+
+    inline uint32_t pinnedCardOf(void *ptr) const {
+        return ((char*)ptr - pinned_begin) >> card_shift;
+    }
+
+    inline size_t oldUsed() const {
+        return options.incremental ? car_used : (size_t)(old_free - old_begin);
+    }
+
+    // 老年代、大对象空间与固定空间的总使用量，超过old_threshold时进行majorGC
+    inline size_t matureUsed() const {
+        return oldUsed() + large_used + pinned_used;
+    }
+
+    // 增量模式下车厢由incrementalGC回收，只按大对象与固定空间的使用量触发majorGC
+    inline bool overMajorThreshold(size_t bytes) const {
+        return (options.incremental ? large_used + pinned_used : matureUsed()) + bytes > old_threshold;
+    }
+
+    // 在大对象空间中分配，优先复用已释放的页段。新提交的页由系统清零
+    inline interop::Instance *allocateLarge(runtime::Class *klass, uint32_t size){
+        auto bytes = heap::roundUp(size, std::max<size_t>(heap::pageSize(), card_size));
+        if(overMajorThreshold(bytes)) majorGC();
+
+        char *ptr = nullptr;
+        for(int retry = 0; ptr == nullptr && retry < 2; retry++){
+            if(retry) majorGC();
+            for(auto itr = large_free.begin(); itr != large_free.end(); itr++){
+                if(itr->second < bytes) continue;
+                ptr = itr->first;
+                if(itr->second > bytes) large_free[ptr + bytes] = itr->second - bytes;
+                large_free.erase(itr);
+                break;
+            }
+            if(ptr == nullptr && (size_t)(large_end - large_top) >= bytes){
+                ptr = large_top;
+                large_top += bytes;
+                large_cards.resize((large_top - large_begin) / card_size, 0);
+            }
+        }
+        if(ptr == nullptr) return nullptr;
+
+        heap::commit(ptr, bytes);
+        large_objects[ptr] = bytes;
+        large_used += bytes;
+        auto ret = (interop::Instance*)ptr;
+        ret->setClass(klass);
+        ret->setAge(tenure_age);
+        LOG_VERBOSE(MinorGC, "allocate large:" << size << " at " << std::hex << (uintptr_t)ptr << std::dec << std::endl);
+        return ret;
+    }
+
+    // 归还大对象占用的页，与相邻的空闲页段合并，位于顶端时降低large_top
+    inline void freeLarge(char *ptr, size_t bytes){
+        LOG_VERBOSE(MinorGC, "discard large object " << std::hex << (void*)ptr << std::dec << " "
+            << ((interop::Instance*)ptr)->getClass()->qualifiedName() << std::endl);
+        heap::decommit(ptr, bytes);
+        large_used -= bytes;
+        std::fill_n(large_cards.begin() + largeCardOf(ptr), bytes / card_size, 0);
+        auto next = large_free.find(ptr + bytes);
+        if(next != large_free.end()){
+            bytes += next->second;
+            large_free.erase(next);
+        }
+        auto prev = large_free.lower_bound(ptr);
+        if(prev != large_free.begin() && (--prev)->first + prev->second == ptr){
+            ptr = prev->first;
+            bytes += prev->second;
+            large_free.erase(prev);
+        }
+        if(ptr + bytes == large_top){
+            large_top = ptr;
+            large_cards.resize((large_top - large_begin) / card_size);
+        }
+        else{
+            large_free[ptr] = bytes;
+        }
+    }
+
+    // 对大对象ins中位于[begin, end)内的引用槽位调用fn，只访问与范围相交的数组元素
+    template<class F>
+    inline void forEachRefSlotIn(interop::Instance *ins, char *begin, char *end, F fn){
+        auto ins_ptr = (char*)ins;
+        auto &desc = ins->getClass()->getTraceDescriptor();
+        if(desc.element_is_ref){
+            auto elements = ins_ptr + desc.fixed_size;
+            auto length = (size_t)((interop::ArrayInstance*)ins)->length;
+            auto size = sizeof(interop::Instance*);
+            size_t first = begin > elements ? (begin - elements + size - 1) / size : 0;
+            size_t last = end > elements ? std::min<size_t>(length, (end - elements + size - 1) / size) : 0;
+            for(auto i = first; i < last; i++){
+                fn((interop::Instance**)(elements + i * size));
+            }
+        }
+        for(auto &run : desc.runs){
+            for(uint32_t i = 0; i < run.count; i++){
+                auto slot = ins_ptr + run.offset + i * sizeof(interop::Instance*);
+                if(slot >= begin && slot < end) fn((interop::Instance**)slot);
+            }
+        }
+    }
+
+    // 扫描大对象空间中被标记的卡。只处理卡范围内的槽位，停顿时间与数组的长度无关
+    inline void scanLargeCards(){
+        for(uint32_t card = 0; card < large_cards.size(); card++){
+            if(!large_cards[card]) continue;
+            large_cards[card] = 0;
+            auto card_begin = large_begin + card * card_size;
+            auto itr = large_objects.upper_bound(card_begin);
+            if(itr == large_objects.begin()) continue;
+            itr--;
+            if(card_begin >= itr->first + itr->second) continue;
+            forEachRefSlotIn((interop::Instance*)itr->first, card_begin, card_begin + card_size, [&](interop::Instance **slot){
+                copyAndUpdateSlot(slot);
+                if(inYoung(*slot)) large_cards[card] = 1;
+                else if(options.incremental) rememberSlot(slot);
+            });
+        }
+    }
+
+    // 提交一个新页并切分为size_class大小的空闲块。保留范围用尽时返回false
+    inline bool refillPinned(uint32_t size_class){
+        if(pinned_end - pinned_top < pinned_page_size) return false;
+        auto page = pinned_top;
+        pinned_top += pinned_page_size;
+        heap::commit(page, pinned_page_size);
+        pinned_page_class.push_back(size_class);
+        pinned_cards.resize((pinned_top - pinned_begin) / card_size, 0);
+        auto size = pinned_size_classes[size_class];
+        // 倒序链接，使分配按地址递增
+        for(auto i = pinned_page_size / size; i > 0; i--){
+            auto block = page + (i - 1) * size;
+            *(char**)(block + sizeof(interop::Instance)) = pinned_free[size_class];
+            pinned_free[size_class] = block;
+        }
+        return true;
+    }
+
+    inline void freePinned(interop::Instance *ins, uint32_t size_class){
+        LOG_VERBOSE(MinorGC, "discard pinned object " << std::hex << (void*)ins << std::dec << " "
+            << ins->getClass()->qualifiedName() << std::endl);
+        auto size = pinned_size_classes[size_class];
+        memset((char*)ins, 0, size);
+        *(char**)((char*)ins + sizeof(interop::Instance)) = pinned_free[size_class];
+        pinned_free[size_class] = (char*)ins;
+        pinned_used -= size;
+    }
+
+    // 对固定空间中与[begin, end)相交的已分配对象调用fn。begin与end不跨页
+    template<class F>
+    inline void forEachPinnedIn(char *begin, char *end, F fn){
+        auto page_index = (begin - pinned_begin) / pinned_page_size;
+        auto page = pinned_begin + page_index * pinned_page_size;
+        auto size_class = pinned_page_class[page_index];
+        auto size = pinned_size_classes[size_class];
+        for(auto ptr = page + (begin - page) / size * size; ptr < end && ptr + size <= page + pinned_page_size; ptr += size){
+            auto ins = (interop::Instance*)ptr;
+            if(ins->header != 0) fn(ins, size_class);
+        }
+    }
+
+    template<class F>
+    inline void forEachPinned(F fn){
+        for(auto page = pinned_begin; page < pinned_top; page += pinned_page_size){
+            forEachPinnedIn(page, page + pinned_page_size, fn);
+        }
+    }
+
+    // 固定空间中的对象不会被复制，与老年代一样通过卡表找到其中指向新生代的引用
+    inline void scanPinnedCards(){
+        for(uint32_t card = 0; card < pinned_cards.size(); card++){
+            if(!pinned_cards[card]) continue;
+            pinned_cards[card] = 0;
+            auto card_begin = pinned_begin + card * card_size;
+            auto card_end = card_begin + card_size;
+            forEachPinnedIn(card_begin, card_end, [&](interop::Instance *ins, uint32_t){
+                forEachRefSlotIn(ins, card_begin, card_end, [&](interop::Instance **slot){
+                    copyAndUpdateSlot(slot);
+                    if(inYoung(*slot)) pinned_cards[card] = 1;
+                    else if(options.incremental) rememberSlot(slot);
+                });
+            });
+        }
+    }
+
+    // [ptr, limit)中第一个原地固定的对象，没有时返回limit
+    inline char *nextYoungPinned(char *ptr, char *limit) const {
+        auto iter = std::lower_bound(young_pinned.begin(), young_pinned.end(), (interop::Instance*)ptr);
+        return iter == young_pinned.end() || (char*)*iter >= limit ? limit : (char*)*iter;
+    }
+
+    // 在半空间中从top分配size字节，跳过原地固定的对象，跳过的部分填充为不含引用的对象。
+    // limit之前放不下时返回false，top不越过limit
+    inline bool skipYoungPinned(char *&top, char *limit, uint32_t size){
+        while(true){
+            auto next = nextYoungPinned(top, limit);
+            if((size_t)(next - top) >= size) return true;
+            if(next == limit) return false;
+            auto end = next + interop::getInstanceSize((interop::Instance*)next);
+            if(end > limit) return false;
+            fill(top, next);
+            top = end;
+        }
+    }
+
+    // 原地固定的对象在所在半空间中的末尾，半空间不能缩小到其之下
+    inline int youngPinnedExtent() const {
+        int extent = 0;
+        for(auto ins : young_pinned){
+            auto semi = inFromSpace(ins) ? from_semi_space : to_semi_space;
+            extent = std::max<int>(extent, (char*)ins + interop::getInstanceSize(ins) - semi);
+        }
+        return extent;
+    }
+
+    // 原地固定的对象不在[from_semi_space, free_semi)之内，按区间遍历新生代时访问不到
+    inline bool outsideNursery(interop::Instance *ins) const {
+        return (char*)ins < from_semi_space || (char*)ins >= free_semi;
+    }
+
+    // 对象中可能存有指向新生代的引用，标记其覆盖的所有卡
+    inline void dirtyPinned(interop::Instance *ins, uint32_t size){
+        std::fill_n(pinned_cards.begin() + pinnedCardOf(ins), (size + card_size - 1) / card_size, 1);
+    }
+
+    // 使老年代已提交的部分至少为size字节，超过保留范围时只提交到保留范围为止
+    inline void commitOld(size_t size){
+        size = std::min(heap::roundUp(size, std::max<size_t>(heap::pageSize(), card_size)), (size_t)(old_reserved_end - old_begin));
+        if(old_begin + size <= old_end) return;
+        heap::commit(old_end, old_begin + size - old_end);
+        old_end = old_begin + size;
+        cards.resize(size / card_size, 0);
+        card_starts.resize(size / card_size, nullptr);
+    }
+
+    // 归还老年代size字节之后已提交的部分
+    inline void decommitOld(size_t size){
+        size = heap::roundUp(size, std::max<size_t>(heap::pageSize(), card_size));
+        if(old_begin + size >= old_end) return;
+        heap::decommit(old_begin + size, old_end - (old_begin + size));
+        old_end = old_begin + size;
+        cards.resize(size / card_size);
+        card_starts.resize(size / card_size);
+    }
+
+    // 调整两个半空间已提交的大小。只在minorGC之后调用，此时to_semi_space为空
+    inline void resizeNursery(int size){
+        size = std::clamp<int>(heap::roundUp(size, heap::pageSize()), min_semi_space_size, max_semi_space_size);
+        if(size < free_semi - from_semi_space || size < youngPinnedExtent() || size == semi_space_size) return;
+        for(auto semi : {from_semi_space, to_semi_space}){
+            if(size > semi_space_size) heap::commit(semi + semi_space_size, size - semi_space_size);
+            else heap::decommit(semi + size, semi_space_size - size);
+        }
+        LOG(MinorGC, "@ resize nursery " << semi_space_size << " -> " << size << std::endl);
+        semi_space_size = size;
+        semi_limit = from_semi_space + semi_space_size;
+        zeroed = std::min(zeroed, semi_limit);
+        updateAllocLimit();
+    }
+
+    // 存活率高说明对象还没来得及死亡，minorGC过于频繁说明分配速度快，两者都扩大新生代；
+    // 存活率低且长时间没有回收时缩小新生代，归还物理内存
+    inline void adaptNursery(int used, int survived){
+        auto now = std::chrono::steady_clock::now();
+        auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_minor_gc).count();
+        last_minor_gc = now;
+        double survival = used == 0 ? 0 : (double)survived / used;
+        if(survival > 0.25 || interval < 10) resizeNursery(semi_space_size * 2);
+        else if(survival < 0.05 && interval > 1000) resizeNursery(semi_space_size / 2);
+    }
+
+    // 在老年代中直接分配放不进新生代的对象
+    inline interop::Instance *allocateOld(runtime::Class *klass, uint32_t size){
+        char *ptr;
+        if(options.incremental){
+            ptr = allocateInTrain(youngestTrain(), size);
+            if(ptr == nullptr){
+                majorGC();
+                ptr = allocateInTrain(youngestTrain(), size);
+            }
+            if(ptr == nullptr) return nullptr;
+        }
+        else{
+            if(remainOldSpace() < size) commitOld(old_free - old_begin + size);
+            if(remainOldSpace() < size){
+                majorGC();
+                commitOld(old_free - old_begin + size);
+            }
+            if(remainOldSpace() < size) return nullptr;
+            ptr = old_free;
+            recordOldObject(old_free, size);
+            old_free += size;
+        }
+        memset(ptr, 0, size);
+        auto ret = (interop::Instance*)ptr;
+        ret->setClass(klass);
+        ret->setAge(tenure_age);
+        return ret;
+    }
+
+    inline uint32_t cardOf(void *ptr) const {
+        return ((char*)ptr - old_begin) >> card_shift;
+    }
+
+    // 记录老年代中新放置的对象覆盖了哪些卡的起点
+    inline void recordOldObject(char *ins, uint32_t size){
+        auto first = cardOf(ins + card_size - 1);
+        auto last = cardOf(ins + size - 1);
+        for(auto card = first; card <= last; card++){
+            card_starts[card] = ins;
+        }
+    }
+
+    // 老年代对象ins中的引用在回收后仍指向新生代时，重新标记对应的卡
+    inline void remember(interop::Instance *ins){
+        forEachRefSlot(ins, [this](interop::Instance **slot){
+            if(inYoung(*slot)) cards[cardOf(slot)] = 1;
+        });
+    }
+
+    // 复制老年代对象ins引用的新生代对象，回收后仍指向新生代的引用重新标记所在的卡
+    inline void scanOldObject(interop::Instance *ins){
+        forEachRefSlot(ins, [this](interop::Instance **slot){
+            copyAndUpdateSlot(slot);
+            if(inYoung(*slot)) cards[cardOf(slot)] = 1;
+            else if(options.incremental) rememberSlot(slot);
+        });
+    }
+
+    // 扫描被标记的卡中的对象，把其中指向新生代的引用作为根。limit之后是本次回收晋升的对象，另行扫描。
+    // 增量模式下扫描到卡所在车厢已分配部分的末尾
+    inline void scanDirtyCards(char *limit){
+        for(uint32_t card = 0; card < cards.size(); card++){
+            if(!cards[card]) continue;
+            cards[card] = 0;
+            auto card_begin = old_begin + card * card_size;
+            auto card_end = card_begin + card_size;
+            if(options.incremental) limit = car_table[carIndexOf(card_begin)].top;
+            auto ptr = card_starts[card];
+            while(ptr < card_end && ptr < limit){
+                auto ins = (interop::Instance*)ptr;
+                scanOldObject(ins);
+                ptr += interop::getInstanceSize(ins);
+            }
+        }
+    }
+
+    inline void updateOldRef(Reference &ref){
+        auto ins = ref.get();
+        if(ins != nullptr && inOld(ins)) ref.set(compactedAddress(ins));
+    }
+
+    inline void updateOldSlot(interop::Instance **slot){
+        if(*slot != nullptr && inOld(*slot)) *slot = compactedAddress(*slot);
+    }
+
+    inline uint32_t carIndexOf(void *ptr) const {
+        return ((char*)ptr - old_begin) >> car_shift;
+    }
+
+    inline char *carBegin(uint32_t index) const {
+        return old_begin + ((size_t)index << car_shift);
+    }
+
+    // 列车编号连续，按与最低列车编号的差找到车厢所在的列车
+    inline Train &trainOf(const Car &car){
+        return trains[(car.order >> 32) - trains.front().number];
+    }
+
+    inline Train &newTrain(){
+        trains.push_back(Train{.number = next_train++, .next_car = 1, .cars = {}});
+        return trains.back();
+    }
+
+    // 晋升的对象放在最年轻的列车
+    inline Train &youngestTrain(){
+        return trains.empty() ? newTrain() : trains.back();
+    }
+
+    // 优先复用已释放的车厢，保留范围用尽时返回no_car
+    inline uint32_t acquireCar(){
+        uint32_t index;
+        if(!free_cars.empty()){
+            index = free_cars.back();
+            free_cars.pop_back();
+        }
+        else if((size_t)(old_reserved_end - old_end) >= car_size){
+            index = carIndexOf(old_end);
+            old_end += car_size;
+            cards.resize((old_end - old_begin) / card_size, 0);
+            card_starts.resize((old_end - old_begin) / card_size, nullptr);
+        }
+        else return no_car;
+        heap::commit(carBegin(index), car_size);
+        return index;
+    }
+
+    inline size_t availableCars() const {
+        return free_cars.size() + (size_t)(old_reserved_end - old_end) / car_size;
+    }
+
+    inline bool appendCar(Train &train){
+        auto index = acquireCar();
+        if(index == no_car) return false;
+        auto &car = car_table[index];
+        car.order = (uint64_t)train.number << 32 | train.next_car++;
+        car.top = carBegin(index);
+        train.cars.push_back(index);
+        return true;
+    }
+
+    // 在列车的最后一节车厢中分配，放不下时加挂一节。没有可用的车厢时返回nullptr
+    inline char *allocateInTrain(Train &train, uint32_t size){
+        if(train.cars.empty() || train.cars.back() == collecting_car
+           || (size_t)(carBegin(train.cars.back()) + car_size - car_table[train.cars.back()].top) < size){
+            if(!appendCar(train)) return nullptr;
+        }
+        auto &car = car_table[train.cars.back()];
+        auto ret = car.top;
+        car.top += size;
+        car_used += size;
+        recordOldObject(ret, size);
+        return ret;
+    }
+
+    // 归还车厢的物理内存并清除其卡表，来自该车厢的记忆集槽位随stamp失效
+    inline void freeCar(uint32_t index){
+        auto &car = car_table[index];
+        auto begin = carBegin(index);
+        LOG_VERBOSE(MinorGC, "free car " << std::hex << (void*)begin << std::dec << ", used " << car.top - begin << std::endl);
+        car_used -= car.top - begin;
+        heap::decommit(begin, car_size);
+        std::fill_n(cards.begin() + cardOf(begin), car_size / card_size, 0);
+        std::fill_n(card_starts.begin() + cardOf(begin), car_size / card_size, nullptr);
+        car.order = 0;
+        car.stamp++;
+        car.top = nullptr;
+        std::vector<RememberedSlot>().swap(car.remembered);
+        car.remembered_limit = remembered_min_limit;
+        free_cars.push_back(index);
+    }
+
+    // 记忆集中的槽位仍位于原来的车厢中，且仍指向index车厢
+    inline bool validRemembered(const RememberedSlot &entry, uint32_t index) const {
+        if(inOld(entry.slot)){
+            auto &source = car_table[carIndexOf(entry.slot)];
+            if(source.order == 0 || source.stamp != entry.stamp) return false;
+        }
+        auto target = *entry.slot;
+        return inOld(target) && carIndexOf(target) == index;
+    }
+
+    inline void compactRemembered(uint32_t index){
+        auto &car = car_table[index];
+        auto &remembered = car.remembered;
+        std::erase_if(remembered, [&](const RememberedSlot &entry){ return !validRemembered(entry, index); });
+        std::sort(remembered.begin(), remembered.end(), [](auto &a, auto &b){ return a.slot < b.slot; });
+        remembered.erase(std::unique(remembered.begin(), remembered.end(), [](auto &a, auto &b){ return a.slot == b.slot; }),
+                         remembered.end());
+        car.remembered_limit = std::max(remembered_min_limit, remembered.size() * 2);
+    }
+
+    // 槽位指向车厢中的对象，且槽位所在的车厢排在目标车厢之后，或位于大对象与固定空间时加入目标车厢的记忆集。
+    // 排在前面的车厢先被回收，回收时复制出的对象会重新检查其中的槽位
+    inline void rememberSlot(interop::Instance **slot){
+        auto target = *slot;
+        if(!inOld(target)) return;
+        auto index = carIndexOf(target);
+        auto &car = car_table[index];
+        if(car.order == 0) return;
+        uint32_t stamp = 0;
+        if(inOld(slot)){
+            auto &source = car_table[carIndexOf(slot)];
+            if(source.order <= car.order) return;
+            stamp = source.stamp;
+        }
+        else if(!inLarge(slot) && !inPinned(slot)) return;
+        car.remembered.push_back(RememberedSlot{slot, stamp});
+        if(car.remembered.size() >= car.remembered_limit) compactRemembered(index);
+    }
+
+    // 把被回收车厢中的对象复制到train的末尾，返回新地址。已复制的对象返回转发地址
+    inline interop::Instance *evacuateCar(interop::Instance *ins, Train &train){
+        if(ins->isForwarded()) return ins->getForward();
+        auto size = interop::getInstanceSize(ins);
+        auto target = allocateInTrain(train, size);
+        if(target == nullptr) outOfMemory();
+        memcpy(target, ins, size);
+        auto moved = (interop::Instance*)target;
+        ins->setForward(moved);
+        increment_evacuated += size;
+        evacuated.push_back(moved);
+        LOG_VERBOSE(MinorGC, "@ evacuate " << std::hex << ins << " to " << moved << std::dec
+            << " in train " << train.number << std::endl);
+        return moved;
+    }
+
+    // 扫描复制出的对象，其中指向被回收车厢的对象复制到同一列车，其余槽位按新位置重新加入记忆集
+    inline void scanEvacuated(uint32_t index){
+        while(!evacuated.empty()){
+            auto ins = evacuated.back();
+            evacuated.pop_back();
+            auto &train = trainOf(car_table[carIndexOf(ins)]);
+            forEachRefSlot(ins, [&](interop::Instance **slot){
+                auto target = *slot;
+                if(inOld(target) && carIndexOf(target) == index) *slot = evacuateCar(target, train);
+                if(inYoung(*slot)) cards[cardOf(slot)] = 1;
+                else rememberSlot(slot);
+            });
+        }
+    }
+
+    // 根集与记忆集中是否有来自列车之外的引用
+    inline bool trainReferenced(const Train &train){
+        auto inTrain = [&](void *ptr){
+            return inOld(ptr) && car_table[carIndexOf(ptr)].order >> 32 == train.number;
+        };
+        for(auto &root : roots){
+            if(inTrain(root.get())) return true;
+        }
+        for(auto index : train.cars){
+            for(auto &entry : car_table[index].remembered){
+                if(validRemembered(entry, index) && !inTrain(entry.slot)) return true;
+            }
+        }
+        return false;
+    }
+
+    // 车厢中有被固定的对象时不能复制，整节移到最年轻的列车末尾。
+    // 车厢此时排在其他车厢之后，其中指向它们的槽位需要加入记忆集
+    inline void relinkCar(Train &train, Train &youngest){
+        auto index = train.cars.front();
+        train.cars.pop_front();
+        auto &car = car_table[index];
+        car.order = (uint64_t)youngest.number << 32 | youngest.next_car++;
+        youngest.cars.push_back(index);
+        for(char *ptr = carBegin(index); ptr < car.top; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            forEachRefSlot((interop::Instance*)ptr, [this](interop::Instance **slot){ rememberSlot(slot); });
+        }
+        LOG(MinorGC, "@ car with pinned objects moved to train " << youngest.number << std::endl);
+    }
+
+    // 回收最低列车的第一节车厢。调用前roots中需要有根集与新生代对象中的槽位，且最低列车不是最年轻的列车
+    inline void collectCar(){
+        auto &train = trains.front();
+        auto &youngest = trains.back();
+        auto index = train.cars.front();
+        auto &car = car_table[index];
+
+        if(!trainReferenced(train)){
+            LOG(MinorGC, "@ train " << train.number << " is unreachable, free " << train.cars.size() << " cars" << std::endl);
+            for(auto car_index : train.cars) freeCar(car_index);
+            increment_cars += train.cars.size();
+            train.cars.clear();
+            return;
+        }
+
+        for(char *ptr = carBegin(index); ptr < car.top; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            if(((interop::Instance*)ptr)->isPinned()){
+                relinkCar(train, youngest);
+                return;
+            }
+        }
+
+        collecting_car = index;
+        auto remembered = std::move(car.remembered);
+        car.remembered.clear();
+        for(auto &root : roots){
+            auto ins = root.get();
+            if(inOld(ins) && carIndexOf(ins) == index) root.set(evacuateCar(ins, youngest));
+        }
+        scanEvacuated(index);
+        // 先处理来自其他列车的引用，使同时被本列车引用的对象离开本列车
+        for(int pass = 0; pass < 2; pass++){
+            for(auto &entry : remembered){
+                if(!validRemembered(entry, index)) continue;
+                auto &source = inOld(entry.slot) ? trainOf(car_table[carIndexOf(entry.slot)]) : youngest;
+                if((&source == &train) != (pass == 1)) continue;
+                *entry.slot = evacuateCar(*entry.slot, source);
+                rememberSlot(entry.slot);
+            }
+            scanEvacuated(index);
+        }
+        collecting_car = no_car;
+
+        train.cars.pop_front();
+        freeCar(index);
+        increment_cars++;
+    }
+
+    // 本轮开始时存在的列车都已回收后，剩余的使用量近似为存活数据量，下一轮在其翻倍时开始
+    inline void popTrain(){
+        auto number = trains.front().number;
+        trains.pop_front();
+        if(number >= round_end){
+            car_threshold = std::clamp(car_used * 2, options.min, std::max(options.min, options.max));
+            round_end = next_train - 1;
+            LOG(MinorGC, "@ train round finished, cars used " << car_used << ", next threshold " << car_threshold << std::endl);
+        }
+    }
 
-    std::map<uintptr_t,Reference> root_set;
+    // 增量模式下的majorGC，在车厢用尽或大对象与固定空间超过阈值时进行。车厢中的对象不移动：
+    // 没有存活对象的车厢整节释放，其余车厢中的死对象替换为填充对象，之后按存活对象重建所有记忆集
+    inline void majorGCTrains(){
+        auto start = gcstats::Clock::now();
+        auto before = matureUsed();
+        collectRoots();
+        markReachable([](interop::Instance*){});
+        auto marked = gcstats::Clock::now();
+        std::erase_if(young_pinned, [](interop::Instance *ins){ return !ins->isMarked(); });
+
+        for(auto &train : trains){
+            std::deque<uint32_t> kept;
+            for(auto index : train.cars){
+                auto &car = car_table[index];
+                bool live = false;
+                for(char *ptr = carBegin(index); ptr < car.top && !live; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+                    live = ((interop::Instance*)ptr)->isMarked();
+                }
+                if(!live){
+                    freeCar(index);
+                    continue;
+                }
+                for(char *ptr = carBegin(index); ptr < car.top;){
+                    auto ins = (interop::Instance*)ptr;
+                    auto size = interop::getInstanceSize(ins);
+                    if(ins->isMarked()) ins->setMarked(false);
+                    else fill(ptr, ptr + size);
+                    ptr += size;
+                }
+                car.remembered.clear();
+                kept.push_back(index);
+            }
+            train.cars = std::move(kept);
+        }
+        for(char *ptr = from_semi_space; ptr < free_semi; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            ((interop::Instance*)ptr)->setMarked(false);
+        }
+        for(auto ins : young_pinned) ins->setMarked(false);
+        forEachPinned([&](interop::Instance *ins, uint32_t size_class){
+            if(ins->isMarked()) ins->setMarked(false);
+            else freePinned(ins, size_class);
+        });
+        for(auto itr = large_objects.begin(); itr != large_objects.end();){
+            auto ins = (interop::Instance*)itr->first;
+            if(!ins->isMarked()){
+                freeLarge(itr->first, itr->second);
+                itr = large_objects.erase(itr);
+                continue;
+            }
+            ins->setMarked(false);
+            itr++;
+        }
+
+        auto remember_all = [this](interop::Instance *ins){
+            forEachRefSlot(ins, [this](interop::Instance **slot){ rememberSlot(slot); });
+        };
+        for(auto &train : trains){
+            for(auto index : train.cars){
+                for(char *ptr = carBegin(index); ptr < car_table[index].top; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+                    remember_all((interop::Instance*)ptr);
+                }
+            }
+        }
+        forEachPinned([&](interop::Instance *ins, uint32_t){ remember_all(ins); });
+        for(auto &[ptr, bytes] : large_objects) remember_all((interop::Instance*)ptr);
+
+        old_threshold = std::clamp((large_used + pinned_used) * 2, options.min, std::max(options.min, options.max));
+        auto end = gcstats::Clock::now();
+        stats.recordMajor(gcstats::MajorCycle{
+            .pause = gcstats::elapsed(start, end),
+            .mark = gcstats::elapsed(start, marked),
+            .compact = gcstats::elapsed(marked, end),
+            .before = before,
+            .after = matureUsed()
+        });
+        LOG(MinorGC, "@ MajorGC finished. cars " << car_used << ", large " << large_used << ", pinned " << pinned_used
+            << std::endl << std::endl);
+    }
 
 public:
     inline int remainSemiSpace() const{
-        return semi_space_size - (free_semi - from_semi_space);
+        return semi_limit - free_semi;
+    }
+
+    inline size_t remainOldSpace() const{
+        return old_end - old_free;
     }
 
-    inline GarbageCollector(int semi_space_size) : semi_space_size(semi_space_size){
-        space_begin = (char*)malloc(semi_space_size * 2);
-        space_end = space_begin + semi_space_size * 2;
+    inline GarbageCollector(const heap::Options &options) : options(options){
+        auto page = heap::pageSize();
+        semi_space_size = std::max<size_t>(heap::roundUp(options.nursery, page), min_semi_space_size);
+        max_semi_space_size = std::max<size_t>(semi_space_size, heap::roundUp(options.max / 8, page));
+        space_begin = (char*)heap::reserve((size_t)max_semi_space_size * 2, options.huge_pages);
+        space_end = space_begin + (size_t)max_semi_space_size * 2;
+
+        nursery_start = free_semi = from_semi_space = space_begin;
+        to_semi_space = space_begin + max_semi_space_size;
+        heap::commit(from_semi_space, semi_space_size);
+        heap::commit(to_semi_space, semi_space_size);
+        // 新提交的页由系统清零
+        zeroed = semi_limit = from_semi_space + semi_space_size;
+        alloc_limit = semi_limit;
+        sample_mark = free_semi;
+        last_minor_gc = std::chrono::steady_clock::now();
+
+        // 增量模式下老年代按车厢提交，对象不能跨越车厢
+        auto old_max = heap::roundUp(std::max(options.max, options.min), options.incremental ? car_size : std::max<size_t>(page, card_size));
+        old_free = old_end = old_begin = (char*)heap::reserve(old_max, options.huge_pages);
+        old_reserved_end = old_begin + old_max;
+        old_threshold = std::min(options.min, old_max);
+        if(options.incremental){
+            this->options.large_object = std::min<size_t>(options.large_object, car_size / 2);
+            car_table.resize(old_max / car_size);
+            car_threshold = old_threshold;
+        }
+        else{
+            commitOld(old_threshold);
+        }
+
+        large_top = large_begin = (char*)heap::reserve(old_max, options.huge_pages);
+        large_end = large_begin + old_max;
+
+        auto pinned_max = heap::roundUp(old_max, pinned_page_size);
+        pinned_top = pinned_begin = (char*)heap::reserve(pinned_max, false);
+        pinned_end = pinned_begin + pinned_max;
 
-        free_semi = from_semi_space = space_begin;
-        to_semi_space = space_begin + semi_space_size;
+        handles.prev = handles.next = &handles;
+
+        // 增量模式下晋升的对象分散在各列车中，minorGC只使用单线程
+        auto threads = options.gc_threads == 0 ? std::max(1u, std::thread::hardware_concurrency()) : options.gc_threads;
+        if(threads > 1 && !options.incremental){
+            pool = std::make_unique<gcworkers::Pool>(threads);
+            for(unsigned i = 0; i < threads; i++) scavengers.push_back(std::make_unique<Scavenger>());
+        }
+        // 原地固定的对象、LAB的剩余部分和疏散后的车厢都需要填充，与回收模式无关
+        filler_word = std::make_unique<runtime::FillerClass>(true);
+        filler_array = std::make_unique<runtime::FillerClass>(false);
     }
 
-    inline void addRoot(uintptr_t id, Reference reference){
-        if(id!=reference.getID())throw ""; //debug
-        if(reference.get()!=nullptr && reference.get()->klass==nullptr)throw "";//debug
-        root_set.insert({id, reference});
+    inline ~GarbageCollector(){
+        heap::release(space_begin, space_end - space_begin);
+        heap::release(old_begin, old_reserved_end - old_begin);
+        heap::release(large_begin, large_end - large_begin);
+        heap::release(pinned_begin, pinned_end - pinned_begin);
     }
 
-    inline void removeRoot(uintptr_t id){
-        root_set.erase(id);
+    inline void addRootProvider(RootProvider *provider){
+        providers.push_back(provider);
     }
 
-    inline void addRoot(interop::Instance **ptr){
-        root_set.insert({(uintptr_t)ptr, Reference::fromRefPtr(ptr)});
+    inline void removeRootProvider(RootProvider *provider){
+        providers.erase(std::find(providers.begin(), providers.end(), provider));
     }
 
-    inline void removeRoot(interop::Instance** ptr) {
-        root_set.erase((uintptr_t)ptr);
+    // 静态字段中的引用，由Loader在链接时按各作用域的静态引用表登记
+    inline void addStaticRoot(interop::Instance **ptr){
+        static_roots.push_back(ptr);
+    }
+
+    inline void addHandle(interop::Handle *handle){
+        handle->prev = &handles;
+        handle->next = handles.next;
+        handles.next->prev = handle;
+        handles.next = handle;
+    }
+
+    inline void removeHandle(interop::Handle *handle){
+        handle->prev->next = handle->next;
+        handle->next->prev = handle->prev;
+        handle->prev = handle->next = nullptr;
     }
 
     inline bool isYoung(Reference &ref){ 
-        auto pos = (char*)ref.get();
-        return pos >= space_begin && pos < space_end;    
+        return inYoung(ref.get());
     }
 
-    inline interop::Instance *allocate(runtime::Class *klass, uint32_t size){
-        if(remainSemiSpace() < size) {
+    // 写屏障。向slot写入引用后调用，slot位于老年代、大对象空间或固定空间时标记所在的卡。
+    // 增量模式下同时维护车厢的记忆集
+    inline void writeBarrier(void *slot){
+        if(inOld(slot)) cards[cardOf(slot)] = 1;
+        else if(inLarge(slot)) large_cards[largeCardOf(slot)] = 1;
+        else if(inPinned(slot)) pinned_cards[pinnedCardOf(slot)] = 1;
+        if(options.incremental) rememberSlot((interop::Instance**)slot);
+    }
+
+    // 不回收区域中的分配超出预留。options.nogc_overflow为false时记录超出，由Processor抛出GCBudgetExceeded。
+    // 之后区域中的分配不再受预留限制，用完新生代后直接分配在老年代，同样不回收
+    inline void overBudget(){
+        if(!options.nogc_overflow) budget_exceeded = true;
+        LOG(MinorGC, "@ no-GC region exceeded its budget" << std::endl);
+        semi_limit = from_semi_space + semi_space_size;
+        updateAllocLimit();
+    }
+
+    // 不在新生代中的分配同样从预留中扣除
+    inline void chargeBudget(size_t bytes){
+        if((size_t)remainSemiSpace() >= bytes){
+            semi_limit -= bytes;
+            updateAllocLimit();
+        }
+        else overBudget();
+    }
+
+    // 开始不回收区域。最外层区域在进入时按需进行一次minorGC并扩大新生代，使新生代中至少剩余budget字节，
+    // 区域中的分配都从这部分预留中扣除。嵌套的区域共用外层区域剩余的预留。
+    // 无法预留budget字节时返回false，不进入区域
+    inline bool enterNoGC(size_t budget){
+        if(nogc_depth > 0){
+            if((size_t)remainSemiSpace() < budget) return false;
+            nogc_depth++;
+            return true;
+        }
+        if(budget > (size_t)max_semi_space_size) return false;
+        if((size_t)remainSemiSpace() < budget){
             minorGC();
+            if((size_t)remainSemiSpace() < budget) resizeNursery(free_semi - from_semi_space + budget);
+            if((size_t)remainSemiSpace() < budget) return false;
         }
+        nogc_depth = 1;
+        semi_limit = free_semi + budget;
+        updateAllocLimit();
+        LOG(MinorGC, "@ enter no-GC region, budget " << budget << std::endl);
+        return true;
+    }
 
-        if(remainSemiSpace() < size) {
-            throw std::invalid_argument("out of heap memory");
-            //return nullptr;
+    // 结束一层不回收区域。最外层区域结束后恢复新生代的上限，区域中推迟的回收在之后的分配中进行
+    inline void exitNoGC(){
+        if(nogc_depth == 0) return;
+        if(--nogc_depth > 0) return;
+        semi_limit = from_semi_space + semi_space_size;
+        updateAllocLimit();
+        LOG(MinorGC, "@ exit no-GC region" << std::endl);
+    }
+
+    inline bool inNoGCRegion() const {
+        return nogc_depth > 0;
+    }
+
+    // 返回并清除超出预留的记录
+    inline bool takeBudgetExceeded(){
+        auto exceeded = budget_exceeded;
+        budget_exceeded = false;
+        return exceeded;
+    }
+
+    // 采样间隔服从指数分布，避免与固定的分配模式同步
+    inline int64_t nextSampleDistance(){
+        return std::max<int64_t>(1, (int64_t)sample_distance(sample_random));
+    }
+
+    // 倒计数耗尽时调用，跨过几个采样点就计入几倍的间隔
+    inline void sampleAllocation(runtime::Class *klass){
+        if(sampler == nullptr){
+            sample_countdown = INT64_MAX;
+            return;
+        }
+        uint64_t samples = 0;
+        while(sample_countdown <= 0){
+            sample_countdown += nextSampleDistance();
+            samples++;
         }
-        LOG(MinorGC, "allocate:"<<size<<" at "<<std::hex<<(uintptr_t)free_semi <<std::dec<<" remain:"<< remainSemiSpace() - size<<std::endl);
-        memset(free_semi, 0, size);
+        sampler->sampleAllocation(klass, samples * sample_interval);
+    }
+
+    // 设置为nullptr时停止采样
+    inline void setAllocationSampler(AllocationSampler *allocation_sampler, uint64_t interval){
+        sampler = allocation_sampler;
+        sample_interval = std::max<uint64_t>(interval, 1);
+        sample_distance = std::exponential_distribution<double>(1.0 / sample_interval);
+        sample_countdown = sampler == nullptr ? INT64_MAX : nextSampleDistance();
+        sample_mark = free_semi;
+        updateAllocLimit();
+    }
+
+    // 把上一次同步之后快速路径中的分配从倒计数中扣除
+    inline void syncSample(){
+        sample_countdown -= free_semi - sample_mark;
+        sample_mark = free_semi;
+    }
+
+    // 计入不经过快速路径的分配，跨过采样点时采样
+    inline void countSlowAllocation(runtime::Class *klass, uint32_t size){
+        syncSample();
+        if((sample_countdown -= size) <= 0) [[unlikely]] sampleAllocation(klass);
+        updateAllocLimit();
+    }
+
+    inline void updateAllocLimit(){
+        syncSample();
+        alloc_limit = std::min(zeroed, semi_limit);
+        if(sampler != nullptr && sample_countdown < alloc_limit - free_semi){
+            alloc_limit = free_semi + std::max<int64_t>(sample_countdown, 0);
+        }
+    }
+
+    // 清零分配指针之后至少size字节，一次清零zero_chunk字节，不越过原地固定的对象
+    inline void zeroAhead(uint32_t size){
+        auto end = std::min(nextYoungPinned(zeroed, from_semi_space + semi_space_size), std::max(zeroed + zero_chunk, free_semi + size));
+        memset(zeroed, 0, end - zeroed);
+        zeroed = end;
+    }
+
+    // 新生代中能否从free_semi分配size字节，必要时跳过原地固定的对象
+    inline bool fitsYoung(uint32_t size){
+        if(young_pinned.empty()) return (size_t)remainSemiSpace() >= size;
+        return skipYoungPinned(free_semi, semi_limit, size);
+    }
+
+    // 快速路径放不下时调用：采样、回收、分配大对象或直接分配在老年代，以及预先清零新生代
+    inline interop::Instance *allocateSlow(runtime::Class *klass, uint32_t size){
+        countSlowAllocation(klass, size);
+        if(size >= options.large_object){
+            if(nogc_depth > 0) chargeBudget(heap::roundUp(size, std::max<size_t>(heap::pageSize(), card_size)));
+            if(auto ins = allocateLarge(klass, size)){
+                stats.addAllocated(size);
+                return ins;
+            }
+            outOfMemory();
+        }
+
+        if(!fitsYoung(size)) {
+            if(nogc_depth > 0) overBudget();
+            else minorGC();
+        }
+
+        if(!fitsYoung(size)) {
+            if(nogc_depth > 0) chargeBudget(size);
+            if(auto ins = allocateOld(klass, size)){
+                stats.addAllocated(size);
+                return ins;
+            }
+            outOfMemory();
+        }
+        LOG_VERBOSE(MinorGC, "allocate:"<<size<<" at "<<std::hex<<(uintptr_t)free_semi <<std::dec<<" remain:"<< remainSemiSpace() - size<<std::endl);
+        zeroed = std::max(zeroed, free_semi);
+        if((size_t)(zeroed - free_semi) < size) zeroAhead(size);
+        auto ret = (interop::Instance*)free_semi;
+        ret->setClass(klass);
+        free_semi += size;
+        sample_mark = free_semi;
+        updateAllocLimit();
+        return ret;
+    }
+
+    // 分配并清零size字节，对象头中设置类序号。新生代中的分配只移动分配指针，空间已预先清零
+    inline interop::Instance *allocate(runtime::Class *klass, uint32_t size){
+        size = interop::alignObjectSize(size);
+        if((size_t)(alloc_limit - free_semi) < size) [[unlikely]] return allocateSlow(klass, size);
         auto ret = (interop::Instance*)free_semi;
-        ret->klass = klass;
         free_semi += size;
+        ret->header = (uint64_t)klass->getClassIndex() << interop::Instance::class_shift;
+        return ret;
+    }
+
+    // 在固定空间中分配已固定的对象，之后不会被移动，Pin/Unpin只改变对象头中的标记。
+    // 超过最大规格的对象放在同样不移动的大对象空间
+    inline interop::Instance *allocatePinned(runtime::Class *klass, uint32_t size){
+        size = interop::alignObjectSize(size);
+        countSlowAllocation(klass, size);
+        if(size > pinned_size_classes[pinned_class_count - 1]){
+            if(nogc_depth > 0) chargeBudget(heap::roundUp(size, std::max<size_t>(heap::pageSize(), card_size)));
+            auto ins = allocateLarge(klass, size);
+            if(ins == nullptr) outOfMemory();
+            ins->setPinned(true);
+            stats.addAllocated(size);
+            return ins;
+        }
+        uint32_t size_class = std::lower_bound(pinned_size_classes, pinned_size_classes + pinned_class_count, size) - pinned_size_classes;
+        auto bytes = pinned_size_classes[size_class];
+        if(nogc_depth > 0) chargeBudget(bytes);
+        if(overMajorThreshold(bytes)) majorGC();
+        if(pinned_free[size_class] == nullptr && !refillPinned(size_class)){
+            majorGC();
+            if(pinned_free[size_class] == nullptr) outOfMemory();
+        }
+        auto block = pinned_free[size_class];
+        pinned_free[size_class] = *(char**)(block + sizeof(interop::Instance));
+        memset(block, 0, bytes);
+        pinned_used += bytes;
+        stats.addAllocated(bytes);
+        auto ret = (interop::Instance*)block;
+        ret->setClass(klass);
+        ret->setAge(tenure_age);
+        ret->setPinned(true);
+        LOG_VERBOSE(MinorGC, "allocate pinned:" << size << " at " << std::hex << (uintptr_t)block << std::dec << std::endl);
         return ret;
     }
 
     inline interop::Instance *allocate(runtime::Class *klass){
         //return (interop::Instance*)malloc(klass->getInstanceMemorySize());
-        auto ins = allocate(klass, klass->getInstanceMemorySize());
-        ins->klass = klass;
-        return ins;
+        return allocate(klass, klass->getInstanceMemorySize());
     }
 
     inline unicode::string debugRunesString(interop::Instance *ins){
         unicode::string ret;
-        //if(ins->klass->name == "Rune[]"_utf32){
+        //if(ins->getClass()->name == "Rune[]"_utf32){
         //    auto arr = (interop::ArrayInstance*)ins;
         //    uint32_t *ptr = (uint32_t*)((uint8_t*)ins + sizeof(interop::ArrayInstance));
         //    for(int i=0;i<arr->length;i++){
         //        ret.push_back(ptr[i]);
         //    }
         //}
-        //else if(ins->klass->name == "String"_utf32){
+        //else if(ins->getClass()->name == "String"_utf32){
         //    auto runeArray = ((interop::StringInstance*)ins)->runes;
         //    unicode::codepoint *ptr = (unicode::codepoint*)(((uint8_t*)runeArray) + sizeof(interop::ArrayInstance));
         //    return unicode::string(ptr,runeArray->length);
@@ -183,148 +1355,709 @@ public:
         return ret;
     }
 
+    // 把新生代对象ins复制到另一个半空间或晋升到老年代，返回其新地址。已被复制的对象直接返回转发地址，
+    // 被固定的对象留在原处
+    inline interop::Instance *evacuate(interop::Instance *ins){
+        if(ins->isForwarded()) return ins->getForward();
+        if(ins->isPinned()) return ins;
+        auto ins_size = interop::getInstanceSize(ins);
+        // 年龄达到阈值且老年代有空间时晋升，否则复制到另一个半空间。增量模式下晋升到最年轻的列车。
+        // to-space中原地固定的对象占去一部分空间，放不下时同样晋升
+        auto promoteTarget = [&]() -> char* {
+            if(options.incremental) return allocateInTrain(youngestTrain(), ins_size);
+            return remainOldSpace() >= ins_size ? old_free : nullptr;
+        };
+        char *target = nullptr;
+        if(ins->getAge() + 1 >= tenure_age) target = promoteTarget();
+        bool promote = target != nullptr;
+        if(!promote && !skipYoungPinned(free_semi, to_semi_space + semi_space_size, ins_size)){
+            target = promoteTarget();
+            if(target == nullptr) throw std::runtime_error("no space for survivors in minorGC");
+            promote = true;
+        }
+        if(!promote) target = free_semi;
+        LOG_VERBOSE(MinorGC, "@ " << (promote ? "promote " : "move survivor ") <<std::hex<<ins<<std::dec<<"("<<ins->getClass()->name
+            <<debugRunesString(ins)
+            <<", size "<< ins_size <<", age "<< (int)ins->getAge() <<") to "
+            <<std::hex<< (void*)target <<std::dec<<std::endl);
+
+        //copy to new space
+        memcpy(target, ins, ins_size);
+        auto moved = (interop::Instance*)target;
+        //increase age
+        moved->setAge(ins->getAge() + 1);
+
+        //复制完成后转发地址覆盖原对象的对象头
+        ins->setForward(moved);
+
+        if(promote && options.incremental){
+            promoted.push_back(moved);
+        }
+        else if(promote){
+            recordOldObject(old_free, ins_size);
+            old_free += ins_size;
+        }
+        else{
+            free_semi += ins_size;
+        }
+        return moved;
+    }
+
     inline void copyAndUpdateRef(Reference &ref){
-        if(isYoung(ref)){
-            if(ref.get()->forward == 0){ //未被移动的对象
-                LOG(MinorGC, "@ move survivor "<<std::hex<<ref.get()<<std::dec<<"("<<ref.get()->klass->name
-                    <<debugRunesString(ref.get())
-                    <<", size "<< interop::getInstanceSize(ref.get()) <<", age "<< (int)ref.get()->age <<") to "
-                    <<std::hex<< (void*)free_semi <<std::dec<<std::endl);
-                
-                auto ins_size = interop::getInstanceSize(ref.get());
-                //set forward address
-                ref.get()->forward = (interop::Instance*)free_semi;
-
-                //copy to new space
-                memcpy(free_semi, ref.get(), ins_size);
-
-                //update this reference to new place inside root instance
-                ref.updateForward();
-                //increase age
-                ref.get()->age++;
-
-                free_semi += ins_size;
+        if(inFromSpace(ref.get())){
+            ref.set(evacuate(ref.get()));
+        }
+    }
+
+    // 对象中的引用槽位，不经过Reference。跨越多张脏卡的老年代对象会被扫描多次，
+    // 此时槽位可能已指向to-space
+    inline void copyAndUpdateSlot(interop::Instance **slot){
+        if(inFromSpace(*slot)) *slot = evacuate(*slot);
+    }
+
+    inline static void dirty(uint8_t &card){
+        std::atomic_ref<uint8_t>(card).store(1, std::memory_order_relaxed);
+    }
+
+    // 把[begin, end)填充为不含引用的对象
+    inline void fill(char *begin, char *end){
+        if(begin == end) return;
+        auto filler = (interop::Instance*)begin;
+        filler->header = 0;
+        if(end - begin == sizeof(interop::Instance)){
+            filler->setClass(filler_word.get());
+        }
+        else{
+            filler->setClass(filler_array.get());
+            ((interop::ArrayInstance*)begin)->length = end - begin - sizeof(interop::ArrayInstance);
+        }
+    }
+
+    // 从共享的分配指针top中切出至少size字节、至多want字节，不超过limit。chunk_end为切出部分的末尾
+    inline static char *carve(char *&top, char *limit, size_t size, size_t want, char *&chunk_end){
+        std::atomic_ref<char*> shared(top);
+        auto current = shared.load(std::memory_order_relaxed);
+        while(true){
+            auto available = (size_t)(limit - current);
+            if(available < size) return nullptr;
+            auto take = std::min(want, available);
+            if(shared.compare_exchange_weak(current, current + take, std::memory_order_relaxed)){
+                chunk_end = current + take;
+                return current;
             }
-            else{ //已经移动的对象
-                ref.updateForward();
+        }
+    }
+
+    // 填充LAB中未用完的部分，老年代中的填充对象同样登记到card_starts
+    inline void retireLab(char *&top, char *&end, bool old){
+        if(top != end){
+            fill(top, end);
+            if(old) recordOldObject(top, end - top);
+        }
+        top = end = nullptr;
+    }
+
+    inline char *allocateInLab(char *&top, char *&end, char *&shared_top, char *limit, uint32_t size, bool old){
+        if((size_t)(end - top) < size){
+            retireLab(top, end, old);
+            char *chunk_end;
+            auto chunk = carve(shared_top, limit, size, std::max<size_t>(lab_size, size), chunk_end);
+            if(chunk == nullptr) return nullptr;
+            top = chunk;
+            end = chunk_end;
+        }
+        auto ret = top;
+        top += size;
+        return ret;
+    }
+
+    // evacuate的并行版本。先把对象复制到本线程的LAB，再用CAS把转发地址写入原对象的对象头，
+    // CAS失败说明其他线程已复制该对象，撤销本次分配并返回其转发地址
+    inline interop::Instance *evacuateParallel(interop::Instance *ins, Scavenger &self){
+        std::atomic_ref<uint64_t> header(ins->header);
+        auto original = header.load(std::memory_order_acquire);
+        if(original & interop::Instance::forwarded_bit) return (interop::Instance*)(original & ~(uint64_t)7);
+        interop::Instance snapshot{original};
+        auto size = interop::getInstanceSize(ins, snapshot.getClass());
+        auto to_end = to_semi_space + semi_space_size;
+
+        // 年龄达到阈值时晋升，to-space放不下时同样晋升
+        bool promote = snapshot.getAge() + 1 >= tenure_age;
+        char *target = nullptr;
+        if(promote) target = allocateInLab(self.plab_top, self.plab_end, old_free, old_end, size, true);
+        if(target == nullptr){
+            promote = false;
+            target = allocateInLab(self.lab_top, self.lab_end, free_semi, to_end, size, false);
+        }
+        if(target == nullptr){
+            promote = true;
+            target = allocateInLab(self.plab_top, self.plab_end, old_free, old_end, size, true);
+        }
+        if(target == nullptr) throw std::runtime_error("no space for survivors in parallel minorGC");
+
+        memcpy(target + sizeof(interop::Instance), (char*)ins + sizeof(interop::Instance), size - sizeof(interop::Instance));
+        auto moved = (interop::Instance*)target;
+        moved->header = original;
+        moved->setAge(snapshot.getAge() + 1);
+        auto forward = (uint64_t)moved | interop::Instance::forwarded_bit;
+        if(!header.compare_exchange_strong(original, forward, std::memory_order_acq_rel, std::memory_order_acquire)){
+            if(promote) self.plab_top -= size;
+            else self.lab_top -= size;
+            return (interop::Instance*)(original & ~(uint64_t)7);
+        }
+        if(promote) recordOldObject(target, size);
+        self.local.push_back(moved);
+        return moved;
+    }
+
+    inline void copyAndUpdateSlotParallel(interop::Instance **slot, Scavenger &self){
+        if(inFromSpace(*slot)) *slot = evacuateParallel(*slot, self);
+    }
+
+    // 扫描已复制的对象。晋升的对象中仍指向新生代的引用需要标记所在的卡
+    inline void scanParallel(interop::Instance *ins, Scavenger &self){
+        if(inOld(ins)){
+            forEachRefSlot(ins, [&](interop::Instance **slot){
+                copyAndUpdateSlotParallel(slot, self);
+                if(inYoung(*slot)) dirty(cards[cardOf(slot)]);
+            });
+        }
+        else{
+            forEachRefSlot(ins, [&](interop::Instance **slot){ copyAndUpdateSlotParallel(slot, self); });
+        }
+    }
+
+    // 脏卡在开始前已清除并分给各线程。只处理卡范围之内的槽位，每个槽位只由一个线程更新
+    inline void scanOldCardParallel(uint32_t card, char *limit, Scavenger &self){
+        auto card_begin = old_begin + card * card_size;
+        auto card_end = card_begin + card_size;
+        auto ptr = card_starts[card];
+        while(ptr < card_end && ptr < limit){
+            auto ins = (interop::Instance*)ptr;
+            forEachRefSlotIn(ins, card_begin, card_end, [&](interop::Instance **slot){
+                copyAndUpdateSlotParallel(slot, self);
+                if(inYoung(*slot)) dirty(cards[card]);
+            });
+            ptr += interop::getInstanceSize(ins);
+        }
+    }
+
+    inline void scanLargeCardParallel(uint32_t card, Scavenger &self){
+        auto card_begin = large_begin + card * card_size;
+        auto itr = large_objects.upper_bound(card_begin);
+        if(itr == large_objects.begin()) return;
+        itr--;
+        if(card_begin >= itr->first + itr->second) return;
+        forEachRefSlotIn((interop::Instance*)itr->first, card_begin, card_begin + card_size, [&](interop::Instance **slot){
+            copyAndUpdateSlotParallel(slot, self);
+            if(inYoung(*slot)) dirty(large_cards[card]);
+        });
+    }
+
+    inline void scanPinnedCardParallel(uint32_t card, Scavenger &self){
+        auto card_begin = pinned_begin + card * card_size;
+        auto card_end = card_begin + card_size;
+        forEachPinnedIn(card_begin, card_end, [&](interop::Instance *ins, uint32_t){
+            forEachRefSlotIn(ins, card_begin, card_end, [&](interop::Instance **slot){
+                copyAndUpdateSlotParallel(slot, self);
+                if(inYoung(*slot)) dirty(pinned_cards[card]);
+            });
+        });
+    }
+
+    inline static void takeDirtyCards(std::vector<uint8_t> &table, std::vector<uint32_t> &out){
+        out.clear();
+        for(uint32_t card = 0; card < table.size(); card++){
+            if(!table[card]) continue;
+            table[card] = 0;
+            out.push_back(card);
+        }
+    }
+
+    inline bool stealWork(unsigned index){
+        auto &self = *scavengers[index];
+        for(size_t i = 1; i < scavengers.size(); i++){
+            auto &victim = *scavengers[(index + i) % scavengers.size()];
+            if(victim.queue.steal(self.local)) return true;
+        }
+        return false;
+    }
+
+    inline bool hasQueuedWork() const {
+        for(auto &scavenger : scavengers){
+            if(scavenger->queue.size() > 0) return true;
+        }
+        return false;
+    }
+
+    // 每个线程先处理分到的根与脏卡，再扫描复制的对象直到所有线程都没有任务
+    inline void scavengeWorker(unsigned index, char *old_limit, gcworkers::Terminator &terminator){
+        auto &self = *scavengers[index];
+        auto count = (unsigned)scavengers.size();
+        auto begin = gcstats::Clock::now();
+        for(size_t i = index; i < roots.size(); i += count){
+            auto ins = roots[i].get();
+            if(inFromSpace(ins)) roots[i].set(evacuateParallel(ins, self));
+        }
+        for(size_t i = index; i < dirty_old.size(); i += count) scanOldCardParallel(dirty_old[i], old_limit, self);
+        for(size_t i = index; i < dirty_large.size(); i += count) scanLargeCardParallel(dirty_large[i], self);
+        for(size_t i = index; i < dirty_pinned.size(); i += count) scanPinnedCardParallel(dirty_pinned[i], self);
+        self.root_scan = gcstats::elapsed(begin, gcstats::Clock::now());
+
+        while(true){
+            while(!self.local.empty()){
+                auto ins = self.local.back();
+                self.local.pop_back();
+                scanParallel(ins, self);
+                if(self.local.size() > publish_threshold && self.queue.size() == 0){
+                    auto half = self.local.size() / 2;
+                    self.queue.push(self.local.data(), self.local.data() + half);
+                    self.local.erase(self.local.begin(), self.local.begin() + half);
+                }
             }
+            if(self.queue.steal(self.local) || stealWork(index)) continue;
+            auto stolen = terminator.idle([&]{ return hasQueuedWork(); },
+                                          [&]{ return self.queue.steal(self.local) || stealWork(index); });
+            if(!stolen) break;
         }
+        retireLab(self.lab_top, self.lab_end, false);
+        retireLab(self.plab_top, self.plab_end, true);
     }
 
-    inline void minorGC(){
-        LOG(MinorGC, "@ trigger minorGC. usage " << semi_space_size << "/" << free_semi - from_semi_space << std::endl);
+    // 并行复制新生代中的存活对象，返回各线程扫描根与卡表的最长时间
+    inline uint64_t scavengeParallel(char *old_limit){
+        takeDirtyCards(cards, dirty_old);
+        takeDirtyCards(large_cards, dirty_large);
+        takeDirtyCards(pinned_cards, dirty_pinned);
+        collectRoots();
+        lab_size = std::clamp<size_t>(semi_space_size / (scavengers.size() * 16), 1 << 10, 32 << 10) & ~(size_t)7;
+        gcworkers::Terminator terminator(scavengers.size());
+        pool->run([&](unsigned index){ scavengeWorker(index, old_limit, terminator); });
+        uint64_t root_scan = 0;
+        for(auto &scavenger : scavengers) root_scan = std::max(root_scan, scavenger->root_scan);
+        return root_scan;
+    }
 
-        //reset forward field in all young object
-        char *unreseted = from_semi_space;
-        while(unreseted < free_semi){
-            auto ins = (interop::Instance*)unreseted;
-            ins->forward = 0;
-            unreseted += interop::getInstanceSize(ins);
+    inline void minorGC(){
+        if(nogc_depth > 0) return;
+        if(snapshot_requested){
+            snapshot_requested = 0;
+            dumpSnapshot();
         }
+        LOG(MinorGC, "@ trigger minorGC. usage " << semi_space_size << "/" << free_semi - from_semi_space
+            << ", old " << old_end - old_begin << "/" << old_free - old_begin << std::endl);
+
+        int used = free_semi - from_semi_space;
+        auto start = gcstats::Clock::now();
 
+        // 新生代对象的对象头在回收开始时都不含转发地址，回收后from_semi_space中存活对象的对象头被转发地址覆盖
+        char *from_end = free_semi;
+        syncSample();
         free_semi = to_semi_space;
         char *unscanned = to_semi_space;
+        char *unscanned_old = old_free;
+        auto old_used = oldUsed();
+        uint64_t root_scan;
 
-        for(auto [_,root] : root_set){
-            //root.get()->klass->name == "OutOfRangeException"
-            copyAndUpdateRef(root);
+        // 并行复制时LAB的剩余部分会浪费少量空间，to-space放不下的对象晋升到老年代，
+        // 因此老年代需要能容纳全部的新生代对象。有原地固定的对象时分配需要跳过它们，只串行复制
+        bool parallel = pool != nullptr && !options.incremental && young_pinned.empty() && used >= parallel_threshold
+                        && (size_t)(old_reserved_end - old_free) >= (size_t)used * 2;
+        if(parallel){
+            commitOld(old_free - old_begin + (size_t)used * 2);
+            root_scan = scavengeParallel(unscanned_old);
         }
+        else{
+            scanDirtyCards(unscanned_old);
+            scanLargeCards();
+            scanPinnedCards();
 
-        while(unscanned < free_semi){
-            Reference obj = Reference::fromRefPtr((interop::Instance**)&unscanned);
-
-            // copy objects and update references inside survivor
-            for(auto ref : obj.getReferences()){
-                copyAndUpdateRef(ref);
+            collectRoots();
+            for(auto &root : roots){
+                copyAndUpdateRef(root);
             }
+            // 解除固定的对象在from-space中时照常复制，在to-space中时要等到下一次回收
+            std::erase_if(young_pinned, [this](interop::Instance *ins){ return !ins->isPinned() && inFromSpace(ins); });
+            for(auto ins : young_pinned){
+                forEachRefSlot(ins, [this](interop::Instance **slot){ copyAndUpdateSlot(slot); });
+            }
+            root_scan = gcstats::elapsed(start, gcstats::Clock::now());
 
-            unscanned += interop::getInstanceSize(obj.get());
+            // 晋升的对象与复制到另一个半空间的对象都需要扫描，直到两者都没有新增
+            while(unscanned < free_semi || unscanned_old < old_free || !promoted.empty()){
+                while(unscanned < free_semi){
+                    auto ins = (interop::Instance*)unscanned;
+                    // copy objects and update references inside survivor
+                    forEachRefSlot(ins, [this](interop::Instance **slot){ copyAndUpdateSlot(slot); });
+                    unscanned += interop::getInstanceSize(ins);
+                }
+                while(unscanned_old < old_free){
+                    auto ins = (interop::Instance*)unscanned_old;
+                    scanOldObject(ins);
+                    unscanned_old += interop::getInstanceSize(ins);
+                }
+                while(!promoted.empty()){
+                    auto ins = promoted.back();
+                    promoted.pop_back();
+                    scanOldObject(ins);
+                }
+            }
         }
 
-#ifdef DEBUG
-        auto discard = from_semi_space;
-        while(true){
-            auto ins = (interop::Instance*)discard;
-            if(ins->klass==0)break;
-            if(ins->forward==0){
-                LOG(MinorGC,"discard object "<<std::hex<<(void*)ins<<std::dec<<" "<<ins->klass->qualifiedName()<<debugRunesString(ins)<<std::endl)
+#ifdef EVM_TRACE
+        if(trace::enabled(trace::Tag::MinorGC, trace::Level::verbose)){
+            auto discard = from_semi_space;
+            while(discard < from_end){
+                auto ins = (interop::Instance*)discard;
+                if(ins->isForwarded()){
+                    discard += interop::getInstanceSize(ins->getForward());
+                    continue;
+                }
+                LOG_VERBOSE(MinorGC,"discard object "<<std::hex<<(void*)ins<<std::dec<<" "<<ins->getClass()->qualifiedName()<<debugRunesString(ins)<<std::endl)
+                discard += interop::getInstanceSize(ins);
             }
-            discard += interop::getInstanceSize(ins);
         }
-        //memset for debug purpose.
-        memset(from_semi_space, 0, semi_space_size);
 #endif
 
         // swap two semi space
         auto tmp = from_semi_space;
         from_semi_space = to_semi_space;
         to_semi_space = tmp;
+        semi_limit = from_semi_space + semi_space_size;
+        // 存活对象之后是两次回收之前的内容，随分配分段清零
+        zeroed = sample_mark = free_semi;
+        updateAllocLimit();
+        auto copied = gcstats::Clock::now();
+
+        LOG(MinorGC, "@ MinorGC finished. usage "<< semi_space_size <<"/"<< free_semi - from_semi_space
+            << ", old " << old_end - old_begin << "/" << old_free - old_begin <<std::endl<<std::endl);
+
+        adaptNursery(used, free_semi - from_semi_space);
+
+        // 晋升量包括卡表中老年代对象引用的新生代对象，majorGC单独记录，不计入本次停顿
+        stats.recordMinor(gcstats::MinorCycle{
+            .pause = gcstats::elapsed(start, gcstats::Clock::now()),
+            .root_scan = root_scan,
+            .copy = gcstats::elapsed(start, copied) - std::min(root_scan, gcstats::elapsed(start, copied)),
+            .allocated = (uint64_t)(from_end - nursery_start),
+            .collected = (uint64_t)used,
+            .survived = (uint64_t)(free_semi - from_semi_space),
+            .promoted = (uint64_t)(oldUsed() - old_used),
+            .threads = parallel ? (uint64_t)scavengers.size() : 1
+        });
+        nursery_start = free_semi;
+
+        if(options.incremental){
+            incrementalGC();
+            return;
+        }
+
+        // 老年代与大对象空间的使用量超过阈值，或保留范围内已放不下下一次minorGC可能晋升的对象时回收老年代
+        if(matureUsed() > old_threshold || oldUsed() + semi_space_size > (size_t)(old_reserved_end - old_begin)){
+            majorGC();
+        }
+        commitOld(old_free - old_begin + semi_space_size);
+    }
+
+    // 从根集出发标记所有可达的对象，每个对象被标记时调用一次visit。调用前需要collectRoots
+    template<class Visit>
+    inline void markReachable(Visit visit){
+        auto mark = [&](interop::Instance *ins){
+            if(ins == nullptr || ins->isMarked()) return;
+            if(!inYoung(ins) && !inOld(ins) && !inLarge(ins) && !inPinned(ins)) return;
+            ins->setMarked(true);
+            visit(ins);
+            mark_stack.push_back(ins);
+        };
+        for(auto &root : roots){
+            mark(root.get());
+        }
+        while(!mark_stack.empty()){
+            auto ins = mark_stack.back();
+            mark_stack.pop_back();
+            forEachRefSlot(ins, [&](interop::Instance **slot){ mark(*slot); });
+        }
+    }
+
+    // 写出options.snapshot指定的堆快照，文件名后附加序号。未指定时不写出
+    inline void dumpSnapshot(){
+        if(options.snapshot.empty()) return;
+        auto path = options.snapshot + "." + std::to_string(++snapshot_count);
+        std::ofstream out(path, std::ios::binary);
+        if(out) writeSnapshot(out);
+        if(out) std::clog << "heap snapshot written to " << path << std::endl;
+        else std::clog << "cannot write heap snapshot to " << path << std::endl;
+    }
+
+    [[noreturn]] inline void outOfMemory(){
+        dumpSnapshot();
+        throw std::invalid_argument("out of heap memory");
+    }
+
+    // 标记-整理回收老年代。新生代对象与大对象只标记不移动，其中指向老年代的引用随整理更新，
+    // 未被标记的大对象直接归还所占的页
+    inline void majorGC(){
+        if(nogc_depth > 0) return;
+        if(options.incremental){
+            majorGCTrains();
+            return;
+        }
+        LOG(MinorGC, "@ trigger majorGC. old " << old_end - old_begin << "/" << old_free - old_begin
+            << ", large " << large_used << std::endl);
+        auto start = gcstats::Clock::now();
+        auto before = matureUsed();
+
+        // 标记。原地固定的新生代对象不作为根，未被标记的不再保留
+        collectRoots();
+        markReachable([](interop::Instance*){});
+        auto marked = gcstats::Clock::now();
+        std::erase_if(young_pinned, [](interop::Instance *ins){ return !ins->isMarked(); });
+
+        // 计算存活的老年代对象整理后的地址。被固定的存活对象是锚点，整理后的地址即原地址，
+        // 卡内锚点之后的对象从锚点开始计算
+        live_bits.assign(cards.size(), 0);
+        card_dest.resize(cards.size());
+        anchors.clear();
+        for(char *ptr = old_begin; ptr < old_free; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            auto ins = (interop::Instance*)ptr;
+            if(ins->isMarked()){
+                setLive(ptr, interop::getInstanceSize(ins));
+                if(ins->isPinned()) anchors.push_back(ptr);
+            }
+        }
+        char *dest = old_begin;
+        auto anchor = anchors.begin();
+        for(size_t card = 0; card < live_bits.size(); card++){
+            card_dest[card] = dest;
+            size_t from = 0;
+            for(; anchor != anchors.end() && cardOf(*anchor) == card; anchor++){
+                dest = *anchor;
+                from = (*anchor - old_begin) / interop::object_alignment % 64;
+            }
+            dest += liveWordsBetween(card, from, 64) * interop::object_alignment;
+        }
+
+        // 更新指向老年代的引用
+        for(auto &root : roots){
+            updateOldRef(root);
+        }
+        for(auto ins : young_pinned){
+            if(!outsideNursery(ins)) continue;
+            forEachRefSlot(ins, [this](interop::Instance **slot){ updateOldSlot(slot); });
+            ins->setMarked(false);
+        }
+        for(char *ptr = from_semi_space; ptr < free_semi; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            auto ins = (interop::Instance*)ptr;
+            if(!ins->isMarked()) continue;
+            forEachRefSlot(ins, [this](interop::Instance **slot){ updateOldSlot(slot); });
+            ins->setMarked(false);
+        }
+        for(char *ptr = old_begin; ptr < old_free; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            auto ins = (interop::Instance*)ptr;
+            if(!ins->isMarked()) continue;
+            forEachRefSlot(ins, [this](interop::Instance **slot){ updateOldSlot(slot); });
+        }
+
+        // 固定空间中存活的对象更新引用并重建卡表，其余的放回空闲链表
+        std::fill(pinned_cards.begin(), pinned_cards.end(), 0);
+        forEachPinned([&](interop::Instance *ins, uint32_t size_class){
+            if(!ins->isMarked()){
+                freePinned(ins, size_class);
+                return;
+            }
+            ins->setMarked(false);
+            forEachRefSlot(ins, [&](interop::Instance **slot){
+                updateOldSlot(slot);
+                if(inYoung(*slot)) pinned_cards[pinnedCardOf(slot)] = 1;
+            });
+        });
+
+        // 存活的大对象更新引用并重建卡表，其余的释放
+        std::fill(large_cards.begin(), large_cards.end(), 0);
+        for(auto itr = large_objects.begin(); itr != large_objects.end();){
+            auto ins = (interop::Instance*)itr->first;
+            if(!ins->isMarked()){
+                freeLarge(itr->first, itr->second);
+                itr = large_objects.erase(itr);
+                continue;
+            }
+            ins->setMarked(false);
+            forEachRefSlotIn(ins, itr->first, itr->first + itr->second, [&](interop::Instance **slot){
+                updateOldSlot(slot);
+                if(inYoung(*slot)) large_cards[largeCardOf(slot)] = 1;
+            });
+            itr++;
+        }
+
+        // 按地址顺序滑动整理。目标地址不高于原地址，移动后不会覆盖尚未读取的对象头。
+        // 锚点之前空出的部分已经读取过，填充为不含引用的对象
+        std::fill(cards.begin(), cards.end(), 0);
+        std::fill(card_starts.begin(), card_starts.end(), nullptr);
+        char *ptr = old_begin, *top = old_begin;
+        while(ptr < old_free){
+            auto ins = (interop::Instance*)ptr;
+            auto size = interop::getInstanceSize(ins);
+            if(ins->isMarked()){
+                auto target = (char*)compactedAddress(ins);
+                if(target > top){
+                    fill(top, target);
+                    recordOldObject(top, target - top);
+                }
+                top = target + size;
+                memmove(target, ptr, size);
+                auto moved = (interop::Instance*)target;
+                moved->setMarked(false);
+                recordOldObject(target, size);
+                remember(moved);
+            }
+            ptr += size;
+        }
+        old_free = dest;
+
+        // 下一次majorGC在存活数据量翻倍时进行，多余的已提交内存归还给系统
+        auto live = (size_t)(old_free - old_begin);
+        auto others = large_used + pinned_used;
+        old_threshold = std::clamp((live + others) * 2, options.min, std::max(options.min, options.max));
+        decommitOld(std::max(old_threshold > others ? old_threshold - others : 0, live + semi_space_size));
+
+        auto end = gcstats::Clock::now();
+        stats.recordMajor(gcstats::MajorCycle{
+            .pause = gcstats::elapsed(start, end),
+            .mark = gcstats::elapsed(start, marked),
+            .compact = gcstats::elapsed(marked, end),
+            .before = before,
+            .after = matureUsed()
+        });
 
-        LOG(MinorGC, "@ MinorGC finished. usage "<< semi_space_size <<"/"<< free_semi - from_semi_space<<std::endl<<std::endl);
+        LOG(MinorGC, "@ MajorGC finished. old " << old_end - old_begin << "/" << old_free - old_begin
+            << ", large " << large_used << std::endl << std::endl);
     }
 
+    // 对象不移动，只设置标记，不引发回收。新生代对象登记到young_pinned，之后的回收把它留在原处
     inline void pin(interop::Instance* ins) {
-        if(ins->pined == 1)return;
-        char age = ins->age + 1;
-        auto new_place = (interop::Instance*)malloc(interop::getInstanceSize(ins));
-        ins->pined = 1; // mark as pined object
-        ins->forward = new_place;
-        ins->age++;
-        minorGC();
-        new_place->age = age;
-        new_place->forward = 0;
-        LOG(MinorGC, "pin at " << std::hex << (uintptr_t)new_place << std::dec << std::endl);
+        if(ins->isPinned())return;
+        ins->setPinned(true);
+        if(!inYoung(ins)) return;
+        auto iter = std::lower_bound(young_pinned.begin(), young_pinned.end(), ins);
+        if(iter == young_pinned.end() || *iter != ins) young_pinned.insert(iter, ins);
+        LOG(MinorGC, "pin nursery object at " << std::hex << (uintptr_t)ins << std::dec << std::endl);
     }
 
+    // 只清除标记。新生代对象在下一次位于from-space的minorGC中照常复制
     inline void unpin(interop::Instance* ins) {
-        if(ins->pined==0)return;
-        auto size = interop::getInstanceSize(ins);
+        ins->setPinned(false);
+    }
 
-        if (remainSemiSpace() < size) {
-            minorGC();
+    // 可以在信号处理函数中调用，快照在下一次minorGC开始时写出
+    inline static void requestSnapshot(){
+        snapshot_requested = 1;
+    }
+
+    // 堆快照，由tool/heap_snapshot.py读取。借用majorGC的标记位遍历存活对象，写出后清除标记。
+    // 数值按本机字节序(小端)写出：
+    //   "EVMHEAP\0" u32版本
+    //   u32类数量，每个类为 u32序号 u32名称长度 UTF-8名称
+    //   u32根数量，每个根为 u64对象地址
+    //   u64对象数量，每个对象为 u64地址 u32类序号 u32大小 u32引用数量 u64引用的对象地址...
+    inline void writeSnapshot(std::ostream &out){
+        static constexpr uint32_t snapshot_version = 1;
+        auto put = [&](auto value){
+            out.write((const char*)&value, sizeof(value));
+        };
+        collectRoots();
+        std::vector<interop::Instance*> objects;
+        markReachable([&](interop::Instance *ins){ objects.push_back(ins); });
+
+        out.write("EVMHEAP", 8);
+        put(snapshot_version);
+        put((uint32_t)(runtime::class_table.size() - 1));
+        for(uint32_t index = 1; index < runtime::class_table.size(); index++){
+            auto name = unicode::toUTF8(runtime::class_table[index]->qualifiedName());
+            put(index);
+            put((uint32_t)name.size());
+            out.write(name.data(), name.size());
         }
 
-        if (remainSemiSpace() < size) {
-            throw std::invalid_argument("out of heap memory");
+        std::vector<interop::Instance*> refs;
+        for(auto &root : roots){
+            if(root.get() != nullptr) refs.push_back(root.get());
         }
+        put((uint32_t)refs.size());
+        for(auto ref : refs) put((uint64_t)(uintptr_t)ref);
 
-        LOG(MinorGC, "unpin:" << size << " at " << std::hex << (uintptr_t)free_semi << std::dec << " remain:" << remainSemiSpace() - size << std::endl);
-        
-        ins->pined = 0;
-        ins->age++;
-        memcpy(free_semi, ins, size);
-        free_semi += size;
-        free(ins);
+        put((uint64_t)objects.size());
+        for(auto ins : objects){
+            ins->setMarked(false);
+            refs.clear();
+            forEachRefSlot(ins, [&](interop::Instance **slot){
+                if(*slot != nullptr) refs.push_back(*slot);
+            });
+            put((uint64_t)(uintptr_t)ins);
+            put((uint32_t)ins->getClass()->getClassIndex());
+            put((uint32_t)interop::getInstanceSize(ins));
+            put((uint32_t)refs.size());
+            for(auto ref : refs) put((uint64_t)(uintptr_t)ref);
+        }
+        LOG(MinorGC, "@ heap snapshot: " << objects.size() << " objects" << std::endl);
+    }
+
+    // 统计数据，先计入上一次minorGC之后在新生代中的分配
+    inline const gcstats::Statistics &getStatistics(){
+        stats.addAllocated(free_semi - nursery_start);
+        nursery_start = free_semi;
+        return stats;
     }
 
     inline interop::ProtectedCell makeProtectedCell(interop::Instance *ins){
         return interop::ProtectedCell(this,ins);
     }
 
-    //void incrementalGC();
-};
+    // 增量回收老年代，在minorGC之后进行。车厢的使用量超过car_threshold时逐节回收车厢，
+    // 每次至少回收一节，用完options.increment_budget微秒后停止，停顿时间与老年代的大小无关
+    inline void incrementalGC(){
+        if(!options.incremental || nogc_depth > 0 || car_used <= car_threshold) return;
+        auto start = gcstats::Clock::now();
+        auto used_before = car_used;
+        increment_cars = increment_evacuated = 0;
 
+        // minorGC之后新生代中只有存活对象，其中的槽位与根集一样需要更新
+        collectRoots();
+        for(char *ptr = from_semi_space; ptr < free_semi; ptr += interop::getInstanceSize((interop::Instance*)ptr)){
+            forEachRefSlot((interop::Instance*)ptr, [this](interop::Instance **slot){ roots.push_back(Reference::fromRefPtr(slot)); });
+        }
+        for(auto ins : young_pinned){
+            if(outsideNursery(ins)) forEachRefSlot(ins, [this](interop::Instance **slot){ roots.push_back(Reference::fromRefPtr(slot)); });
+        }
 
+        bool starved = false;
+        while(car_used > car_threshold){
+            while(!trains.empty() && trains.front().cars.empty()) popTrain();
+            if(trains.empty()) break;
+            // 被回收的列车不能接收晋升与被根集引用的对象
+            if(trains.size() == 1) newTrain();
+            // 一节车厢中的对象最多分散到每列列车的末尾，各需要一节新车厢
+            if(availableCars() < trains.size() + 1){
+                starved = true;
+                break;
+            }
+            collectCar();
+            if(gcstats::elapsed(start, gcstats::Clock::now()) >= (uint64_t)options.increment_budget * 1000) break;
+        }
 
-// class Container{
-//     interop::Instance *instance;
-// public:
+        stats.recordIncrement(gcstats::IncrementCycle{
+            .pause = gcstats::elapsed(start, gcstats::Clock::now()),
+            .cars = increment_cars,
+            .evacuated = increment_evacuated,
+            .freed = used_before > car_used ? used_before - car_used : 0
+        });
+        LOG(MinorGC, "@ incremental GC collected " << increment_cars << " cars, evacuated " << increment_evacuated
+            << " bytes, cars used " << used_before << " -> " << car_used << std::endl);
 
-    
-// };
-
-// class Car{
-//     Car *predecessor = nullptr,
-//         *successor = nullptr;
-//     int number,size;
-//     Container containers[3];
-//     std::list<Reference> remember_set;
-// };
-
-// class Train{
-//     int number;
-//     Car *car;
-//     std::list<Reference> remember_set;
-// };
+        if(starved){
+            LOG(MinorGC, "@ no free cars for incremental GC" << std::endl);
+            majorGC();
+        }
+    }
+};
 
 #endif
\ No newline at end of file
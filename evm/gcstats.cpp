@@ -0,0 +1,208 @@
+#include "gcstats.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace gcstats {
+
+    int Histogram::indexOf(uint64_t value){
+        if(value < sub_count) return (int)value;
+        int exponent = std::bit_width(value) - 1;
+        int sub = (int)(value >> (exponent - sub_bits)) & (sub_count - 1);
+        return (exponent - sub_bits + 1) * sub_count + sub;
+    }
+
+    uint64_t Histogram::upperBoundOf(int index){
+        if(index + 1 >= (int)std::tuple_size_v<decltype(buckets)>) return UINT64_MAX;
+        auto next = index + 1;
+        if(next < sub_count) return next - 1;
+        int exponent = next / sub_count + sub_bits - 1;
+        uint64_t lower = (uint64_t)(sub_count + next % sub_count) << (exponent - sub_bits);
+        return lower - 1;
+    }
+
+    void Histogram::record(uint64_t value){
+        buckets[indexOf(value)]++;
+        samples++;
+        total += value;
+        maximum = std::max(maximum, value);
+    }
+
+    uint64_t Histogram::percentile(double p) const {
+        if(samples == 0) return 0;
+        auto rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p * samples));
+        uint64_t seen = 0;
+        for(int i = 0; i < (int)buckets.size(); i++){
+            seen += buckets[i];
+            if(seen >= rank) return std::min(upperBoundOf(i), maximum);
+        }
+        return maximum;
+    }
+
+    void Statistics::remember(const Cycle &cycle){
+        if(history.size() == history_limit){
+            history.pop_front();
+            dropped++;
+        }
+        history.push_back(cycle);
+    }
+
+    void Statistics::recordMinor(const MinorCycle &cycle){
+        pauses.record(cycle.pause);
+        minor_pauses.record(cycle.pause);
+        allocated += cycle.allocated;
+        collected += cycle.collected;
+        survived += cycle.survived;
+        promoted += cycle.promoted;
+        root_scan += cycle.root_scan;
+        copy += cycle.copy;
+        if(cycle.threads > 1) parallel++;
+        Cycle entry;
+        entry.kind = Cycle::Kind::Minor;
+        entry.minor_cycle = cycle;
+        remember(entry);
+    }
+
+    void Statistics::recordMajor(const MajorCycle &cycle){
+        pauses.record(cycle.pause);
+        major_pauses.record(cycle.pause);
+        mark += cycle.mark;
+        compact += cycle.compact;
+        Cycle entry;
+        entry.kind = Cycle::Kind::Major;
+        entry.major_cycle = cycle;
+        remember(entry);
+    }
+
+    void Statistics::recordIncrement(const IncrementCycle &cycle){
+        pauses.record(cycle.pause);
+        increment_pauses.record(cycle.pause);
+        cars += cycle.cars;
+        evacuated += cycle.evacuated;
+        Cycle entry;
+        entry.kind = Cycle::Kind::Increment;
+        entry.increment_cycle = cycle;
+        remember(entry);
+    }
+
+    int64_t Statistics::sample(Metric metric) const {
+        switch(metric){
+            case Metric::MinorCollections: return minor_pauses.count();
+            case Metric::MajorCollections: return major_pauses.count();
+            case Metric::PauseP50: return pauses.percentile(0.5);
+            case Metric::PauseP99: return pauses.percentile(0.99);
+            case Metric::PauseMax: return pauses.max();
+            case Metric::PauseTotal: return pauses.sum();
+            case Metric::BytesAllocated: return allocated;
+            case Metric::BytesPromoted: return promoted;
+            case Metric::BytesSurvived: return survived;
+            case Metric::NurseryCollected: return collected;
+            case Metric::RootScanTime: return root_scan;
+            case Metric::CopyTime: return copy;
+            case Metric::MarkTime: return mark;
+            case Metric::CompactTime: return compact;
+            case Metric::IncrementalCollections: return increment_pauses.count();
+            case Metric::CarsCollected: return cars;
+            case Metric::BytesEvacuated: return evacuated;
+            case Metric::ParallelCollections: return parallel;
+            default: throw std::invalid_argument("unknown gc metric " + std::to_string((int32_t)metric));
+        }
+    }
+
+    namespace {
+        std::string milliseconds(uint64_t ns){
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(3) << ns / 1e6 << "ms";
+            return out.str();
+        }
+
+        double survivalOf(uint64_t survived, uint64_t promoted, uint64_t collected){
+            return collected == 0 ? 0 : (double)(survived + promoted) / collected;
+        }
+
+        void writePauses(std::ostream &out, const Histogram &histogram){
+            out << "{\"count\":" << histogram.count() << ",\"total_ns\":" << histogram.sum()
+                << ",\"p50_ns\":" << histogram.percentile(0.5) << ",\"p99_ns\":" << histogram.percentile(0.99)
+                << ",\"max_ns\":" << histogram.max() << "}";
+        }
+    }
+
+    void Statistics::print(std::ostream &out) const {
+        out << "GC statistics" << std::endl
+            << "  collections      minor " << minor_pauses.count() << " (parallel " << parallel << ")"
+            << ", major " << major_pauses.count() << std::endl
+            << "  pause            p50 " << milliseconds(pauses.percentile(0.5))
+            << ", p99 " << milliseconds(pauses.percentile(0.99))
+            << ", max " << milliseconds(pauses.max())
+            << ", total " << milliseconds(pauses.sum()) << std::endl
+            << "  minor pause      p50 " << milliseconds(minor_pauses.percentile(0.5))
+            << ", p99 " << milliseconds(minor_pauses.percentile(0.99))
+            << ", max " << milliseconds(minor_pauses.max()) << std::endl
+            << "  major pause      p50 " << milliseconds(major_pauses.percentile(0.5))
+            << ", p99 " << milliseconds(major_pauses.percentile(0.99))
+            << ", max " << milliseconds(major_pauses.max()) << std::endl
+            << "  increment pause  p50 " << milliseconds(increment_pauses.percentile(0.5))
+            << ", p99 " << milliseconds(increment_pauses.percentile(0.99))
+            << ", max " << milliseconds(increment_pauses.max())
+            << ", count " << increment_pauses.count() << std::endl
+            << "  allocated        " << allocated << " bytes" << std::endl
+            << "  promoted         " << promoted << " bytes" << std::endl
+            << "  survival         " << std::fixed << std::setprecision(1)
+            << survivalOf(survived, promoted, collected) * 100 << "%" << std::defaultfloat << std::endl
+            << "  minor time       root scan " << milliseconds(root_scan) << ", copy " << milliseconds(copy) << std::endl
+            << "  major time       mark " << milliseconds(mark) << ", compact " << milliseconds(compact) << std::endl
+            << "  trains           cars " << cars << ", evacuated " << evacuated << " bytes" << std::endl;
+    }
+
+    void Statistics::writeJson(std::ostream &out) const {
+        out << "{\"minor\":";
+        writePauses(out, minor_pauses);
+        out << ",\"major\":";
+        writePauses(out, major_pauses);
+        out << ",\"increment\":";
+        writePauses(out, increment_pauses);
+        out << ",\"pause\":";
+        writePauses(out, pauses);
+        out << ",\"allocated\":" << allocated
+            << ",\"promoted\":" << promoted
+            << ",\"survived\":" << survived
+            << ",\"nursery_collected\":" << collected
+            << ",\"survival\":" << survivalOf(survived, promoted, collected)
+            << ",\"root_scan_ns\":" << root_scan
+            << ",\"copy_ns\":" << copy
+            << ",\"mark_ns\":" << mark
+            << ",\"compact_ns\":" << compact
+            << ",\"cars\":" << cars
+            << ",\"evacuated\":" << evacuated
+            << ",\"parallel\":" << parallel
+            << ",\"cycles_dropped\":" << dropped
+            << ",\"cycles\":[";
+        bool first = true;
+        for(auto &cycle : history){
+            if(!first) out << ",";
+            first = false;
+            if(cycle.kind == Cycle::Kind::Increment){
+                auto &c = cycle.increment_cycle;
+                out << "{\"kind\":\"increment\",\"pause_ns\":" << c.pause << ",\"cars\":" << c.cars
+                    << ",\"evacuated\":" << c.evacuated << ",\"freed\":" << c.freed << "}";
+            }
+            else if(cycle.kind == Cycle::Kind::Major){
+                auto &c = cycle.major_cycle;
+                out << "{\"kind\":\"major\",\"pause_ns\":" << c.pause << ",\"mark_ns\":" << c.mark
+                    << ",\"compact_ns\":" << c.compact << ",\"before\":" << c.before << ",\"after\":" << c.after << "}";
+            }
+            else{
+                auto &c = cycle.minor_cycle;
+                out << "{\"kind\":\"minor\",\"pause_ns\":" << c.pause << ",\"root_scan_ns\":" << c.root_scan
+                    << ",\"copy_ns\":" << c.copy << ",\"allocated\":" << c.allocated << ",\"collected\":" << c.collected
+                    << ",\"survived\":" << c.survived << ",\"promoted\":" << c.promoted
+                    << ",\"survival\":" << survivalOf(c.survived, c.promoted, c.collected) << ",\"threads\":" << c.threads << "}";
+            }
+        }
+        out << "]}" << std::endl;
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef EVM_GCSTATS
+#define EVM_GCSTATS
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+
+// GC的运行统计。GarbageCollector在每次回收结束时记录一个周期，
+// 由 --gc-stats 在退出时输出文本，或由 --gc-stats-file 写出JSON，EB代码通过GCStatistic内部函数读取。
+// 时间单位为纳秒，大小单位为字节
+namespace gcstats {
+
+    using Clock = std::chrono::steady_clock;
+
+    inline uint64_t elapsed(Clock::time_point from, Clock::time_point to){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    }
+
+    // 与langlibs/core/GC.eb中的编号一致，只能在末尾追加
+    enum class Metric : int32_t {
+        MinorCollections,
+        MajorCollections,
+        PauseP50,
+        PauseP99,
+        PauseMax,
+        PauseTotal,
+        BytesAllocated,
+        BytesPromoted,
+        BytesSurvived,      // minorGC后留在新生代的字节数之和
+        NurseryCollected,   // minorGC开始时新生代已使用的字节数之和，存活率为(BytesSurvived+BytesPromoted)/NurseryCollected
+        RootScanTime,
+        CopyTime,
+        MarkTime,
+        CompactTime,
+        IncrementalCollections,
+        CarsCollected,
+        BytesEvacuated,     // 增量回收从被回收的车厢中复制出的字节数之和
+        ParallelCollections,    // 由多个线程复制的minorGC次数
+        count
+    };
+
+    // 对数-线性分桶的直方图，每个2的幂区间分为8个桶，相对误差不超过12.5%
+    class Histogram {
+        static constexpr int sub_bits = 3;
+        static constexpr int sub_count = 1 << sub_bits;
+        std::array<uint64_t, 64 * sub_count> buckets{};
+        uint64_t samples = 0, total = 0, maximum = 0;
+
+        static int indexOf(uint64_t value);
+        static uint64_t upperBoundOf(int index);
+    public:
+        void record(uint64_t value);
+
+        // 第p(0-1)分位的样本所在桶的上界，不超过最大值。没有样本时为0
+        uint64_t percentile(double p) const;
+
+        uint64_t count() const { return samples; }
+        uint64_t sum() const { return total; }
+        uint64_t max() const { return maximum; }
+    };
+
+    struct MinorCycle {
+        uint64_t pause;
+        uint64_t root_scan;     // 扫描卡表与根集，并复制它们直接引用的对象
+        uint64_t copy;          // 复制其余可达对象
+        uint64_t allocated;     // 上一次回收之后新分配的字节数
+        uint64_t collected;     // 回收开始时新生代已使用的字节数
+        uint64_t survived;
+        uint64_t promoted;
+        uint64_t threads;       // 复制存活对象的线程数，串行复制时为1
+    };
+
+    struct MajorCycle {
+        uint64_t pause;
+        uint64_t mark;
+        uint64_t compact;       // 更新引用、清扫与整理
+        uint64_t before;        // 回收前老年代、大对象与固定空间的使用量
+        uint64_t after;
+    };
+
+    // 增量回收老年代的一次停顿，见GarbageCollector::incrementalGC
+    struct IncrementCycle {
+        uint64_t pause;
+        uint64_t cars;          // 回收的车厢数，包括整列释放的列车中的车厢
+        uint64_t evacuated;     // 从车厢中复制出的存活对象的字节数
+        uint64_t freed;         // 释放的车厢中已分配的字节数减去复制出的字节数
+    };
+
+    class Statistics {
+        static constexpr size_t history_limit = 1024;
+
+        Histogram pauses, minor_pauses, major_pauses, increment_pauses;
+        uint64_t allocated = 0, promoted = 0, survived = 0, collected = 0;
+        uint64_t root_scan = 0, copy = 0, mark = 0, compact = 0;
+        uint64_t cars = 0, evacuated = 0;
+        uint64_t parallel = 0;
+
+        // 最近的history_limit个周期，写入JSON
+        struct Cycle {
+            enum class Kind { Minor, Major, Increment } kind;
+            union {
+                MinorCycle minor_cycle;
+                MajorCycle major_cycle;
+                IncrementCycle increment_cycle;
+            };
+        };
+        std::deque<Cycle> history;
+        uint64_t dropped = 0;
+
+        void remember(const Cycle &cycle);
+    public:
+        void recordMinor(const MinorCycle &cycle);
+        void recordMajor(const MajorCycle &cycle);
+        void recordIncrement(const IncrementCycle &cycle);
+
+        // 不经过minorGC的分配，如大对象、固定空间与直接分配在老年代的对象
+        inline void addAllocated(uint64_t bytes){
+            allocated += bytes;
+        }
+
+        // 读取一项指标，metric超出范围时抛出std::invalid_argument
+        int64_t sample(Metric metric) const;
+
+        void print(std::ostream &out) const;
+        void writeJson(std::ostream &out) const;
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#include "gcworkers.h"
+
+namespace gcworkers {
+
+    Pool::Pool(unsigned count){
+        for(unsigned index = 1; index < count; index++){
+            threads.emplace_back([this, index]{ loop(index); });
+        }
+    }
+
+    Pool::~Pool(){
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for(auto &thread : threads) thread.join();
+    }
+
+    void Pool::loop(unsigned index){
+        uint64_t seen = 0;
+        while(true){
+            std::function<void(unsigned)> current;
+            {
+                std::unique_lock lock(mutex);
+                start_cv.wait(lock, [&]{ return stopping || generation != seen; });
+                if(stopping) return;
+                seen = generation;
+                current = job;
+            }
+            current(index);
+            {
+                std::lock_guard lock(mutex);
+                if(--pending == 0) done_cv.notify_one();
+            }
+        }
+    }
+
+    void Pool::run(std::function<void(unsigned)> work){
+        {
+            std::lock_guard lock(mutex);
+            job = work;
+            pending = threads.size();
+            generation++;
+        }
+        start_cv.notify_all();
+        work(0);
+        std::unique_lock lock(mutex);
+        done_cv.wait(lock, [&]{ return pending == 0; });
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef EVM_GCWORKERS
+#define EVM_GCWORKERS
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 并行minorGC使用的线程池、可窃取的任务队列与终止检测
+namespace gcworkers {
+
+    // 固定数量的工作线程。run在调用线程与其余线程上同时执行job(序号)，全部返回后run才返回
+    class Pool {
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable start_cv, done_cv;
+        std::function<void(unsigned)> job;
+        uint64_t generation = 0;
+        unsigned pending = 0;
+        bool stopping = false;
+
+        void loop(unsigned index);
+    public:
+        // count为包括调用线程在内的线程数
+        explicit Pool(unsigned count);
+        ~Pool();
+
+        inline unsigned size() const { return threads.size() + 1; }
+
+        void run(std::function<void(unsigned)> job);
+    };
+
+    // 任务的所有者在本地栈中处理任务，本地任务较多时把一部分放入这里供其他线程窃取
+    template<class T>
+    class StealQueue {
+        std::mutex mutex;
+        std::vector<T> items;
+        std::atomic<size_t> count{0};
+    public:
+        inline size_t size() const {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        inline void push(const T *begin, const T *end){
+            std::lock_guard lock(mutex);
+            items.insert(items.end(), begin, end);
+            count.store(items.size(), std::memory_order_relaxed);
+        }
+
+        // 取走至多一半(至少一个)任务放入out
+        inline bool steal(std::vector<T> &out){
+            if(size() == 0) return false;
+            std::lock_guard lock(mutex);
+            if(items.empty()) return false;
+            auto take = std::max<size_t>(1, items.size() / 2);
+            out.insert(out.end(), items.end() - take, items.end());
+            items.resize(items.size() - take);
+            count.store(items.size(), std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+    // 所有线程都没有任务且所有队列为空时结束。只有活动的线程会向队列中放入任务，
+    // 线程在自己的队列为空时才转为空闲，因此活动线程数为0时所有队列都已为空
+    class Terminator {
+        std::atomic<unsigned> active;
+    public:
+        explicit Terminator(unsigned count) : active(count){}
+
+        // 当前线程没有任务时调用。has_work检查是否有可窃取的任务，try_steal尝试窃取。
+        // 返回true表示窃取到了任务，false表示所有线程都已结束
+        template<class HasWork, class TrySteal>
+        inline bool idle(HasWork has_work, TrySteal try_steal){
+            active.fetch_sub(1, std::memory_order_acq_rel);
+            while(true){
+                if(active.load(std::memory_order_acquire) == 0) return false;
+                if(has_work()){
+                    active.fetch_add(1, std::memory_order_acq_rel);
+                    if(try_steal()) return true;
+                    active.fetch_sub(1, std::memory_order_acq_rel);
+                }
+                std::this_thread::yield();
+            }
+        }
+    };
+}
+
+#endif
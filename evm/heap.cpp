@@ -0,0 +1,96 @@
+#include "heap.h"
+#include <cctype>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace heap {
+
+#ifdef _WIN32
+
+    size_t pageSize(){
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+    }
+
+    // 大页需要SeLockMemoryPrivilege且必须一次提交，Windows下忽略huge_pages
+    void *reserve(size_t size, bool huge_pages){
+        auto ptr = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+        if(ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void commit(void *ptr, size_t size){
+        if(size == 0) return;
+        if(VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) == nullptr) throw std::bad_alloc();
+    }
+
+    void decommit(void *ptr, size_t size){
+        if(size == 0) return;
+        VirtualFree(ptr, size, MEM_DECOMMIT);
+    }
+
+    void release(void *ptr, size_t size){
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+
+#else
+
+    size_t pageSize(){
+        static size_t size = sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    void *reserve(size_t size, bool huge_pages){
+        auto ptr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(ptr == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        if(huge_pages) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        return ptr;
+    }
+
+    // 物理页在第一次访问时才分配
+    void commit(void *ptr, size_t size){
+        if(size == 0) return;
+        if(mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0) throw std::bad_alloc();
+    }
+
+    void decommit(void *ptr, size_t size){
+        if(size == 0) return;
+        madvise(ptr, size, MADV_DONTNEED);
+        mprotect(ptr, size, PROT_NONE);
+    }
+
+    void release(void *ptr, size_t size){
+        munmap(ptr, size);
+    }
+
+#endif
+
+    size_t parseSize(const std::string &str){
+        size_t pos = 0;
+        unsigned long long value;
+        try{
+            value = std::stoull(str, &pos);
+        }
+        catch(std::exception&){
+            throw std::invalid_argument("invalid size '" + str + "'");
+        }
+        if(pos == str.size()) return value;
+        if(pos + 1 != str.size()) throw std::invalid_argument("invalid size '" + str + "'");
+        switch(std::tolower(str[pos])){
+            case 'k': return value << 10;
+            case 'm': return value << 20;
+            case 'g': return value << 30;
+            default: throw std::invalid_argument("invalid size '" + str + "'");
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef EVM_HEAP
+#define EVM_HEAP
+#include <cstddef>
+#include <string>
+
+// 堆的虚拟内存管理。启动时按最大值保留地址空间，使用时才提交物理内存，
+// 因此堆可以在不移动对象的前提下增长与收缩
+namespace heap {
+
+    struct Options {
+        size_t min = 8 << 20;           // 老年代初始提交的大小，也是触发majorGC的最低阈值
+        size_t max = 1 << 30;           // 老年代可以增长到的大小
+        size_t nursery = 1 << 20;       // 新生代每个半空间的初始大小，之后按存活率与分配速度调整
+        size_t large_object = 32 << 10; // 不小于此大小的对象分配在大对象空间，不被复制
+        bool huge_pages = false;        // 对堆使用透明大页(仅Linux)
+        unsigned gc_threads = 1;        // 并行minorGC的线程数，1为单线程，0为CPU核数
+        bool incremental = false;       // 老年代用train算法增量回收
+        unsigned increment_budget = 2000;   // 每次增量回收的时间预算(微秒)，至少回收一节车厢
+        bool nogc_overflow = false;     // 不回收区域超出预留时继续分配而不抛出GCBudgetExceeded
+        std::string snapshot;           // 收到SIGUSR2或内存不足时写出堆快照的文件名前缀，为空时不写出
+    };
+
+    size_t pageSize();
+
+    inline size_t roundUp(size_t size, size_t alignment){
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // 保留size字节的地址空间，不提交物理内存。失败时抛出std::bad_alloc
+    void *reserve(size_t size, bool huge_pages);
+
+    // 提交或归还[ptr, ptr+size)的物理内存，ptr与size需按页对齐
+    void commit(void *ptr, size_t size);
+    void decommit(void *ptr, size_t size);
+
+    void release(void *ptr, size_t size);
+
+    // 解析形如 4096、512k、64m、1g 的大小，格式错误时抛出std::invalid_argument
+    size_t parseSize(const std::string &str);
+}
+
+#endif
@@ -2,16 +2,17 @@
 #include "loader.h"
 #include "processor.h"
 #include "runtime.h"
+#include <fstream>
 
 namespace interop {
 
 
 
     ProtectedCell::ProtectedCell(GarbageCollector *gc, interop::Instance *ins) : gc(gc){
-        obj = new SharedObj();
+        obj = new Handle();
         obj->ins = ins;
         obj->shared_count = 1;
-        gc->addRoot(&(obj->ins));
+        gc->addHandle(obj);
     }
 
     ProtectedCell::ProtectedCell(ProtectedCell &&that){
@@ -30,7 +31,7 @@ namespace interop {
         if(obj!=nullptr){
             obj->shared_count--;
             if(obj->shared_count==0){
-                gc->removeRoot(&(obj->ins));
+                gc->removeHandle(obj);
                 delete obj;
             }
         }
@@ -75,7 +76,6 @@ namespace interop {
                 break;
             case Ref:
                 stack.push<interop::Instance*>(((ProtectedCell&)ref_val.value()).get());
-                processor->getLoader().getGC()->addRoot(stack.ptrToPeek<interop::Instance*>());
                 break;
             default:
                 throw std::invalid_argument("");
@@ -86,21 +86,11 @@ namespace interop {
         processor = new Processor(loader);
     }
 
-    uint32_t getInstanceSize(interop::Instance *ins){
-        auto size = ins->klass->getInstanceMemorySize();
-        if(auto spec_ary = dynamic_cast<runtime::SpecializedArray*>(ins->klass)){
-            size += ((interop::ArrayInstance*)ins)->length * runtime::getRuntimeSize(spec_ary->getElementType());
-        }
-        return size;
-    }
-
 
     interop::Instance *Agent::createUnprotectedInstance(runtime::Class *klass, std::list<Value> parameters){
         auto cell = processor->getLoader().getGC()->makeProtectedCell(processor->getLoader().getGC()->allocate(klass));
-        
-        cell.get()->klass = klass;
+
         processor->getOperand().push<Instance*>(cell.get());
-        processor->getLoader().getGC()->addRoot(processor->getOperand().ptrToPeek<interop::Instance*>());
         for(auto iter = parameters.rbegin(); iter!=parameters.rend(); iter++){
             (*iter).pushToStack(processor);
         }
@@ -110,12 +100,13 @@ namespace interop {
         return cell.get();
     }
 
-    interop::ArrayInstance *Agent::createUnprotectedArray(runtime::SpecializedArray *array, int count){
+    interop::ArrayInstance *Agent::createUnprotectedArray(runtime::SpecializedArray *array, int count, bool pinned){
         auto content_length = count * runtime::getRuntimeSize(array->getElementType());
-        auto ins = (ArrayInstance*)processor->getLoader().getGC()->allocate(array, array->getInstanceMemorySize() + content_length);
-        ins->base.klass = array;
+        auto gc = processor->getLoader().getGC();
+        auto size = sizeof(ArrayInstance) + content_length;
+        // 分配的空间已清零，只需设置长度
+        auto ins = (ArrayInstance*)(pinned ? gc->allocatePinned(array, size) : gc->allocate(array, size));
         ins->length = count;
-        memset((char*)ins + sizeof(ArrayInstance), 0, content_length);
         return ins;
     }
 
@@ -218,21 +209,18 @@ namespace interop {
                 bool boolean = processor->getOperand().pop<uint8_t>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(boolean ? "True"_utf32:"False"_utf32);
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case ByteToString:{
                 auto value = processor->getOperand().pop<uint8_t>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case ShortToString:{
                 auto value = processor->getOperand().pop<int16_t>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case IntegerToString:{
@@ -240,28 +228,24 @@ namespace interop {
                 //std::cout<<std::endl<<"@ "<< unicode::to_string(value) <<std::endl;
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case LongToString:{
                 auto value = processor->getOperand().pop<int64_t>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case SingleToString:{
                 auto value = processor->getOperand().pop<float>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case DoubleToString:{
                 auto value = processor->getOperand().pop<double>();
                 auto ins = processor->getLoader().getInteropAgent()->createString(unicode::to_string(value));
                 processor->getOperand().push(ins.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case DebugObjAddr: {
@@ -271,12 +255,10 @@ namespace interop {
             }
             case Trap:{
                 auto count = processor->getOperand().pop<uint32_t>();
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<interop::Instance*>();
                 break;
             }
             case StringToCStr:{
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<Instance*>();
                 auto str = fetchStringFromInstance((StringInstance*)ins);
                 auto cstr = unicode::toPlatform(str);
@@ -288,55 +270,54 @@ namespace interop {
                     ptr++;
                 }
                 processor->getOperand().push<Instance*>(ary.get());
-                processor->OpAddRoot<Instance*>();
                 break;
             }
             case Pin:{
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<Instance*>();
                 processor->getLoader().getGC()->pin(ins);
                 break;
             }
             case Unpin:{
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<Instance*>();
                 processor->getLoader().getGC()->unpin(ins);
                 break;
             }
             case EnableGC:{
+                processor->exitNoGCRegion();
                 break;
             }
             case DisableGC:{
+                processor->enterNoGCRegion(processor->getOperand().pop<int64_t>());
                 break;
             }
             case AryPtr:{
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<Instance*>();
-                if(ins->pined==0){
-                
+                if(!ins->isPinned()){
+                    auto ins = createInstance(processor->getLoader().getEBObjectUnpinnedException(),{});
+                    processor->handleException(ins);
                 }
                 else{
-                    auto ptr = (uintptr_t)((uint8_t*)ins + sizeof(Instance));
+                    auto ptr = (uintptr_t)((uint8_t*)ins + sizeof(ArrayInstance));
                     processor->getOperand().push<uintptr_t>(ptr);
                 }
                 break;
             }
             case ObjPtr:{
-                processor->OpRemoveRoot<Instance*>();
                 auto ins = processor->getOperand().pop<Instance*>();
-                if(ins->pined==0){
-                    auto ptr = (uintptr_t)((uint8_t*)ins + sizeof(Instance));
-                    processor->getOperand().push<uintptr_t>(ptr);
+                if(!ins->isPinned()){
+                    auto ins = createInstance(processor->getLoader().getEBObjectUnpinnedException(),{});
+                    processor->handleException(ins);
                 }
                 else{
-                    processor->getOperand().push<uintptr_t>((uintptr_t)ins);
+                    auto ptr = (uintptr_t)((uint8_t*)ins + sizeof(Instance));
+                    processor->getOperand().push<uintptr_t>(ptr);
                 }
                 break;
             }
             case RefPtr:{
-                processor->OpRemoveRoot<Instance*>();
                 auto itp = processor->getOperand().pop<InteriorPointer>();
-                if(getInteriorPointerInstance(itp)->pined==0){
+                auto ins = getInteriorPointerInstance(itp);
+                if(ins != nullptr && !ins->isPinned()){
                     auto ins = createInstance(processor->getLoader().getEBObjectUnpinnedException(),{});
                     processor->handleException(ins);
                 }
@@ -345,6 +326,40 @@ namespace interop {
                 }
                 break;
             }
+            case NewPinnedBytes:{
+                auto count = processor->getOperand().pop<int32_t>();
+                auto byte_symbol = processor->getLoader().getGlobal()->find("Byte"_utf32);
+                auto ary = createUnprotectedArray(processor->getLoader().getSpecilizedArrayPool()->query(byte_symbol), count, true);
+                processor->getOperand().push<Instance*>((Instance*)ary);
+                break;
+            }
+            case GCStatistic:{
+                auto metric = processor->getOperand().pop<int32_t>();
+                if(metric < 0 || metric >= (int32_t)gcstats::Metric::count){
+                    auto ins = createInstance(processor->getLoader().getEBOutOfRangeException(),{
+                        Value::fromI32(metric),
+                        Value::fromI32((int32_t)gcstats::Metric::count)
+                    });
+                    processor->handleException(std::move(ins));
+                    break;
+                }
+                auto &stats = processor->getLoader().getGC()->getStatistics();
+                processor->getOperand().push<int64_t>(stats.sample((gcstats::Metric)metric));
+                break;
+            }
+            case HeapSnapshot:{
+                auto ins = processor->getOperand().pop<Instance*>();
+                auto path = unicode::toPlatform(fetchStringFromInstance((StringInstance*)ins));
+                std::ofstream out(path, std::ios::binary);
+                if(out) processor->getLoader().getGC()->writeSnapshot(out);
+                processor->getOperand().push<uint8_t>(out ? 1 : 0);
+                break;
+            }
+            case FillExceptionTrace:{
+                auto ins = processor->getOperand().pop<Instance*>();
+                processor->fillExceptionTrace((ExceptionInstance*)ins);
+                break;
+            }
             default: throw "";
         }
     }
@@ -371,11 +386,17 @@ namespace interop {
         {"StringToCStr"_utf32,Intrinsic::StringToCStr},
         {"Pin"_utf32,Intrinsic::Pin},
         {"Unpin"_utf32,Intrinsic::Unpin},
+        {"PinIntrinsic"_utf32,Intrinsic::Pin},
+        {"UnpinIntrinsic"_utf32,Intrinsic::Unpin},
         {"DisableGC"_utf32,Intrinsic::DisableGC},
         {"EnableGC"_utf32,Intrinsic::EnableGC},
         {"AryPtr"_utf32,Intrinsic::AryPtr},
         {"ObjPtr"_utf32,Intrinsic::ObjPtr},
-        {"RefPtr"_utf32,Intrinsic::RefPtr}
+        {"RefPtr"_utf32,Intrinsic::RefPtr},
+        {"NewPinnedBytes"_utf32,Intrinsic::NewPinnedBytes},
+        {"GCStatistic"_utf32,Intrinsic::GCStatistic},
+        {"HeapSnapshot"_utf32,Intrinsic::HeapSnapshot},
+        {"FillExceptionTrace"_utf32,Intrinsic::FillExceptionTrace}
     };
 
     Intrinsic Agent::getInstrinsicByName(unicode::string name){
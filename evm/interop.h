@@ -3,6 +3,7 @@
 #include "runtime.h"
 #include "unicode.h"
 #include "utils.h"
+#include <algorithm>
 #include <cstdint>
 #include <stdexcept>
 
@@ -22,16 +23,55 @@ class GarbageCollector;
 
 namespace interop {
 
-    PACK(struct Instance {
-        runtime::Class *klass;
-        struct Instance *forward;
-        uint8_t pined;
-        uint8_t age;
-    });
+    // 对象头为一个对齐的64位字：
+    //  bit 0       pinned
+    //  bit 1       forwarded，此时除低3位外为转发地址。对象按8字节对齐，只在回收期间出现
+    //  bit 2       majorGC的标记
+    //  bit 3-7     经历的minorGC次数
+    //  bit 32-63   类在runtime::class_table中的序号
+    struct Instance {
+        static constexpr uint64_t pinned_bit = 1;
+        static constexpr uint64_t forwarded_bit = 2;
+        static constexpr uint64_t marked_bit = 4;
+        static constexpr uint32_t age_shift = 3;
+        static constexpr uint64_t age_mask = 0x1f << age_shift;
+        static constexpr uint32_t class_shift = 32;
+
+        uint64_t header;
+
+        inline runtime::Class *getClass() const { return runtime::class_table[header >> class_shift]; }
+        inline uint32_t getClassIndex() const { return header >> class_shift; }
+        inline void setClass(runtime::Class *klass){
+            header = (uint64_t)klass->getClassIndex() << class_shift | (header & ((1ull << class_shift) - 1));
+        }
+
+        inline bool isPinned() const { return header & pinned_bit; }
+        inline void setPinned(bool pinned){ header = pinned ? header | pinned_bit : header & ~pinned_bit; }
+
+        inline bool isMarked() const { return header & marked_bit; }
+        inline void setMarked(bool marked){ header = marked ? header | marked_bit : header & ~marked_bit; }
+
+        inline uint8_t getAge() const { return (header & age_mask) >> age_shift; }
+        inline void setAge(uint8_t age){ header = (header & ~age_mask) | ((uint64_t)std::min<uint8_t>(age, 0x1f) << age_shift); }
+
+        // 转发地址覆盖整个对象头，写入前需已把对象复制到目标位置
+        inline bool isForwarded() const { return header & forwarded_bit; }
+        inline Instance *getForward() const { return (Instance*)(header & ~(uint64_t)7); }
+        inline void setForward(Instance *target){ header = (uint64_t)target | forwarded_bit; }
+    };
 
+    // 对象的大小按此对齐，保证对象头与其后8字节的字段对齐
+    constexpr uint32_t object_alignment = 8;
+
+    inline uint32_t alignObjectSize(uint32_t size){
+        return (size + object_alignment - 1) & ~(object_alignment - 1);
+    }
+
+    // padding使元素从8字节边界开始
     PACK(struct ArrayInstance{
         Instance base;
         int32_t length;
+        int32_t padding;
     }); 
 
     PACK(struct StringInstance {
@@ -42,10 +82,13 @@ namespace interop {
     PACK(struct ExceptionInstance {
         Instance base;
         StringInstance *message;
-        StringInstance *name;
+        StringInstance *name;       // 与trace一样在EB代码读取时才生成
         StringInstance *trace;
+        ArrayInstance *trace_frames;    // 抛出时的调用栈，每个栈帧为(runtime::function_table中的序号, 行号)两个Long
     });
 
+    static_assert(sizeof(Instance) == 8 && sizeof(ArrayInstance) % object_alignment == 0);
+
     PACK(struct InteriorPointer {
         uint8_t *ptr;
         uint32_t offset;
@@ -80,15 +123,27 @@ namespace interop {
         return p;
     }
 
-    uint32_t getInstanceSize(interop::Instance *ins);
+    // klass为ins的类。对象头可能被其他线程改写时(如并行minorGC)由调用者先读出类
+    inline uint32_t getInstanceSize(interop::Instance *ins, runtime::Class *klass){
+        auto &desc = klass->getTraceDescriptor();
+        if(!desc.is_array) return desc.fixed_size;
+        return alignObjectSize(desc.fixed_size + ((ArrayInstance*)ins)->length * desc.element_size);
+    }
+
+    inline uint32_t getInstanceSize(interop::Instance *ins){
+        return getInstanceSize(ins, ins->getClass());
+    }
+
+    // 由ProtectedCell共享的引用，链入GarbageCollector的句柄链表作为根
+    struct Handle{
+        interop::Instance *ins = nullptr;
+        int shared_count = 0;
+        Handle *prev = nullptr, *next = nullptr;
+    };
 
     class ProtectedCell {
         GarbageCollector* gc;
-        struct SharedObj{
-            interop::Instance *ins;
-            int shared_count;
-        };
-        SharedObj *obj;
+        Handle *obj;
     public:
         explicit ProtectedCell(GarbageCollector* gc, interop::Instance* ins);
         ProtectedCell(ProtectedCell &&that);
@@ -225,7 +280,11 @@ namespace interop {
         EnableGC,
         AryPtr,
         ObjPtr,
-        RefPtr
+        RefPtr,
+        NewPinnedBytes,
+        GCStatistic,
+        HeapSnapshot,
+        FillExceptionTrace
     };
 
     class Agent{
@@ -236,7 +295,8 @@ namespace interop {
         ProtectedCell createString(unicode::string string);
 
         interop::Instance *createUnprotectedInstance(runtime::Class *klass, std::list<Value> parameters);
-        interop::ArrayInstance *createUnprotectedArray(runtime::SpecializedArray *array, int count);
+        // pinned为true时分配在GC的固定空间中，对象不会被移动
+        interop::ArrayInstance *createUnprotectedArray(runtime::SpecializedArray *array, int count, bool pinned = false);
         interop::StringInstance *createUnprotectedString(unicode::string string);
 
 
@@ -0,0 +1,100 @@
+#include "layout.h"
+#include "runtime.h"
+#include "trace.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace layout {
+
+    namespace {
+        constexpr uint32_t ref_alignment = sizeof(void*);
+
+        Statistics totals;
+
+        struct Pending {
+            runtime::Variable *variable;
+            uint32_t size;
+            uint32_t alignment;
+        };
+
+        inline uint32_t alignUp(uint32_t offset, uint32_t alignment){
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    uint32_t alignmentOf(runtime::Symbol *type){
+        using namespace runtime;
+        if(instancesOf<Class>(type)) return ref_alignment;
+        if(auto pmt = dynamic_cast<Primitive*>(type)) return pmt->getSize();
+        if(auto rcd = dynamic_cast<Record*>(type)) return rcd->getAlignment();
+        if(instancesOf<Enumeration>(type) || instancesOf<EnumConstant>(type)) return ref_alignment;
+        throw std::invalid_argument("unexpected field type in layout::alignmentOf");
+    }
+
+    Layout arrange(uint32_t base, const std::vector<runtime::Variable*> &variables){
+        Layout layout;
+        layout.size = base;
+
+        std::vector<runtime::Variable*> refs;
+        std::vector<Pending> values;
+        for(auto variable : variables){
+            auto type = variable->getType();
+            if(runtime::instancesOf<runtime::Class>(type)){
+                refs.push_back(variable);
+            }
+            else{
+                values.push_back(Pending{variable, runtime::getRuntimeSize(type), alignmentOf(type)});
+            }
+        }
+        // 对齐大的在前，相同对齐时大的在前，其余保持名称顺序
+        std::stable_sort(values.begin(), values.end(), [](const Pending &lhs, const Pending &rhs){
+            if(lhs.alignment != rhs.alignment) return lhs.alignment > rhs.alignment;
+            return lhs.size > rhs.size;
+        });
+
+        auto place = [&](runtime::Variable *variable, uint32_t size, uint32_t alignment){
+            auto offset = alignUp(layout.size, alignment);
+            layout.padding += offset - layout.size;
+            layout.slots.push_back(Slot{variable, offset, size});
+            layout.size = offset + size;
+            layout.alignment = std::max(layout.alignment, alignment);
+            return offset;
+        };
+
+        // 用恰好能放下且不需要填充的字段填补到8字节边界的空隙，对齐大的优先
+        auto boundary = alignUp(layout.size, ref_alignment);
+        for(auto itr = values.begin(); itr != values.end() && layout.size < boundary;){
+            if(layout.size % itr->alignment == 0 && layout.size + itr->size <= boundary){
+                place(itr->variable, itr->size, itr->alignment);
+                values.erase(itr);
+                itr = values.begin();
+            }
+            else itr++;
+        }
+
+        for(auto variable : refs){
+            layout.ref_offsets.push_back(place(variable, sizeof(void*), ref_alignment));
+        }
+
+        for(auto &value : values){
+            place(value.variable, value.size, value.alignment);
+        }
+
+        return layout;
+    }
+
+    void report(runtime::Symbol *owner, const Layout &layout, uint32_t tail){
+        totals.types++;
+        totals.bytes += layout.size + tail;
+        totals.padding += layout.padding + tail;
+        LOG(Loader, "layout " << owner->qualifiedName() << ": " << layout.slots.size() << " fields, size "
+            << layout.size + tail << ", align " << layout.alignment << ", padding " << layout.padding + tail << std::endl);
+        for(auto &slot : layout.slots){
+            LOG_VERBOSE(Loader, "    " << slot.variable->name << " +" << slot.offset << " (" << slot.size << ")" << std::endl);
+        }
+    }
+
+    const Statistics &statistics(){
+        return totals;
+    }
+}
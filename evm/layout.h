@@ -0,0 +1,51 @@
+#ifndef EVM_LAYOUT
+#define EVM_LAYOUT
+#include <cstdint>
+#include <vector>
+
+namespace runtime {
+    class Symbol;
+    class Variable;
+}
+
+// 字段布局。类的实例字段、record的字段以及静态区中的变量都由此决定偏移：
+//  1. 先用小字段填满base之后到8字节边界的空隙(如基类末尾的Integer之后)
+//  2. 引用字段按名称顺序连续放置，GC可以把它们当作一段连续的槽位扫描
+//  3. 其余字段按对齐从大到小放置，之后的字段不再需要填充
+// 名称相同对齐的字段保持名称顺序，与interop中的StringInstance、ExceptionInstance等镜像结构一致
+namespace layout {
+
+    struct Slot {
+        runtime::Variable *variable;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct Layout {
+        std::vector<Slot> slots;
+        std::vector<uint32_t> ref_offsets;  // 本次放置的引用字段，连续且按8字节对齐
+        uint32_t size = 0;                  // 含base在内的大小
+        uint32_t alignment = 1;             // 字段中最大的对齐
+        uint32_t padding = 0;               // 为对齐插入的字节数
+    };
+
+    // 值的对齐。引用、枚举为指针大小，基本类型为其大小，record为其字段中最大的对齐
+    uint32_t alignmentOf(runtime::Symbol *type);
+
+    // 从偏移base开始放置variables，variables按名称有序
+    Layout arrange(uint32_t base, const std::vector<runtime::Variable*> &variables);
+
+    // 输出类型的布局与填充字节数，tail为类型末尾额外的填充(如对象按8字节取整)
+    void report(runtime::Symbol *owner, const Layout &layout, uint32_t tail = 0);
+
+    // 已完成布局的类型的字段总字节数与填充总字节数
+    struct Statistics {
+        uint64_t types = 0;
+        uint64_t bytes = 0;
+        uint64_t padding = 0;
+    };
+
+    const Statistics &statistics();
+}
+
+#endif
@@ -1,10 +1,12 @@
 #include "loader.h"
 #include "gc.h"
 #include "interop.h"
+#include "layout.h"
 #include "processor.h"
 #include "backage.pb.h"
 #include "dependencies.h"
 #include "runtime.h"
+#include "threaded.h"
 #include "unicode.h"
 #include <fstream>
 #include <stdexcept>
@@ -52,10 +54,11 @@ runtime::Symbol *TokenTable::search(Token *token){
 
 
 
-Loader::Loader(unicode::string package_folder) : package_folder(package_folder), specialized_array_pool(*this) {
+Loader::Loader(unicode::string package_folder, const heap::Options &heap_options) : package_folder(package_folder), specialized_array_pool(*this) {
     global = new runtime::Global();
+    // Agent中的Processor构造时需要向gc登记
+    gc = new GarbageCollector(heap_options);
     interop_agent = new interop::Agent(this);
-    gc = new GarbageCollector(2048);
     ffi = new ForeignFunctionInterface();
 
     using enum runtime::PrimitiveKind;
@@ -221,6 +224,8 @@ void Loader::load(){
     eb_evm_internal_exception = dynamic_cast<runtime::Class*>(global->find("EvmInternalException"_utf32));
     eb_divide_by_zero_exception = dynamic_cast<runtime::Class*>(global->find("DivideByZeroException"_utf32));
     eb_object_unpinned_exception = dynamic_cast<runtime::Class*>(global->find("ObjectUnpinned"_utf32));
+    eb_gc_budget_exceeded_exception = dynamic_cast<runtime::Class*>(global->find("GCBudgetExceeded"_utf32));
+    eb_stack_overflow_exception = dynamic_cast<runtime::Class*>(global->find("StackOverflowException"_utf32));
     eb_ffi_entry_not_found_exception = dynamic_cast<runtime::Class*>(global->find("FFIEntryNotFoundException"_utf32));
     eb_ffi_module_not_found_exception = dynamic_cast<runtime::Class*>(global->find("FFIModuleNotFoundException"_utf32));
 
@@ -232,6 +237,13 @@ void Loader::load(){
         throw "size resolve error";
     }
 
+    //complete record。类的字段布局需要record的大小与对齐，因此先于类完成
+    LOG(Loader,"record:"<<std::endl);
+    for(auto rcd : size_dependencies.getOrder()){
+        rcd->complete();
+        LOG(Loader, rcd->name << "(" << rcd->getMemorySize() << ") -> "<<std::endl);
+    }
+
     //complete class
     LOG(Loader,"class:"<<std::endl);
     for(auto cls : inherit_dependencies.getOrder()){
@@ -242,13 +254,6 @@ void Loader::load(){
                 << ") -> "<<std::endl); 
     }
 
-    //complete record
-    LOG(Loader,"record:"<<std::endl);
-    for(auto rcd : size_dependencies.getOrder()){
-        rcd->complete();
-        LOG(Loader, rcd->name << "(" << rcd->getMemorySize() << ") -> "<<std::endl);
-    }
-
     //complete specialized array
     getSpecilizedArrayPool()->completeAll();
 
@@ -267,4 +272,44 @@ void Loader::load(){
             sym->complete();
         }
     }
+
+    LOG(Loader, "layout: " << layout::statistics().types << " types, " << layout::statistics().bytes
+        << " bytes, " << layout::statistics().padding << " bytes of padding" << std::endl);
+
+    link();
+}
+
+// 所有符号完成布局后，翻译每个函数的字节码并将token解析为运行时数据
+void Loader::link(){
+    using namespace runtime;
+    std::queue<Symbol*> sym_queue;
+    sym_queue.push(global);
+    while(!sym_queue.empty()){
+        auto sym = sym_queue.front();
+        sym_queue.pop();
+        if(auto hosted = dynamic_cast<HostedFunction*>(sym)){
+            // 无法链接的函数保持未翻译状态，第一次被调用时在调用者中抛出EvmInternalException
+            if(hosted->getCode() == nullptr){
+                try{
+                    hosted->setCode(threaded::translate(hosted, *this));
+                }
+                catch(std::exception &e){
+                    LOG(Loader, "cannot link " << hosted->name << ": " << e.what() << std::endl);
+                }
+                catch(const char *msg){
+                    LOG(Loader, "cannot link " << hosted->name << ": " << msg << std::endl);
+                }
+            }
+        }
+        else if(auto variable = dynamic_cast<Variable*>(sym)){
+            // 静态字段所在的内存不会移动，链接时一次性登记其中的引用
+            if(variable->getStaticAddress() != nullptr && instancesOf<Class>(variable->getType())){
+                gc->addStaticRoot((interop::Instance**)variable->getStaticAddress());
+            }
+        }
+        else if(instancesOf<Global>(sym) || instancesOf<Module>(sym) || instancesOf<Class>(sym)){
+            for(auto [_,child] : dynamic_cast<Scope*>(sym)->getChildern())
+                sym_queue.push(child);
+        }
+    }
 }
\ No newline at end of file
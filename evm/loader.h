@@ -139,10 +139,13 @@ class Loader{
                     *eb_evm_internal_exception = nullptr,
                     *eb_divide_by_zero_exception = nullptr,
                     *eb_object_unpinned_exception = nullptr,
+                    *eb_gc_budget_exceeded_exception = nullptr,
+                    *eb_stack_overflow_exception = nullptr,
                     *eb_ffi_entry_not_found_exception = nullptr,
                     *eb_ffi_module_not_found_exception = nullptr;
 
     runtime::Symbol *createSymbol(Backage::Declaration &decl, TokenTable &table);
+    void link();
     
 public:
 
@@ -176,6 +179,8 @@ public:
     inline runtime::Class *getEBEvmInternalException(){ return eb_evm_internal_exception; }
     inline runtime::Class *getEBDivideByZeroException(){ return eb_divide_by_zero_exception; }
     inline runtime::Class *getEBObjectUnpinnedException(){ return eb_object_unpinned_exception; }
+    inline runtime::Class *getEBGCBudgetExceededException(){ return eb_gc_budget_exceeded_exception; }
+    inline runtime::Class *getEBStackOverflowException(){ return eb_stack_overflow_exception; }
     inline runtime::Class *getEBFFIModuleNotFoundException(){ return eb_ffi_module_not_found_exception; }
     inline runtime::Class *getEBFFIEntryNotFoundException(){ return eb_ffi_entry_not_found_exception; }
 
@@ -184,7 +189,7 @@ public:
 
     void load();
 
-    explicit Loader(unicode::string package_folder);
+    explicit Loader(unicode::string package_folder, const heap::Options &heap_options = {});
 
 };
 
@@ -1,10 +1,16 @@
 #include "backage.pb.h"
+#include "heap.h"
 #include "loader.h"
 #include "processor.h"
+#include "profiler.h"
 #include "runtime.h"
+#include "trace.h"
 
+#include <csignal>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <optional>
 #include <string>
 #include <iostream>
 
@@ -93,10 +99,6 @@ public:
 
 
 int main(int argc, char *argv[]){
-    std::ofstream out("debug.txt");
-    std::clog.rdbuf(out.rdbuf());
-    LOG(ARGS[0],std::string(argv[0])<<std::endl);
-
     std::vector<std::string> args;
     for(int i=1;i<argc;i++){
         args.push_back(std::string(argv[i]));
@@ -105,11 +107,132 @@ int main(int argc, char *argv[]){
     std::string run_target = "";
     std::string package_folder = ".";
 
+    // 环境变量中的trace配置先生效，命令行参数可以覆盖
+    auto configureTrace = [](std::string spec){
+        try{
+            trace::configure(spec);
+            return true;
+        }
+        catch(std::invalid_argument &e){
+            std::cout<<"Error: "<<e.what()<<std::endl;
+            return false;
+        }
+    };
+    auto setTraceOutput = [](std::string path){
+        try{
+            trace::setOutput(path);
+            return true;
+        }
+        catch(std::invalid_argument &e){
+            std::cout<<"Error: "<<e.what()<<std::endl;
+            return false;
+        }
+    };
+    heap::Options heap_options;
+    auto setHeapSize = [](size_t &target){
+        return [&target](std::string str){
+            try{
+                target = heap::parseSize(str);
+                return true;
+            }
+            catch(std::invalid_argument &e){
+                std::cout<<"Error: "<<e.what()<<std::endl;
+                return false;
+            }
+        };
+    };
+    auto setGCThreads = [&](std::string str){
+        try{
+            size_t end;
+            auto threads = std::stoul(str, &end);
+            if(end != str.size() || threads > 256) throw std::invalid_argument("");
+            heap_options.gc_threads = threads;
+            return true;
+        }
+        catch(std::exception&){
+            std::cout<<"Error: invalid gc thread count '"<<str<<"'"<<std::endl;
+            return false;
+        }
+    };
+    auto setIncrementBudget = [&](std::string str){
+        try{
+            size_t end;
+            auto budget = std::stoul(str, &end);
+            if(end != str.size() || budget == 0 || budget > 10000000) throw std::invalid_argument("");
+            heap_options.increment_budget = budget;
+            return true;
+        }
+        catch(std::exception&){
+            std::cout<<"Error: invalid increment budget '"<<str<<"'"<<std::endl;
+            return false;
+        }
+    };
+    bool env_flag = true;
+    if(auto spec = std::getenv("EVM_TRACE")) env_flag = configureTrace(spec) && env_flag;
+    if(auto path = std::getenv("EVM_TRACE_FILE")) env_flag = setTraceOutput(path) && env_flag;
+    if(auto size = std::getenv("EVM_HEAP_MIN")) env_flag = setHeapSize(heap_options.min)(size) && env_flag;
+    if(auto size = std::getenv("EVM_HEAP_MAX")) env_flag = setHeapSize(heap_options.max)(size) && env_flag;
+    if(auto size = std::getenv("EVM_NURSERY")) env_flag = setHeapSize(heap_options.nursery)(size) && env_flag;
+    if(auto size = std::getenv("EVM_LARGE_OBJECT")) env_flag = setHeapSize(heap_options.large_object)(size) && env_flag;
+    if(std::getenv("EVM_HUGE_PAGES")) heap_options.huge_pages = true;
+    if(auto path = std::getenv("EVM_HEAP_SNAPSHOT")) heap_options.snapshot = path;
+    if(std::getenv("EVM_NOGC_OVERFLOW")) heap_options.nogc_overflow = true;
+    if(auto threads = std::getenv("EVM_GC_THREADS")) env_flag = setGCThreads(threads) && env_flag;
+    if(std::getenv("EVM_INCREMENTAL_GC")) heap_options.incremental = true;
+    if(auto budget = std::getenv("EVM_INCREMENT_BUDGET")) env_flag = setIncrementBudget(budget) && env_flag;
+    // 退出时输出GC统计，文本写到stderr，JSON写到指定文件
+    bool gc_stats = false;
+    std::string gc_stats_file;
+    if(std::getenv("EVM_GC_STATS")) gc_stats = true;
+    if(auto path = std::getenv("EVM_GC_STATS_FILE")) gc_stats_file = path;
+    // 分配采样，退出时把折叠栈写到alloc_profile
+    std::string alloc_profile;
+    size_t alloc_sample_interval = 512 << 10;
+    if(auto path = std::getenv("EVM_ALLOC_PROFILE")) alloc_profile = path;
+    if(auto size = std::getenv("EVM_ALLOC_SAMPLE_INTERVAL")) env_flag = setHeapSize(alloc_sample_interval)(size) && env_flag;
+
     CmdDispatcher dispatcher;
     auto flag = dispatcher.add("package-folder","p","path to .bkg folder",[&](std::string path){
         package_folder = path;
         return true;
     })
+    .add("trace","t","trace tags and levels, e.g. Loader,Instruction=verbose",configureTrace)
+    .add("trace-file","tf","write trace output to file instead of stderr",setTraceOutput)
+    .add("heap-min","hmin","initial old generation size, e.g. 8m",setHeapSize(heap_options.min))
+    .add("heap-max","hmax","maximum old generation size, e.g. 1g",setHeapSize(heap_options.max))
+    .add("nursery","n","initial nursery semi-space size, e.g. 1m",setHeapSize(heap_options.nursery))
+    .add("large-object","lo","objects of at least this size are allocated in the large object space, e.g. 32k",setHeapSize(heap_options.large_object))
+    .add("huge-pages","hp","back the heap with transparent huge pages",[&](){
+        heap_options.huge_pages = true;
+        return true;
+    })
+    .add("gc-threads","gt","threads used by minor collections, 0 for one per core",setGCThreads)
+    .add("incremental-gc","igc","collect the old generation incrementally with the train algorithm",[&](){
+        heap_options.incremental = true;
+        return true;
+    })
+    .add("increment-budget","ib","pause budget of each incremental collection in microseconds",setIncrementBudget)
+    .add("nogc-overflow","ngo","keep allocating when a DisableGC region exceeds its budget instead of raising GCBudgetExceeded",[&](){
+        heap_options.nogc_overflow = true;
+        return true;
+    })
+    .add("heap-snapshot","hs","write heap snapshots to <prefix>.N on SIGUSR2 or out of memory",[&](std::string prefix){
+        heap_options.snapshot = prefix;
+        return true;
+    })
+    .add("gc-stats","gs","print GC statistics on exit",[&](){
+        gc_stats = true;
+        return true;
+    })
+    .add("gc-stats-file","gsf","write GC statistics as JSON to file on exit",[&](std::string path){
+        gc_stats_file = path;
+        return true;
+    })
+    .add("alloc-profile","ap","sample allocations and write folded stacks for flame graphs to file on exit",[&](std::string path){
+        alloc_profile = path;
+        return true;
+    })
+    .add("alloc-sample-interval","asi","average allocated bytes between allocation samples, e.g. 512k",setHeapSize(alloc_sample_interval))
     .add("help","h","print help info",[&](){
         dispatcher.printMenu();
         return true;
@@ -130,9 +253,33 @@ int main(int argc, char *argv[]){
         flag = false;
     }
 
-    if(!flag)return 0;
+    if(heap_options.min > heap_options.max){
+        std::cout<<"Error: heap-min is larger than heap-max"<<std::endl;
+        flag = false;
+    }
 
-    Loader loader(unicode::fromPlatform(package_folder));
+    if(alloc_sample_interval == 0){
+        std::cout<<"Error: alloc-sample-interval must be larger than 0"<<std::endl;
+        flag = false;
+    }
+
+    if(heap_options.large_object == 0){
+        std::cout<<"Error: large-object must be larger than 0"<<std::endl;
+        flag = false;
+    }
+
+    if(!flag || !env_flag)return 0;
+
+    trace::start();
+
+#ifdef SIGUSR2
+    if(!heap_options.snapshot.empty()){
+        std::signal(SIGUSR2, [](int){ GarbageCollector::requestSnapshot(); });
+    }
+#endif
+    LOG(Args,std::string(argv[0])<<std::endl);
+
+    Loader loader(unicode::fromPlatform(package_folder), heap_options);
     loader.fromPackageFolder(unicode::fromPlatform(run_target));
     loader.load();
 
@@ -140,6 +287,31 @@ int main(int argc, char *argv[]){
     auto ctor = ((runtime::Ctor*)cls->find("#ctor"_utf32));
     
     Processor processor(&loader);
+
+    std::optional<AllocationProfiler> profiler;
+    if(!alloc_profile.empty()){
+        profiler.emplace(processor);
+        loader.getGC()->setAllocationSampler(&*profiler, alloc_sample_interval);
+    }
     
     processor.execute(loader.getGlobal()->getMainMethod());
+
+    if(profiler){
+        loader.getGC()->setAllocationSampler(nullptr, 0);
+        std::ofstream out(alloc_profile);
+        if(out) profiler->writeFolded(out);
+        else std::cout<<"Error: cannot open '"<<alloc_profile<<"'"<<std::endl;
+    }
+
+    if(gc_stats || !gc_stats_file.empty()){
+        auto &stats = loader.getGC()->getStatistics();
+        if(gc_stats) stats.print(std::cerr);
+        if(!gc_stats_file.empty()){
+            std::ofstream out(gc_stats_file);
+            if(out) stats.writeJson(out);
+            else std::cout<<"Error: cannot open '"<<gc_stats_file<<"'"<<std::endl;
+        }
+    }
+
+    trace::stop();
 }
\ No newline at end of file
@@ -4,229 +4,161 @@
 #include "interop.h"
 #include "gc.h"
 
-std::list<uintptr_t> mapLiveSet(std::list<Reference> live_set){
-    std::list<uintptr_t> ret;
-    for(auto r : live_set)ret.push_back(r.getID());
-    return ret;
-}
-
-void Processor::popArgsFromOperand(runtime::HostedFunction *hosted, uint8_t *frame, std::list<Reference> &live_set){
-    if(hosted->getParamArray() != nullptr){
-        loader.getGC()->removeRoot(operand.ptrToPeek<interop::Instance*>());
-        auto param_array_ref = operand.pop<interop::ArrayInstance*>();
-        auto dst = frame + hosted->getParamArray()->getOffset();
-        seqcpy(dst, (uint8_t*)(&param_array_ref), sizeof(void*));
+void Processor::popArgsFromOperand(runtime::HostedFunction *hosted, uint8_t *frame){
+    auto &plan = hosted->getArgumentPlan();
+    if(plan.has_param_array){
+        operand.popToPtr(frame + plan.param_array_offset, sizeof(interop::ArrayInstance*));
     }
 
-    if(hosted->getOptionalParameters().size() != 0){
+    if(plan.has_optional){
         auto option_count = operand.pop<uint8_t>();
         while(option_count--){
             auto option = operand.pop<runtime::OptionalParameter*>();
             *(frame + option->getFlagOffset()) = 1; 
             // 在从operand上拷贝数据到栈帧之前设置option flag。
             // 因为当option参数是按引用传递时，flag与value共用内存空间。
-            auto dst_ptr = frame + option->getOffset();
-            if(option->getEvalKind() == runtime::EvaluationKind::Byref){
-                OpRemoveRoot<interop::InteriorPointer>();
-            }
-            else if(runtime::instancesOf<runtime::Class>(option->getType())){
-                OpRemoveRoot<interop::Instance*>();
-            }
-            seqcpy(dst_ptr, operand.popAndGetTop(option->getLength()), option->getLength());
+            operand.popToPtr(frame + option->getOffset(), option->getLength());
         }
     }
 
-    for(int i = 0; i < hosted->getNormalParameters().size(); i++){
-        auto &parameter = hosted->getNormalParameters()[i];
-        
-        auto dst_ptr = frame + parameter->getOffset();
-        if(parameter->getEvalKind() == runtime::EvaluationKind::Byref){
-            OpRemoveRoot<interop::InteriorPointer>();
-        }
-        else if(runtime::instancesOf<runtime::Class>(parameter->getType())){ //byval
-            OpRemoveRoot<interop::Instance*>();
-        }
-        auto src_ptr = operand.popAndGetTop(parameter->getLength());
-        seqcpy(dst_ptr, src_ptr, parameter->getLength());
+    auto src = operand.popAndGetTop(plan.normal_size);
+    for(auto &move : plan.moves){
+        memcpy(frame + move.dst, src + move.src, move.length);
     }
+}
 
-    for(auto ref_offset : hosted->getStackFrameRefOffsets()){
-        live_set.push_back(Reference::fromRefPtr((interop::Instance**)(frame + ref_offset)));
+// 参数区域只清零实参不会覆盖的部分。局部变量仍全部清零，没有初始值的Dim依赖零值
+static inline void clearParameters(runtime::Function *function, uint8_t *memory){
+    for(auto &range : function->getParamClearRanges()){
+        memset(memory + range.begin, 0, range.length);
     }
+}
+
+void Processor::invokeStaticMethod(runtime::Method *method){
+    auto param_size = method->getParamMemorySize();
+    if(!stackCheck(param_size + method->getLocalMemorySize())) return;
+    auto memory = getFrame().borrow(param_size + method->getLocalMemorySize());
+    clearParameters(method, memory);
+    memset(memory + param_size, 0, method->getLocalMemorySize());
+    popArgsFromOperand(method,memory);
+    call_stack.push(method,memory,operand.getTop());
+}
 
-    for(auto itp_offset : hosted->getStackFrameInteriorPointerOffsets()){
-        live_set.push_back(Reference::fromInterior((interop::InteriorPointer*)(frame + itp_offset)));
+// 实参在操作栈上的总长度，接收者紧挨在其下。可选参数的个数与长度从操作栈上读出
+static inline uint32_t argumentDepth(runtime::HostedFunction *hosted, MemoryStack &operand){
+    auto &plan = hosted->getArgumentPlan();
+    uint32_t depth = 0;
+    if(plan.has_param_array) depth += sizeof(interop::ArrayInstance*);
+    if(plan.has_optional){
+        auto option_count = operand.peekBelow<uint8_t>(depth);
+        depth += sizeof(uint8_t);
+        while(option_count--){
+            auto option = operand.peekBelow<runtime::OptionalParameter*>(depth);
+            depth += sizeof(runtime::OptionalParameter*) + option->getLength();
+        }
     }
+    return depth + plan.normal_size;
+}
 
+// 按接收者的类查找虚函数的实现与其栈帧大小，先查调用点的内联缓存，未命中时查虚函数表并记录到缓存
+static inline runtime::Method *dispatchVirtual(runtime::VirtualMethod *method, interop::Instance *instance,
+                                               threaded::InlineCache *cache, uint32_t &frame_size){
+    auto class_index = instance->getClassIndex();
+    if(!cache->isMegamorphic()){
+        if(auto entry = cache->lookup(class_index, method)){
+            frame_size = entry->frame_size;
+            return entry->target;
+        }
+    }
+    auto target = instance->getClass()->dispatchMethod(method->getVTableOffset());
+    frame_size = target->getParamMemorySize() + target->getLocalMemorySize();
+    if(!cache->isMegamorphic()) cache->record(class_index, method, target, frame_size);
+    return target;
 }
 
-void Processor::invokeStaticMethod(runtime::Method *method){
-    auto frame_size = method->getParamMemorySize() + method->getLocalMemorySize();
+// 按接收者的类确定真正调用的函数，再按它的参数布局一次分配整个栈帧并传参。
+// 实参之下还有receiver_size字节的接收者时一并弹出
+void Processor::enterVirtual(runtime::VirtualMethod *method, interop::Instance *instance,
+                             threaded::InlineCache *cache, uint32_t receiver_size){
+    uint32_t frame_size;
+    auto ftn = dispatchVirtual(method, instance, cache, frame_size);
+    if(!stackCheck(frame_size)) return;
+    auto param_size = ftn->getParamMemorySize();
     auto memory = getFrame().borrow(frame_size);
-    memset(memory, 0, frame_size);
-    std::list<Reference> live_set;
-    popArgsFromOperand(method,memory,live_set);
-    call_stack.push_back(CallEnv(method,mapLiveSet(live_set),memory,getFrame()));
-
-    for(Reference live : live_set){
-        loader.getGC()->addRoot(live.getID(),live);
-    }
+    clearParameters(ftn, memory);
+    memset(memory + param_size, 0, frame_size - param_size);
+    popArgsFromOperand(ftn, memory);
+    operand.pop((int)receiver_size);
+    *((interop::Instance**)memory) = instance; // 设置参数栈第一个参数为实例的引用
+    call_stack.push(ftn,memory,operand.getTop());
 }
 
-void Processor::invokeVirtualMethod(runtime::VirtualMethod *method){
-    auto memory = getFrame().borrow(method->getSelfImpl()->getParamMemorySize());
-    memset(memory, 0, method->getSelfImpl()->getParamMemorySize());
-    std::list<Reference> live_set;
-    popArgsFromOperand(method->getSelfImpl(), memory, live_set);
+// 先读出实参之下的接收者，再调用它的类中的实现
+void Processor::invokeVirtualMethod(runtime::VirtualMethod *method, threaded::InlineCache *cache){
+    auto depth = argumentDepth(method->getSelfImpl(), operand);
+    auto instance = operand.peekBelow<interop::Instance*>(depth);
+    // 抛出NullPointerException之前弹出实参与接收者
+    if(instance == nullptr) operand.pop((int)(depth + sizeof(interop::Instance*)));
 
-    // self pointer
-    loader.getGC()->removeRoot(operand.ptrToPeek<interop::Instance*>());
-    auto instance = getOperand().pop<interop::Instance*>();
+    if (nullPointerCheck(instance)) {
+        enterVirtual(method, instance, cache, sizeof(interop::Instance*));
+    }
+}
 
+void Processor::invokeVirtualMethod(runtime::VirtualMethod *method, threaded::InlineCache *cache, interop::Instance *instance){
+    if(instance == nullptr) operand.pop((int)argumentDepth(method->getSelfImpl(), operand));
     if (nullPointerCheck(instance)) {
-        *((interop::Instance**)memory) = instance; // 设置参数栈第一个参数为实例的引用
-        auto ftn = instance->klass->dispatchMethod(method->getVTableOffset());
-        auto local_memory = getFrame().borrow(ftn->getLocalMemorySize()); // 分配虚函数表中真正调用的函数的栈帧内存
-        memset(local_memory, 0, ftn->getLocalMemorySize());
-        call_stack.push_back(CallEnv(ftn,mapLiveSet(live_set),memory,getFrame()));
-
-        for(Reference live : live_set){
-            loader.getGC()->addRoot(live.getID(),live);
-        }
+        enterVirtual(method, instance, cache, 0);
     }
 }
 
 void Processor::invokeCtor(runtime::Ctor *ctor){
-    auto frame_size = ctor->getParamMemorySize() + ctor->getLocalMemorySize();
-    auto memory = getFrame().borrow(frame_size);
-    memset(memory, 0, frame_size);
-    std::list<Reference> live_set;
-    popArgsFromOperand(ctor, memory, live_set);
+    auto param_size = ctor->getParamMemorySize();
+    if(!stackCheck(param_size + ctor->getLocalMemorySize())) return;
+    auto memory = getFrame().borrow(param_size + ctor->getLocalMemorySize());
+    clearParameters(ctor, memory);
+    memset(memory + param_size, 0, ctor->getLocalMemorySize());
+    popArgsFromOperand(ctor, memory);
     
     // self pointer
-    loader.getGC()->removeRoot(operand.ptrToPeek<interop::Instance*>());
     auto instance = getOperand().pop<interop::Instance*>();
 
     *((interop::Instance**)memory) = instance;// 设置参数栈第一个参数为实例的引用
-    call_stack.push_back(CallEnv(ctor, mapLiveSet(live_set), memory, getFrame()));
-
-    for(Reference live : live_set){
-        loader.getGC()->addRoot(live.getID(),live);
-    }
+    call_stack.push(ctor,memory,operand.getTop());
 }
 
 void Processor::invokeMethod(runtime::Method *method){
-    auto frame_size = method->getParamMemorySize() + method->getLocalMemorySize();
-    auto memory = getFrame().borrow(frame_size);
-    memset(memory, 0, frame_size);
-    std::list<Reference> live_set;
-    popArgsFromOperand(method, memory, live_set);
+    auto param_size = method->getParamMemorySize();
+    if(!stackCheck(param_size + method->getLocalMemorySize())) return;
+    auto memory = getFrame().borrow(param_size + method->getLocalMemorySize());
+    clearParameters(method, memory);
+    memset(memory + param_size, 0, method->getLocalMemorySize());
+    popArgsFromOperand(method, memory);
 
     // self pointer
-    loader.getGC()->removeRoot(operand.ptrToPeek<interop::Instance*>());
     auto instance = getOperand().pop<interop::Instance*>();
+    // 抛出NullPointerException之前释放栈帧，否则在本函数内捕获时这部分内存不会被归还
+    if(instance == nullptr) getFrame().restore(memory);
 
     if (nullPointerCheck(instance)) {
         *((interop::Instance**)memory) = instance;
-        call_stack.push_back(CallEnv(method, mapLiveSet(live_set), memory, getFrame()));
-
-        for(Reference live : live_set){
-            loader.getGC()->addRoot(live.getID(),live);
-        }
+        call_stack.push(method,memory,operand.getTop());
     }
 }
 
-#define ForEachIntegralType(Op) \
-    switch (consume<uint8_t>()) {\
-        case bytecode::t_boolean: Op<uint8_t>(); break;\
-        case bytecode::t_i8: Op<int8_t>(); break;\
-        case bytecode::t_i16: Op<int16_t>(); break;\
-        case bytecode::t_i32: Op<int32_t>(); break;\
-        case bytecode::t_i64: Op<int64_t>(); break;\
-        case bytecode::t_u8: Op<uint8_t>(); break;\
-        case bytecode::t_u16: Op<uint16_t>(); break;\
-        case bytecode::t_u32: Op<uint32_t>(); break;\
-        case bytecode::t_u64: Op<uint64_t>(); break;\
-        default: throw std::invalid_argument("unexpedted type");\
-    }
-
-#define ForEachArithmeticType(Op) \
-    switch (consume<uint8_t>()) {\
-        case bytecode::t_boolean: Op<uint8_t>(); break;\
-        case bytecode::t_i8: Op<int8_t>(); break;\
-        case bytecode::t_i16: Op<int16_t>(); break;\
-        case bytecode::t_i32: Op<int32_t>(); break;\
-        case bytecode::t_i64: Op<int64_t>(); break;\
-        case bytecode::t_u8: Op<uint8_t>(); break;\
-        case bytecode::t_u16: Op<uint16_t>(); break;\
-        case bytecode::t_u32: Op<uint32_t>(); break;\
-        case bytecode::t_u64: Op<uint64_t>(); break;\
-        case bytecode::t_f32: Op<float>(); break;\
-        case bytecode::t_f64: Op<double>(); break;\
-        default: throw std::invalid_argument("unexpedted type");\
-    }
-
-#define ForEachTypeWithOrd(Op) \
-    auto typ = consume<uint8_t>();\
-    switch (typ) {\
-        case bytecode::t_boolean: Op<uint8_t>(); break;\
-        case bytecode::t_i8: Op<int8_t>(); break;\
-        case bytecode::t_i16: Op<int16_t>(); break;\
-        case bytecode::t_i32: Op<int32_t>(); break;\
-        case bytecode::t_i64: Op<int64_t>(); break;\
-        case bytecode::t_u8: Op<uint8_t>(); break;\
-        case bytecode::t_u16: Op<uint16_t>(); break;\
-        case bytecode::t_u32: Op<uint32_t>(); break;\
-        case bytecode::t_u64: Op<uint64_t>(); break;\
-        case bytecode::t_f32: Op<float>(); break;\
-        case bytecode::t_f64: Op<double>(); break;\
-        case bytecode::t_emconst: Op<void*>(); break;\
-        case bytecode::t_ref: Op<interop::Instance*>(); break;\
-        default: throw std::invalid_argument("unexpedted type");\
-    }
-
-
-#define ForEachType(Op) \
-    auto typ = consume<uint8_t>();\
-    switch (typ) {\
-        case bytecode::t_boolean: Op<uint8_t>(); break;\
-        case bytecode::t_i8: Op<int8_t>(); break;\
-        case bytecode::t_i16: Op<int16_t>(); break;\
-        case bytecode::t_i32: Op<int32_t>(); break;\
-        case bytecode::t_i64: Op<int64_t>(); break;\
-        case bytecode::t_u8: Op<uint8_t>(); break;\
-        case bytecode::t_u16: Op<uint16_t>(); break;\
-        case bytecode::t_u32: Op<uint32_t>(); break;\
-        case bytecode::t_u64: Op<uint64_t>(); break;\
-        case bytecode::t_f32: Op<float>(); break;\
-        case bytecode::t_f64: Op<double>(); break;\
-        case bytecode::t_emconst: Op<void*>(); break;\
-        case bytecode::t_ref: Op<interop::Instance*>(); break;\
-        case bytecode::t_hdl: Op<interop::InteriorPointer>(); break;\
-        case bytecode::t_record: Op<interop::RecordOpaque>(); break;\
-        default: throw std::invalid_argument("unexpedted type");\
-    }
-
-#define ForEachTypeWithRefFlag(Op) \
-    auto typ = consume<uint8_t>();\
-    switch (typ) {\
-        case bytecode::t_boolean: Op<uint8_t>(false); break;\
-        case bytecode::t_i8: Op<int8_t>(false); break;\
-        case bytecode::t_i16: Op<int16_t>(false); break;\
-        case bytecode::t_i32: Op<int32_t>(false); break;\
-        case bytecode::t_i64: Op<int64_t>(false); break;\
-        case bytecode::t_u8: Op<uint8_t>(false); break;\
-        case bytecode::t_u16: Op<uint16_t>(false); break;\
-        case bytecode::t_u32: Op<uint32_t>(false); break;\
-        case bytecode::t_u64: Op<uint64_t>(false); break;\
-        case bytecode::t_f32: Op<float>(false); break;\
-        case bytecode::t_f64: Op<double>(false); break;\
-        case bytecode::t_emconst: Op<void*>(false); break;\
-        case bytecode::t_ref: Op<interop::Instance*>(true); break;\
-        case bytecode::t_hdl: Op<interop::InteriorPointer>(true); break;\
-        case bytecode::t_record: Op<interop::RecordOpaque>(false); break;\
-        default: throw std::invalid_argument("unexpedted type");\
+void Processor::invokeMethod(runtime::Method *method, interop::Instance *instance){
+    if(instance == nullptr) operand.pop((int)argumentDepth(method, operand));
+    if (nullPointerCheck(instance)) {
+        auto param_size = method->getParamMemorySize();
+        if(!stackCheck(param_size + method->getLocalMemorySize())) return;
+        auto memory = getFrame().borrow(param_size + method->getLocalMemorySize());
+        clearParameters(method, memory);
+        memset(memory + param_size, 0, method->getLocalMemorySize());
+        popArgsFromOperand(method, memory);
+        *((interop::Instance**)memory) = instance;
+        call_stack.push(method,memory,operand.getTop());
     }
+}
 
 bool Processor::arrayAccessCheck(interop::ArrayInstance *instance, int subscript){
     if(subscript < 0 || subscript >= instance->length){
@@ -269,609 +201,784 @@ bool Processor::optionalParameterCheck(CallEnv &env, uint16_t index){
     return true;
 }
 
+void Processor::raiseBudgetExceeded(){
+    auto ins = loader.getInteropAgent()->createInstance(loader.getEBGCBudgetExceededException(), {});
+    handleException(std::move(ins));
+    // 创建异常对象本身也可能超出预留，不再重复抛出
+    loader.getGC()->takeBudgetExceeded();
+}
+
+void Processor::enterNoGCRegion(int64_t budget){
+    if(budget < 0 || !loader.getGC()->enterNoGC(budget)){
+        raiseBudgetExceeded();
+        return;
+    }
+    nogc_regions.push_back(handlerDepth(call_stack.begin(), call_stack.end()));
+}
+
+void Processor::exitNoGCRegion(){
+    if(nogc_regions.empty()) return;
+    nogc_regions.pop_back();
+    loader.getGC()->exitNoGC();
+    allocationBudgetCheck();
+}
+
+void Processor::loadFieldAddress(const threaded::Instruction &inst, uint8_t hint){
+    auto fld = inst.a.field;
+    LOG_INST("ldflda " << inst.b.variable->qualifiedName())
+    if(hint==bytecode::hint_instance){ // ins
+        auto ins = operand.pop<interop::Instance*>();
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(ins,fld.offset));
+    }
+    else if(hint==bytecode::hint_handle){ // hld
+        auto itp = operand.pop<interop::InteriorPointer>();
+        auto ptr = itp.ptr + fld.offset;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(ptr));
+    }
+    else if(hint==bytecode::hint_record){ // record
+        throw "";
+    }
+}
+
+size_t Processor::handlerDepth(CallEnv *begin, CallEnv *end){
+    size_t depth = 0;
+    for(auto env = begin; env != end; env++){
+        auto code = env->getHostedFunction()->getCode();
+        if(env->pc == nullptr || env->pc == code->begin()) continue;
+        depth += code->handlerDepth(env->pc - 1);
+    }
+    return depth;
+}
+
+// 异常的调用栈中的一行
+static unicode::string traceLine(runtime::HostedFunction *hosted, uint32_t line, bool last){
+    unicode::string text = "    In function '"_utf32;
+    if (auto ctor = dynamic_cast<runtime::Ctor*>(hosted))
+        text += ctor->getClass()->qualifiedName() + ".constructor"_utf32;
+    else
+        text += hosted->qualifiedName();
+    return text + "' line "_utf32 + unicode::to_string(line) + (last ? ".\n"_utf32 : ",\n"_utf32);
+}
+
+void Processor::captureTrace(interop::ProtectedCell &cell){
+    if(trace_frames_array == nullptr){
+        trace_frames_array = loader.getSpecilizedArrayPool()->query(loader.getGlobal()->find("Long"_utf32));
+    }
+    auto frames = loader.getInteropAgent()->createUnprotectedArray(trace_frames_array, call_stack.size() * 2);
+    auto data = (int64_t*)((uint8_t*)frames + sizeof(interop::ArrayInstance));
+    for(auto &env : call_stack){
+        *data++ = env.getHostedFunction()->getFunctionIndex();
+        *data++ = env.getLine();
+    }
+    auto exception = cell.get<interop::ExceptionInstance*>();
+    exception->trace_frames = frames;
+    exception->trace = nullptr;
+    loader.getGC()->writeBarrier(&exception->trace_frames);
+}
+
+void Processor::fillExceptionTrace(interop::ExceptionInstance *exception){
+    auto cell = loader.getGC()->makeProtectedCell((interop::Instance*)exception);
+    if(exception->name == nullptr){
+        auto name = loader.getInteropAgent()->createUnprotectedString(exception->base.getClass()->name);
+        cell.get<interop::ExceptionInstance*>()->name = name;
+        loader.getGC()->writeBarrier(&cell.get<interop::ExceptionInstance*>()->name);
+    }
+    auto frames = cell.get<interop::ExceptionInstance*>()->trace_frames;
+    if(cell.get<interop::ExceptionInstance*>()->trace == nullptr && frames != nullptr){
+        unicode::string trace;
+        // TraceFrames可能已被EB代码改写，跳过不是函数序号的项
+        auto data = (int64_t*)((uint8_t*)frames + sizeof(interop::ArrayInstance));
+        for(int32_t i = 0; i + 1 < frames->length; i += 2){
+            if(data[i] <= 0 || data[i] >= (int64_t)runtime::function_table.size()) continue;
+            trace += traceLine(runtime::function_table[data[i]], (uint32_t)data[i + 1], i + 3 >= frames->length);
+        }
+        auto str = loader.getInteropAgent()->createUnprotectedString(trace);
+        cell.get<interop::ExceptionInstance*>()->trace = str;
+        loader.getGC()->writeBarrier(&cell.get<interop::ExceptionInstance*>()->trace);
+    }
+}
+
 void Processor::handleException(interop::ProtectedCell cell){
-    auto handler = getExceptionHandler().search(cell.get<interop::ExceptionInstance*>()->base.klass);
-
-    unicode::string trace;
-    int i = 0;
-    for (auto iter = getCallStack().cbegin(); iter != getCallStack().cend(); iter++) {
-        i++;
-        trace += "    In function '"_utf32;
-        if (auto ctor = dynamic_cast<runtime::Ctor*>(iter->getHostedFunction()))
-            trace += ctor->getClass()->qualifiedName() + ".constructor"_utf32;
-        else
-            trace += iter->getHostedFunction()->qualifiedName();
-        
-        trace += "' line "_utf32 + unicode::to_string(iter->line)
-            + (i != getCallStack().size() ? ",\n"_utf32 : ".\n"_utf32);
-    }
-
-    if(handler.has_value()){
-        while(&getCallStack().back() != handler.value().stack_frame){
-            getCallStack().pop_back();
+    auto exception_class = cell.get<interop::ExceptionInstance*>()->base.getClass();
+
+    // 从最内层的栈帧开始，在各栈帧正在执行的指令所在的try块中查找能捕获异常的一项
+    CallEnv *frame = nullptr;
+    const threaded::ExceptionRange *handler = nullptr;
+    size_t outer = 0;
+    for(auto iter = call_stack.rbegin(); iter != call_stack.rend(); iter++){
+        auto code = iter->getHostedFunction()->getCode();
+        if(iter->pc == nullptr || iter->pc == code->begin()) continue;
+        handler = code->findHandler(iter->pc - 1, exception_class, outer);
+        if(handler != nullptr){
+            frame = &*iter;
+            break;
         }
-        getCallStack().back().ip = handler.value().entry;
-        cell.get<interop::ExceptionInstance*>()->name = loader.getInteropAgent()->createString(cell.get<interop::ExceptionInstance*>()->base.klass->name)
-                                                                                    .get<interop::StringInstance*>();
-        cell.get<interop::ExceptionInstance*>()->trace = loader.getInteropAgent()->createString(trace).get<interop::StringInstance*>();
+    }
+
+    if(handler != nullptr){
+        // 先分配TraceFrames再展开栈帧。展开后pc指向handler入口，此时发生回收无法按stack map枚举操作栈
+        captureTrace(cell);
 
+        auto depth = handlerDepth(call_stack.begin(), frame) + outer;
+        while(&call_stack.back() != frame){
+            popCallEnv();
+        }
+        while(!nogc_regions.empty() && nogc_regions.back() > depth){
+            nogc_regions.pop_back();
+            loader.getGC()->exitNoGC();
+        }
+        frame->pc = handler->entry;
+        getOperand().restore(frame->getOperandBase() + handler->height);
         getOperand().push(cell.get<interop::ExceptionInstance*>());
-        OpAddRoot<interop::Instance*>();
     }
     else{
-        std::cout<<"Unexpected "<<cell.get<interop::ExceptionInstance*>()->base.klass->name<<": "
+        unicode::string trace;
+        for(auto &env : call_stack){
+            trace += traceLine(env.getHostedFunction(), env.getLine(), &env == &call_stack.back());
+        }
+        std::cout<<"Unexpected "<<exception_class->name<<": "
                     <<loader.getInteropAgent()->fetchStringFromInstance(cell.get<interop::ExceptionInstance*>()->message)<<"\n";
         std::cout<<trace<<"Stop."<<std::endl;
         fata_error_occur = true;
     }  
 }
 
+void Processor::enumerateRoots(std::vector<Reference> &roots){
+    for(auto iter = call_stack.begin(); iter != call_stack.end(); iter++){
+        auto &env = *iter;
+        auto hosted = env.getHostedFunction();
+        auto memory = env.getMemory();
+        for(auto offset : hosted->getStackFrameRefOffsets()){
+            roots.push_back(Reference::fromRefPtr((interop::Instance**)(memory + offset)));
+        }
+        for(auto offset : hosted->getStackFrameInteriorPointerOffsets()){
+            roots.push_back(Reference::fromInterior((interop::InteriorPointer*)(memory + offset)));
+        }
+
+        // 尚未开始执行的栈帧在操作栈上没有内容
+        if(env.pc == nullptr || env.pc == hosted->getCode()->begin()) continue;
+
+        // 栈帧在操作栈上的部分到下一个栈帧的起点为止，最顶层的栈帧到栈顶为止。
+        // 正在执行(或调用中)的指令已弹出的操作数不在其中，因此只取stack map中完全位于这部分之内的槽位
+        auto next = iter + 1;
+        auto base = env.getOperandBase();
+        uint32_t height = (next == call_stack.end() ? operand.getTop() : next->getOperandBase()) - base;
+        // 链接时已为每条可达的指令生成stack map
+        auto &map = hosted->getCode()->getStackMap(env.pc - 1);
+        for(auto offset : map.refs){
+            if(offset + sizeof(interop::Instance*) <= height)
+                roots.push_back(Reference::fromRefPtr((interop::Instance**)(base + offset)));
+        }
+        for(auto offset : map.interiors){
+            if(offset + sizeof(interop::InteriorPointer) <= height)
+                roots.push_back(Reference::fromInterior((interop::InteriorPointer*)(base + offset)));
+        }
+    }
+}
+
+bool Processor::prepare(CallEnv &env, const void *const *handler_table){
+    auto hosted = env.getHostedFunction();
+    auto code = hosted->getCode();
+    if(code == nullptr){
+        std::string error;
+        try{
+            code = threaded::translate(hosted, loader);
+        }
+        catch(std::exception &e){
+            error = e.what();
+        }
+        catch(const char *msg){
+            error = msg;
+        }
+        if(code == nullptr){
+            auto name = hosted->qualifiedName();
+            popCallEnv();
+            raiseInternalError("cannot link "_utf32 + name + ": "_utf32 + unicode::fromUTF8(error));
+            return false;
+        }
+        hosted->setCode(code);
+    }
+    if(!raising_overflow && !operand.hasRoom(code->getMaxHeight() + operand_reserve)){
+        popCallEnv();
+        raiseStackOverflow();
+        return false;
+    }
+    if(handler_table != nullptr && !code->isBound()){
+        code->bind(handler_table);
+    }
+    env.pc = code->begin();
+    return true;
+}
+
+void Processor::raiseStackOverflow(){
+    raising_overflow = true;
+    auto ins = loader.getInteropAgent()->createInstance(loader.getEBStackOverflowException(), {});
+    raising_overflow = false;
+    handleException(std::move(ins));
+}
+
+void Processor::raiseInternalError(const unicode::string &message){
+    auto msg = loader.getInteropAgent()->createString(message);
+    auto ins = loader.getInteropAgent()->createInstance(loader.getEBEvmInternalException(), {
+        interop::Value::fromRef(std::move(msg))
+    });
+    handleException(std::move(ins));
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define EVM_COMPUTED_GOTO
+#endif
+
+#ifdef EVM_COMPUTED_GOTO
+    #define TARGET(op) op_##op:
+    #define DISPATCH() goto *env->pc->handler
+#else
+    #define TARGET(op) case threaded::Op::op:
+    #define DISPATCH() goto dispatch
+#endif
+
+// 执行可能切换栈帧的指令(调用、返回、异常)之后重新取得当前栈帧
+#define RELOAD() \
+    if(fata_error_occur) return;\
+    env = &call_stack.back();\
+    if(env->pc == nullptr && !prepare(*env, handler_table)){\
+        if(fata_error_occur) return;\
+        env = &call_stack.back();\
+    }\
+    DISPATCH()
+
 void Processor::execute(runtime::Method *static_method){
+#ifdef EVM_COMPUTED_GOTO
+    static const void *const handler_table[] = {
+        #define EVM_HANDLER_ADDRESS(op) &&op_##op,
+        #define EVM_QUICKENED_HANDLER_ADDRESS(op, Handler, suffix, T) &&op_##op##_##suffix,
+        #define EVM_CONVERT_HANDLER_ADDRESS(src, S, dst, D) &&op_convert_##src##_##dst,
+        EVM_THREADED_OPS(EVM_HANDLER_ADDRESS)
+        EVM_QUICKENED_OPS(EVM_QUICKENED_HANDLER_ADDRESS)
+        EVM_QUICKENED_CHECKED_OPS(EVM_QUICKENED_HANDLER_ADDRESS)
+        EVM_CONVERT_OPS(EVM_CONVERT_HANDLER_ADDRESS)
+        #undef EVM_HANDLER_ADDRESS
+        #undef EVM_QUICKENED_HANDLER_ADDRESS
+        #undef EVM_CONVERT_HANDLER_ADDRESS
+    };
+#else
+    const void *const *handler_table = nullptr;
+#endif
+
     if(static_method!=nullptr){
         invokeStaticMethod(static_method);
     }
+    if(fata_error_occur) return;
 
     auto top_frame = &call_stack.back();
-    bool exit = false;
-
-    while (!exit && !fata_error_occur) {
-        //getLoader().getGC()->minorGC();
-
-        auto offset = call_stack.back().ip - call_stack.back().getHostedFunction()->getBlock();
-        call_stack.back().line = call_stack.back().getHostedFunction()->getLineNumberTable()->determineLine(offset);//这个地方太慢了
-        
-        auto code = consume<uint8_t>();
-        switch (code) {
-            /*
-                code x = "case bytecode::" ++ x ++ ":{\n\n\tbreak;\n}\n"
-                putStr $ foldl1 (++) (fmap (code . unpack) (Data.Text.splitOn (pack ",") (pack "bytecode1,bytecode2,..."))
-            */
-            case bytecode::ldsftn:{
-                auto token = consume<uint32_t>();
-                auto sftn = dynamic_cast<runtime::Method*>(call_stack.back().getHostedFunction()->getTable().query(token));
-                operand.push(sftn);
-                LOG_INST("ldsftn" << " " << sftn->qualifiedName())
-                break;
-            }
-            case bytecode::ldvftn:{
-                auto token = consume<uint32_t>();
-                auto vftn = dynamic_cast<runtime::VirtualMethod*>(call_stack.back().getHostedFunction()->getTable().query(token));
-                operand.push(vftn);
-                LOG_INST("ldvftn " << vftn->qualifiedName())
-                break;
-            }
-            case bytecode::ldftn:{
-                auto token = consume<uint32_t>();
-                auto ftn = dynamic_cast<runtime::Method*>(call_stack.back().getHostedFunction()->getTable().query(token));
-                operand.push(ftn);
-                LOG_INST("ldftn" << ftn->qualifiedName())
-                break;
-            }
-            case bytecode::ldctor:{
-                auto token = consume<uint32_t>();
-                auto sym = call_stack.back().getHostedFunction()->getTable().query(token);
-                auto ctor = dynamic_cast<runtime::Ctor*>(sym);
-                operand.push<runtime::Ctor*>(ctor);
-                LOG_INST("ldctor " << ctor->getClass()->qualifiedName() << ".Constructor")
-                break;
-            }
-            case bytecode::ldforeign:{
-                auto token = consume<uint32_t>();
-                auto ff = dynamic_cast<runtime::ForeignEntry*>(call_stack.back().getHostedFunction()->getTable().query(token));
-                operand.push(ff);
-                LOG_INST("ldforeign " << ff->qualifiedName())
-                break;
-            }
-            case bytecode::callmethod:{
-                auto ftn = dynamic_cast<runtime::Method*>(operand.pop<runtime::Symbol*>());
-                invokeMethod(ftn);
-                LOG_INST("callmethod" << ftn->qualifiedName())
-                break;
-            }
-            case bytecode::callvirtual:{
-                auto vftn = dynamic_cast<runtime::VirtualMethod*>(operand.pop<runtime::Symbol*>());
-                invokeVirtualMethod(vftn);
-                LOG_INST("callvirtual " << vftn->qualifiedName())
-                break;
-            }
-            case bytecode::callstatic:{
-                auto ftn = dynamic_cast<runtime::Method*>(operand.pop<runtime::Symbol*>());
-                invokeStaticMethod(ftn);
-                LOG_INST("callstatic " << ftn->qualifiedName())
-                break;
+    CallEnv *env = top_frame;
+    if(env->pc == nullptr && !prepare(*env, handler_table)){
+        if(fata_error_occur) return;
+        env = &call_stack.back();
+    }
+
+#ifdef EVM_COMPUTED_GOTO
+    DISPATCH();
+#else
+    dispatch:
+    switch (env->pc->op) {
+#endif
+
+    TARGET(ldsftn){
+        auto &inst = *env->pc++;
+        auto sftn = inst.a.method;
+        operand.push(sftn);
+        LOG_INST("ldsftn" << " " << sftn->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(ldvftn){
+        auto &inst = *env->pc++;
+        auto vftn = inst.a.virtual_method;
+        operand.push(vftn);
+        LOG_INST("ldvftn " << vftn->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(ldftn){
+        auto &inst = *env->pc++;
+        auto ftn = inst.a.method;
+        operand.push(ftn);
+        LOG_INST("ldftn" << ftn->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(ldctor){
+        auto &inst = *env->pc++;
+        auto ctor = inst.a.ctor;
+        operand.push<runtime::Ctor*>(ctor);
+        LOG_INST("ldctor " << ctor->getClass()->qualifiedName() << ".Constructor")
+        DISPATCH();
+    }
+
+    TARGET(ldforeign){
+        auto &inst = *env->pc++;
+        auto ff = inst.a.foreign;
+        operand.push(ff);
+        LOG_INST("ldforeign " << ff->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(callmethod){
+        env->pc++;
+        auto ftn = operand.pop<runtime::Method*>();
+        invokeMethod(ftn);
+        LOG_INST("callmethod" << ftn->qualifiedName())
+        RELOAD();
+    }
+
+    TARGET(callvirtual){
+        auto &inst = *env->pc++;
+        auto vftn = operand.pop<runtime::VirtualMethod*>();
+        invokeVirtualMethod(vftn, inst.a.cache);
+        LOG_INST("callvirtual " << vftn->qualifiedName())
+        RELOAD();
+    }
+
+    TARGET(callstatic){
+        env->pc++;
+        auto ftn = operand.pop<runtime::Method*>();
+        invokeStaticMethod(ftn);
+        LOG_INST("callstatic " << ftn->qualifiedName())
+        RELOAD();
+    }
+
+    TARGET(newobj){
+        auto &inst = *env->pc++;
+        auto klass = inst.a.klass;
+        auto ins = loader.getGC()->allocate(klass);
+        operand.push<interop::Instance*>(ins);
+        LOG_INST("newobj " << klass->qualifiedName())
+        if(!allocationBudgetCheck()) { RELOAD(); }
+        DISPATCH();
+    }
+
+    TARGET(callctor){
+        env->pc++;
+        auto ctor = operand.pop<runtime::Ctor*>();
+        invokeCtor(ctor);
+        LOG_INST("callctor " << ctor->getClass()->qualifiedName())
+        RELOAD();
+    }
+
+    TARGET(callforeign){
+        env->pc++;
+        LOG_INST("callforeign ")
+        auto fe = getOperand().pop<runtime::ForeignEntry*>();
+        getLoader().getFFI()->call(fe, this);
+        RELOAD();
+    }
+
+    TARGET(callintrinsic){
+        auto &inst = *env->pc++;
+        auto &name = *inst.b.text;
+        auto intrinsic = (interop::Intrinsic)inst.a.u64;
+        LOG_INST("callintrinsic " << name);
+        if(intrinsic!=interop::Intrinsic::NotFound){
+            loader.getInteropAgent()->callIntrinsic(intrinsic, this);
+            allocationBudgetCheck();
+        }
+        else{
+            auto msg = loader.getInteropAgent()->createString("Intrinsic '"_utf32 + name + "' not found."_utf32);
+            auto ins = loader.getInteropAgent()->createInstance(loader.getEBEvmInternalException(), {
+                interop::Value::fromRef(std::move(msg))
+            });
+            handleException(std::move(ins));
+        }
+        RELOAD();
+    }
+
+    TARGET(ldarga){
+        env->pc++;
+        auto idx = operand.pop<uint16_t>();
+        auto hosted = call_stack.back().getHostedFunction();
+        if(hosted->getParameterByIndex(idx)->getKind() == runtime::ParameterKind::Optional){
+            optionalParameterCheck(call_stack.back(),idx);
+        }
+        auto offset = call_stack.back().getHostedFunction()->getParameterByIndex(idx)->getOffset();
+        auto address = call_stack.back().getMemory() + offset;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
+        LOG_INST("ldarga " << idx);
+        RELOAD();
+    }
+
+    TARGET(testopt){
+        env->pc++;
+        auto count = operand.pop<uint8_t>();
+        bool result = true;
+        while(count--){
+            auto idx = operand.pop<uint16_t>();
+            if(result==true){
+                auto optional = dynamic_cast<const runtime::OptionalParameter*>(call_stack.back().getHostedFunction()->getParameterByIndex(idx));
+                auto offset = optional->getFlagOffset();
+                auto base = call_stack.back().getMemory();
+                if(*(base + offset)==0)result = false;
             }
-            case bytecode::newobj:{
-                auto tok = consume<token_t>();
-                auto klass = dynamic_cast<runtime::Class*>(call_stack.back().getHostedFunction()->getTable().query(tok));
+        }
+        operand.push<uint8_t>(result);
+        LOG_INST("testopt")
+        DISPATCH();
+    }
+
+    TARGET(ldargai){
+        auto &inst = *env->pc++;
+        if(inst.a.slot.optional){
+            optionalParameterCheck(call_stack.back(),inst.a.slot.index);
+        }
+        auto address = env->getMemory() + inst.a.slot.offset;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
+        LOG_INST("ldargai " << inst.a.slot.index);
+        RELOAD();
+    }
+
+    TARGET(ldloca){
+        env->pc++;
+        auto idx = operand.pop<uint16_t>();
+        auto offset = call_stack.back().getHostedFunction()->getLocalOffset(idx);
+        auto address = call_stack.back().getMemory() + offset;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
+        LOG_INST("ldloca " << idx)
+        DISPATCH();
+    }
+
+    TARGET(ldlocai){
+        auto &inst = *env->pc++;
+        auto address = env->getMemory() + inst.a.slot.offset;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
+        LOG_INST("ldlocai " << inst.a.slot.index)
+        DISPATCH();
+    }
+
+    TARGET(ldflda){
+        auto &inst = *env->pc++;
+        loadFieldAddress(inst, operand.pop<uint8_t>());
+        DISPATCH();
+    }
+
+    TARGET(ldfldah){
+        auto &inst = *env->pc++;
+        loadFieldAddress(inst, inst.hint);
+        DISPATCH();
+    }
+
+    TARGET(ldsflda){
+        auto &inst = *env->pc++;
+        operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(inst.a.address));
+        LOG_INST("ldsflda " << inst.b.variable->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(packopt){
+        auto &inst = *env->pc++;
+        auto tok = inst.a.token;
+        operand.push<token_t>(tok);
+        LOG_INST("packopt " << inst.b.symbol->qualifiedName())
+        DISPATCH();
+    }
+
+    TARGET(ldelema){
+        auto &inst = *env->pc++;
+        LOG_INST("ldelema")
+        auto idx = operand.pop<int32_t>();
+        auto ins = operand.pop<interop::ArrayInstance*>();
+        if (nullPointerCheck((interop::Instance*)ins) & arrayAccessCheck(ins, idx)) {
+            auto base_offset = sizeof(interop::ArrayInstance);
+            uint32_t offset = base_offset + idx * inst.a.size;
+            operand.push<interop::InteriorPointer>(interop::makeInteriorPointer((interop::Instance*)ins,offset));
+        }
+        RELOAD();
+    }
+
+    TARGET(newarray){
+        auto &inst = *env->pc++;
+        LOG_INST("newarray")
+        auto array_length = operand.pop<int32_t>();
+        auto ins = loader.getInteropAgent()->createUnprotectedArray(inst.a.array, array_length);
+        operand.push<interop::ArrayInstance*>(ins);
+        if(!allocationBudgetCheck()) { RELOAD(); }
+        DISPATCH();
+    }
+
+    TARGET(arraylength){
+        env->pc++;
+        //deprecated
+        LOG_INST("arraylength")
+        auto ref = operand.pop<uint8_t*>();
+        int32_t length = *((int32_t*)(ref - sizeof(int32_t)));
+        operand.push<int32_t>(length);
+        DISPATCH();
+    }
+
+    TARGET(jif){
+        auto &inst = *env->pc++;
+        auto cond = operand.pop<uint8_t>();
+        LOG_INST("jif " << inst.a.target->offset)
+        if(cond) env->pc = inst.a.target;
+        DISPATCH();
+    }
+
+    TARGET(br){
+        auto &inst = *env->pc++;
+        LOG_INST("br " << inst.a.target->offset)
+        env->pc = inst.a.target;
+        DISPATCH();
+    }
+
+    TARGET(ret){
+        env->pc++;
+        LOG_INST("ret")
+        bool exit = env == top_frame;
+        popCallEnv();
+        if(exit) return;
+        RELOAD();
+    }
+
+    TARGET(nop){
+        env->pc++;
+        DISPATCH();
+    }
+
+    TARGET(ldnothing){
+        env->pc++;
+        LOG_INST("ldnothing")
+        operand.push((interop::Instance*)nullptr);
+        DISPATCH();
+    }
+
+    TARGET(castClass){
+        auto &inst = *env->pc++;
+        LOG_INST("castClass")
+        auto ins = (interop::Instance*)operand.pop<uint8_t*>();
+        auto target_class = inst.b.klass;
+        if(isInstanceOf(ins,target_class)){
+            operand.push<interop::Instance*>(ins);
+        }
+        else{
+            auto source_class = inst.a.klass;
+            auto src_str = loader.getInteropAgent()->createString(source_class->name);
+            auto dst_str = loader.getInteropAgent()->createString(target_class->name);
+            auto ins = loader.getInteropAgent()->createInstance(loader.getEBConverstionException(),{
+                                                                        interop::Value::fromRef(std::move(src_str)),
+                                                                        interop::Value::fromRef(std::move(dst_str))});
+            handleException(std::move(ins));
+        }
+        RELOAD();
+    }
+
+    TARGET(instanceof){
+        auto &inst = *env->pc++;
+        LOG_INST("instanceof")
+        auto ins = operand.pop<interop::Instance*>();
+        auto klass = inst.a.klass;
+        operand.push<uint8_t>(isInstanceOf(ins,klass));
+        DISPATCH();
+    }
+
+    TARGET(throw_){
+        env->pc++;
+        LOG_INST("throw")
+        auto ins = operand.pop<interop::Instance*>();
+        handleException(getLoader().getGC()->makeProtectedCell(ins));
+        RELOAD();
+    }
+
+    // try块由异常表描述，进出try块时不需要做任何事
+    TARGET(enter){
+        env->pc++;
+        LOG_INST("enter")
+        DISPATCH();
+    }
+
+    TARGET(leave){
+        env->pc++;
+        LOG_INST("leave")
+        DISPATCH();
+    }
+
+    TARGET(and_){
+        env->pc++;
+        LOG_INST("and")
+        auto rhs = operand.pop<uint8_t>();
+        auto lhs = operand.pop<uint8_t>();
+        operand.push<uint8_t>(lhs & rhs);
+        DISPATCH();
+    }
+
+    TARGET(or_){
+        env->pc++;
+        LOG_INST("or")
+        auto rhs = operand.pop<uint8_t>();
+        auto lhs = operand.pop<uint8_t>();
+        operand.push<uint8_t>(lhs | rhs);
+        DISPATCH();
+    }
+
+    TARGET(xor_){
+        env->pc++;
+        LOG_INST("xor")
+        auto rhs = operand.pop<uint8_t>();
+        auto lhs = operand.pop<uint8_t>();
+        operand.push<uint8_t>(lhs xor rhs);
+        DISPATCH();
+    }
+
+    TARGET(not_){
+        env->pc++;
+        LOG_INST("not")
+        auto rhs = operand.pop<uint8_t>();
+        operand.push(!rhs);
+        DISPATCH();
+    }
+
+    TARGET(ldstr){
+        auto &inst = *env->pc++;
+        auto &utf8str = *inst.a.text;
+        auto ins = loader.getInteropAgent()->createUnprotectedString(utf8str);
+        operand.push(ins);
+        LOG_INST("ldstr " << utf8str)
+        DISPATCH();
+    }
+
+    TARGET(ldoptinfo){
+        auto &inst = *env->pc++;
+        LOG_INST("ldoptinfo")
+        auto option = inst.a.option;
+        operand.push(option);
+        DISPATCH();
+    }
+
+    TARGET(ldenumc){
+        auto &inst = *env->pc++;
+        LOG_INST("ldenumc")
+        auto constant = inst.a.constant;
+        operand.push<runtime::EnumConstant*>(constant);
+        DISPATCH();
+    }
+
+    TARGET(wrapctor){
+        env->pc++;
+        auto ctor = operand.pop<runtime::Ctor*>();
+        interop::Delegate dlg;
+        dlg.kind = interop::DelegateKind::Ctor;
+        dlg.function = ctor;
+        operand.push<interop::Delegate>(dlg);
+        DISPATCH();
+    }
+
+    TARGET(wrapforeign){
+        env->pc++;
+        auto ff = operand.pop<runtime::ForeignEntry*>();
+        interop::Delegate dlg;
+        dlg.kind = interop::DelegateKind::Foreign;
+        dlg.function = ff;
+        operand.push<interop::Delegate>(dlg);
+        DISPATCH();
+    }
+
+    TARGET(wrapsftn){
+        env->pc++;
+        auto sftn = operand.pop<runtime::Method*>();
+        interop::Delegate dlg;
+        dlg.kind = interop::DelegateKind::SFtn;
+        dlg.function = sftn;
+        operand.push<interop::Delegate>(dlg);
+        DISPATCH();
+    }
+
+    TARGET(wrapftn){
+        env->pc++;
+        auto ins = operand.pop<interop::Instance*>();
+        auto ftn = operand.pop<runtime::Method*>();
+        interop::Delegate dlg;
+        dlg.kind = interop::DelegateKind::Ftn;
+        dlg.function = ftn;
+        dlg.instance = ins;
+        operand.push<interop::Delegate>(dlg);
+        DISPATCH();
+    }
+
+    TARGET(wrapvftn){
+        env->pc++;
+        auto ins = operand.pop<interop::Instance*>();
+        auto vftn = operand.pop<runtime::VirtualMethod*>();
+        interop::Delegate dlg;
+        dlg.kind = interop::DelegateKind::VFtn;
+        dlg.function = vftn;
+        dlg.instance = ins;
+        operand.push<interop::Delegate>(dlg);
+        DISPATCH();
+    }
+
+    TARGET(calldlg){
+        auto &inst = *env->pc++;
+        auto dlg = operand.pop<interop::Delegate>();
+        switch(dlg.kind){
+            case interop::DelegateKind::Ctor:{
+                auto ctor = static_cast<runtime::Ctor*>(dlg.function);
+                auto klass = ctor->getClass();
                 auto ins = loader.getGC()->allocate(klass);
-                //设置ClassInstance.Klass
-                ins->klass = klass;
                 operand.push<interop::Instance*>(ins);
-                OpAddRoot<interop::Instance*>();
-                LOG_INST("newobj " << klass->qualifiedName())
+                if(allocationBudgetCheck()) invokeCtor(ctor);
                 break;
             }
-            case bytecode::callctor:{
-                auto ctor = operand.pop<runtime::Ctor*>();
-                invokeCtor(ctor);
-                LOG_INST("callctor " << ctor->getClass()->qualifiedName())
-                break;
-            }
-            case bytecode::callforeign:{
-                LOG_INST("callforeign ")
-                auto fe = getOperand().pop<runtime::ForeignEntry*>();
+            case interop::DelegateKind::Foreign:{
+                auto fe = static_cast<runtime::ForeignEntry*>(dlg.function);
                 getLoader().getFFI()->call(fe, this);
                 break;
             }
-            case bytecode::callintrinsic:{
-                auto tok = consume<token_t>();
-                auto name = dynamic_cast<TextToken*>(call_stack.back().getHostedFunction()->getTable().getToken(tok))->getText();
-                auto intrinsic = loader.getInteropAgent()->getInstrinsicByName(name);
-                LOG_INST("callintrinsic " << name);
-                if(intrinsic!=interop::Intrinsic::NotFound){
-                    loader.getInteropAgent()->callIntrinsic(intrinsic, this);
-                }
-                else{
-                    auto msg = loader.getInteropAgent()->createString("Intrinsic '"_utf32 + name + "' not found."_utf32);
-                    auto ins = loader.getInteropAgent()->createInstance(loader.getEBEvmInternalException(), {
-                        interop::Value::fromRef(std::move(msg))
-                    });
-                    handleException(std::move(ins));
-                }
-                break;
-            }
-            case bytecode::starg:{
-                ForEachTypeWithRefFlag(OpStarg)
-                break;
-            }
-            case bytecode::ldarg:{
-                ForEachTypeWithRefFlag(OpLdarg)
-                break;
-            }
-            case bytecode::ldarga:{
-                auto idx = operand.pop<uint16_t>();
-                auto hosted = call_stack.back().getHostedFunction();
-                if(hosted->getParameterByIndex(idx)->getKind() == runtime::ParameterKind::Optional){
-                    optionalParameterCheck(call_stack.back(),idx);
-                }
-                auto offset = call_stack.back().getHostedFunction()->getParameterByIndex(idx)->getOffset();
-                auto address = call_stack.back().getMemory() + offset;
-                operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
-                OpAddRoot<interop::InteriorPointer>();
-                LOG_INST("ldarga " << idx);
-                break;
-            }
-            case bytecode::stloc:{
-                ForEachTypeWithRefFlag(OpStloc);
-                break;
-            }
-            case bytecode::ldloc:{
-                ForEachTypeWithRefFlag(OpLdloc);
-                break;
-            }
-            case bytecode::testopt:{
-                auto count = operand.pop<uint8_t>();
-                bool result = true;
-                while(count--){
-                    auto idx = operand.pop<uint16_t>();
-                    if(result==true){
-                        auto optional = dynamic_cast<const runtime::OptionalParameter*>(call_stack.back().getHostedFunction()->getParameterByIndex(idx));
-                        auto offset = optional->getFlagOffset();
-                        auto base = call_stack.back().getMemory();
-                        if(*(base + offset)==0)result = false;
-                    }
-                }
-                operand.push<uint8_t>(result);
-                LOG_INST("testopt")
-                break;
-            }
-            case bytecode::ldloca:{
-                auto idx = operand.pop<uint16_t>();
-                auto offset = call_stack.back().getHostedFunction()->getLocalOffset(idx);
-                auto address = call_stack.back().getMemory() + offset;
-                operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(address));
-                OpAddRoot<interop::InteriorPointer>();
-                LOG_INST("ldloca " << idx)
-                break;
-            }
-            case bytecode::stfld:{
-                ForEachTypeWithRefFlag(OpStfld);
-                break;
-            }
-            case bytecode::ldfld:{
-                ForEachTypeWithRefFlag(OpLdfld);
-                break;
-            }
-            case bytecode::ldflda:{
-                auto tok = consume<token_t>();
-                uint8_t hint = operand.pop<uint8_t>();
-                auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-                LOG_INST("ldflda " << fld->qualifiedName())
-                if(hint==1){ // ins
-                    OpRemoveRoot<interop::Instance*>();
-                    auto ins = operand.pop<interop::Instance*>();
-                    auto offset = fld->getOffset();
-                    operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(ins,offset));
-                    OpAddRoot<interop::InteriorPointer>();              
-                }
-                else if(hint==2){ // hld
-                    OpRemoveRoot<interop::InteriorPointer>();
-                    auto itp = operand.pop<interop::InteriorPointer>();
-                    auto ptr = itp.ptr + fld->getOffset();
-                    operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(ptr));
-                    OpAddRoot<interop::InteriorPointer>();
-                }
-                else if(hint==3){ // record
-                    throw "";
-                }
-                break;
-            }
-            case bytecode::stsfld:{
-                ForEachTypeWithRefFlag(OpStsfld);
-                break;
-            }
-            case bytecode::ldsfld:{
-                ForEachTypeWithRefFlag(OpLdsfld);
-                break;
-            }
-            case bytecode::ldsflda:{
-                auto tok = consume<token_t>();
-                auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-                auto addr = fld->getStaticAddress();
-                operand.push<interop::InteriorPointer>(interop::makeInteriorPointer(addr));
-                OpAddRoot<interop::InteriorPointer>();
-                LOG_INST("ldsflda " << fld->qualifiedName())
-                break;
-            }
-            case bytecode::packopt:{
-                auto tok = consume<token_t>();
-                operand.push<token_t>(tok);
-                LOG_INST("packopt " << call_stack.back().getHostedFunction()->getTable().query(tok)->qualifiedName())
-                break;
-            }
-            case bytecode::stelem:{
-                ForEachTypeWithRefFlag(OpStelem);
-                break;
-            }
-            case bytecode::stelemr:{
-                ForEachTypeWithRefFlag(OpStelemr);
-                break;
-            }
-            case bytecode::ldelem:{
-                ForEachTypeWithRefFlag(OpLdelem);
-                break;
-            }
-            case bytecode::ldelema:{
-                LOG_INST("ldelema")
-                auto tok = consume<token_t>();
-                auto idx = operand.pop<int32_t>();
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = operand.pop<interop::ArrayInstance*>();
-                if (nullPointerCheck((interop::Instance*)ins) & arrayAccessCheck(ins, idx)) {
-                    auto base_offset = sizeof(interop::ArrayInstance);
-                    auto element_sym = call_stack.back().getHostedFunction()->getTable().query(tok);
-                    uint32_t offset = base_offset + idx * runtime::getRuntimeSize(element_sym);
-                    operand.push<interop::InteriorPointer>(interop::makeInteriorPointer((interop::Instance*)ins,offset));
-                    OpAddRoot<interop::InteriorPointer>();
-                }
-                break;
-            }
-            case bytecode::newarray:{
-                LOG_INST("newarray")
-                auto tok = consume<token_t>();
-                auto array_length = operand.pop<int32_t>();
-                auto element_sym = call_stack.back().getHostedFunction()->getTable().query(tok);
-                auto ins = loader.getInteropAgent()->createUnprotectedArray(loader.getSpecilizedArrayPool()->query(element_sym), array_length);
-                operand.push<interop::ArrayInstance*>(ins);
-                OpAddRoot<interop::Instance*>();
-                break;
-            }
-            case bytecode::arraylength:{
-                //deprecated
-                DEBUG_INSTRUCTION(arraylength)
-                auto ref = operand.pop<uint8_t*>();
-                int32_t length = *((int32_t*)(ref - sizeof(int32_t)));
-                operand.push<int32_t>(length);
-                break;
-            }
-            case bytecode::jif:{
-                auto offset = consume<uint32_t>();
-                auto cond = operand.pop<uint8_t>();
-                LOG_INST("jif " << offset)
-                if(cond) call_stack.back().ip = call_stack.back().getHostedFunction()->getBlock() + offset;
-                break;
-            }
-            case bytecode::br:{
-                auto offset = consume<uint32_t>();
-                LOG_INST("br " << offset)
-                call_stack.back().ip = call_stack.back().getHostedFunction()->getBlock() + offset;
-                break;
-            }
-            case bytecode::ret:{
-                LOG_INST("ret")
-                if(&call_stack.back() == top_frame) exit = true;
-                for(auto live_id : call_stack.back().getLiveSet()){
-                    loader.getGC()->removeRoot(live_id);
-                }
-                call_stack.pop_back();
-                break;
-            }
-            case bytecode::nop:{
-                break;
-            }
-            case bytecode::dup:{
-                ForEachTypeWithRefFlag(OpDup);
-                break;
-            }
-            case bytecode::push:{
-                ForEachTypeWithRefFlag(OpPush);
-                break;
-            }
-            case bytecode::store:{
-                ForEachTypeWithRefFlag(OpStore);
-                break;
-            }
-            case bytecode::load:{
-                ForEachTypeWithRefFlag(OpLoad);
-                break;
-            }
-            case bytecode::ldnothing:{
-                LOG_INST("ldnothing")
-                operand.push((interop::Instance*)nullptr);
-                OpAddRoot<interop::Instance*>();
-                break;
-            }
-            case bytecode::convert:{
-                ForEachArithmeticType(OpConvert);
-                break;
-            }
-            case bytecode::castClass:{
-                LOG_INST("castClass")
-                auto src_tok = consume<token_t>();
-                auto dst_tok = consume<token_t>();
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = (interop::Instance*)operand.pop<uint8_t*>();
-                auto target_class = (runtime::Class*)call_stack.back().getHostedFunction()->getTable().query(dst_tok);
-                if(isInstanceOf(ins,target_class)){
-                    operand.push<interop::Instance*>(ins);
-                    OpAddRoot<interop::Instance*>();
-                }
-                else{
-                    auto source_class = (runtime::Class*)call_stack.back().getHostedFunction()->getTable().query(src_tok);
-                    auto src_str = loader.getInteropAgent()->createString(source_class->name);
-                    auto dst_str = loader.getInteropAgent()->createString(target_class->name);
-                    auto ins = loader.getInteropAgent()->createInstance(loader.getEBConverstionException(),{
-                                                                                interop::Value::fromRef(std::move(src_str)),
-                                                                                interop::Value::fromRef(std::move(dst_str))});
-                    handleException(std::move(ins));
-                }
-                break;
-            }
-            case bytecode::instanceof:{
-                LOG_INST("instanceof")
-                auto tok = consume<token_t>();
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = operand.pop<interop::Instance*>();
-                auto klass = (runtime::Class*)call_stack.back().getHostedFunction()->getTable().query(tok);
-                operand.push<uint8_t>(isInstanceOf(ins,klass));
-                break;
-            }
-            case bytecode::throw_:{
-                LOG_INST("throw")
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = operand.pop<interop::Instance*>();
-                handleException(getLoader().getGC()->makeProtectedCell(ins));
-                break;
-            }
-            case bytecode::enter:{
-                LOG_INST("enter")
-                auto tok = consume<token_t>();
-                auto offset = consume<uint32_t>();
-                auto exception_class = (runtime::Class*)call_stack.back().getHostedFunction()->getTable().query(tok);
-                exception_handler.push(exception_class, &call_stack.back(), call_stack.back().getHostedFunction()->getBlock() + offset);
-                break;
-            }
-            case bytecode::leave:{
-                LOG_INST("leave")
-                auto tok = consume<token_t>();
-                auto exception_class = (runtime::Class*)call_stack.back().getHostedFunction()->getTable().query(tok);
-                exception_handler.pop();
-                break;
-            }
-            case bytecode::add:{
-                ForEachArithmeticType(OpAdd);
-                break;
-            }
-            case bytecode::sub:{
-                ForEachArithmeticType(OpSub);
-                break;
-            }
-            case bytecode::mul:{
-                DEBUG_INSTRUCTION(mul)
-                ForEachArithmeticType(OpMul);
-                break;
-            }
-            case bytecode::div:{
-                ForEachArithmeticType(OpDiv);
-                break;
-            }
-            case bytecode::and_:{
-                LOG_INST("and")
-                auto rhs = operand.pop<uint8_t>();
-                auto lhs = operand.pop<uint8_t>();
-                operand.push<uint8_t>(lhs & rhs);
-                break;
-            }
-            case bytecode::or_:{
-                LOG_INST("or")
-                auto rhs = operand.pop<uint8_t>();
-                auto lhs = operand.pop<uint8_t>();
-                operand.push<uint8_t>(lhs | rhs);
-                break;
-            }
-            case bytecode::xor_:{
-                LOG_INST("xor")
-                auto rhs = operand.pop<uint8_t>();
-                auto lhs = operand.pop<uint8_t>();
-                operand.push<uint8_t>(lhs xor rhs);
+            case interop::DelegateKind::Ftn:{
+                auto ftn = static_cast<runtime::Method*>(dlg.function);
+                invokeMethod(ftn, dlg.instance);
                 break;
             }
-            case bytecode::eq:{
-                ForEachTypeWithOrd(OpEQ);
+            case interop::DelegateKind::VFtn:{
+                auto vftn = static_cast<runtime::VirtualMethod*>(dlg.function);
+                invokeVirtualMethod(vftn, inst.a.cache, dlg.instance);
                 break;
             }
-            case bytecode::ne:{
-                ForEachTypeWithOrd(OpNE);
-                break;
-            }
-            case bytecode::lt:{
-                ForEachArithmeticType(OpLT);
-                break;
-            }
-            case bytecode::gt:{
-                ForEachArithmeticType(OpGT);
-                break;
-            }
-            case bytecode::le:{
-                ForEachArithmeticType(OpLE);
-                break;
-            }
-            case bytecode::ge:{
-                ForEachArithmeticType(OpGE);
-                break;
-            }
-            case bytecode::neg:{
-                ForEachArithmeticType(OpNeg);
-                break;
-            }
-            case bytecode::not_:{
-                LOG_INST("not")
-                auto rhs = operand.pop<uint8_t>();
-                operand.push(!rhs);
-                break;
-            }
-            case bytecode::ldstr:{
-                auto tok = consume<token_t>();
-                auto utf8str = dynamic_cast<TextToken*>(call_stack.back().getHostedFunction()->getTable().getToken(tok))->getText();
-                auto ins = loader.getInteropAgent()->createUnprotectedString(utf8str);
-                operand.push(ins);
-                OpAddRoot<interop::Instance*>();
-                LOG_INST("ldstr " << utf8str)
-                break;
-            }
-            case bytecode::ldoptinfo:{
-                LOG_INST("ldoptinfo")
-                auto tok = consume<token_t>();
-                auto option = dynamic_cast<runtime::OptionalParameter*>(call_stack.back().getHostedFunction()->getTable().query(tok));
-                operand.push(option);
-                break;
-            }
-            case bytecode::ldenumc:{
-                LOG_INST("ldenumc")
-                auto tok = consume<token_t>();
-                auto constant = dynamic_cast<runtime::EnumConstant*>(call_stack.back().getHostedFunction()->getTable().query(tok));
-                operand.push<runtime::EnumConstant*>(constant);
-                break;
-            }
-            case bytecode::mod:{
-                ForEachIntegralType(OpMod);
-                break;
-            }
-            case bytecode::wrapctor:{
-                auto ctor = operand.pop<runtime::Ctor*>();
-                interop::Delegate dlg;
-                dlg.kind = interop::DelegateKind::Ctor;
-                dlg.function = ctor;
-                operand.push<interop::Delegate>(dlg);
-                OpAddRoot<interop::Delegate>();
-                break;
-            }
-            case bytecode::wrapforeign:{
-                auto ff = operand.pop<runtime::ForeignEntry*>();
-                interop::Delegate dlg;
-                dlg.kind = interop::DelegateKind::Ctor;
-                dlg.function = ff;
-                operand.push<interop::Delegate>(dlg);
-                OpAddRoot<interop::Delegate>();
-                break;
-            }
-            case bytecode::wrapsftn:{
-                auto sftn = operand.pop<runtime::Method*>();
-                interop::Delegate dlg;
-                dlg.kind = interop::DelegateKind::Ctor;
-                dlg.function = sftn;
-                operand.push<interop::Delegate>(dlg);
-                OpAddRoot<interop::Delegate>();
-                break;
-            }
-            case bytecode::wrapftn:{
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = operand.pop<interop::Instance*>();
-                auto ftn = operand.pop<runtime::Method*>();
-                interop::Delegate dlg;
-                dlg.kind = interop::DelegateKind::Ctor;
-                dlg.function = ftn;
-                dlg.instance = ins;
-                operand.push<interop::Delegate>(dlg);
-                OpAddRoot<interop::Delegate>();
-                break;
-            }
-            case bytecode::wrapvftn:{
-                OpRemoveRoot<interop::Instance*>();
-                auto ins = operand.pop<interop::Instance*>();
-                auto vftn = operand.pop<runtime::VirtualMethod*>();
-                interop::Delegate dlg;
-                dlg.kind = interop::DelegateKind::Ctor;
-                dlg.function = vftn;
-                dlg.instance = ins;
-                operand.push<interop::Delegate>(dlg);
-                OpAddRoot<interop::Delegate>();
-                break;
-            }
-            case bytecode::calldlg:{
-                OpRemoveRoot<interop::Delegate>();
-                auto dlg = operand.pop<interop::Delegate>();
-                switch(dlg.kind){
-                    case interop::DelegateKind::Ctor:{
-                        auto ctor = dynamic_cast<runtime::Ctor*>(dlg.function);
-                        auto klass = dynamic_cast<runtime::Class*>(ctor->parent);
-                        auto ins = loader.getGC()->allocate(klass);
-                        //设置ClassInstance.Klass
-                        ins->klass = klass;
-                        operand.push<interop::Instance*>(ins);
-                        OpAddRoot<interop::Instance*>();
-                        invokeCtor(ctor);
-                        break;
-                    }
-                    case interop::DelegateKind::Foreign:{
-                        auto fe = dynamic_cast<runtime::ForeignEntry*>(dlg.function);
-                        getLoader().getFFI()->call(fe, this);
-                        break;
-                    }
-                    case interop::DelegateKind::Ftn:{
-                        auto ftn = dynamic_cast<runtime::Method*>(dlg.function);
-                        invokeMethod(ftn);
-                        break;
-                    }
-                    case interop::DelegateKind::VFtn:{
-                        auto vftn = dynamic_cast<runtime::VirtualMethod*>(dlg.function);
-                        invokeVirtualMethod(vftn);
-                        break;
-                    }
-                    case interop::DelegateKind::SFtn:{
-                        auto ftn = dynamic_cast<runtime::Method*>(dlg.function);
-                        invokeStaticMethod(ftn);
-                        break;
-                    }
-                }
-                break;
-            }
-            case bytecode::pop:{
-                ForEachType(OpPop);
+            case interop::DelegateKind::SFtn:{
+                auto ftn = static_cast<runtime::Method*>(dlg.function);
+                invokeStaticMethod(ftn);
                 break;
             }
-            default: throw std::invalid_argument("unexpected bytecode " + std::to_string(code));
         }
+        RELOAD();
     }
-}
 
+    #define EVM_QUICKENED_HANDLER(op, Handler, suffix, T) \
+        TARGET(op##_##suffix){ \
+            auto &inst = *env->pc++; \
+            Handler<T>(inst); \
+            DISPATCH(); \
+        }
+    EVM_QUICKENED_OPS(EVM_QUICKENED_HANDLER)
+    #undef EVM_QUICKENED_HANDLER
+
+    #define EVM_QUICKENED_CHECKED_HANDLER(op, Handler, suffix, T) \
+        TARGET(op##_##suffix){ \
+            auto &inst = *env->pc++; \
+            Handler<T>(inst); \
+            RELOAD(); \
+        }
+    EVM_QUICKENED_CHECKED_OPS(EVM_QUICKENED_CHECKED_HANDLER)
+    #undef EVM_QUICKENED_CHECKED_HANDLER
+
+    #define EVM_CONVERT_HANDLER(src, S, dst, D) \
+        TARGET(convert_##src##_##dst){ \
+            auto &inst = *env->pc++; \
+            OpConvert<S, D>(inst); \
+            DISPATCH(); \
+        }
+    EVM_CONVERT_OPS(EVM_CONVERT_HANDLER)
+    #undef EVM_CONVERT_HANDLER
+
+#ifndef EVM_COMPUTED_GOTO
+    default: throw std::invalid_argument("unexpected instruction " + std::to_string((int)env->pc->op));
+    }
+#endif
+}
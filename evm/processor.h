@@ -4,187 +4,171 @@
 #include <cstdint>
 #include <cstring>
 #include <initializer_list>
+#include <iterator>
 #include <map>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <vector>
-#include <stack>
 #include <optional>
 #include "interop.h"
 #include "loader.h"
 #include "bytecode.h"
 #include "runtime.h"
+#include "threaded.h"
 #include "unicode.h"
 #include "utils.h"
 
-//#define DEBUG
-
-#ifdef DEBUG
-    #define DEBUG_INSTRUCTION(x) LOG(IL,"       ! "#x<<std::endl);
-    #define DEBUG_FUNCTION_ENTER(x) LOG(Frame, " >> enter "<< x);
-    #define DEBUG_FUNCTION_EXIT(x) LOG(Frame, " >> exit " << x);
-    #define DEBUG_STACKFRAME_PUSH(x) LOG(Frame, " >> stackframe push "<<x<<std::endl);
-    #define DEBUG_STACKFRAME_POP(x) LOG(Frame, " >> stackframe pop "<<x<<std::endl);
-#else
-    #define DEBUG_INSTRUCTION(x) 
-    #define DEBUG_FUNCTION_ENTER(x)
-    #define DEBUG_FUNCTION_EXIT(x)
-    #define DEBUG_STACKFRAME_PUSH(x)
-    #define DEBUG_STACKFRAME_POP(x)
-#endif
-
 #define LOG_INST(x) LOG(Instruction,"(" << call_stack.back().getHostedFunction()->qualifiedName()\
-                                        <<",offset " << call_stack.back().ip - call_stack.back().getHostedFunction()->getBlock()\
-                                        << ",line " << call_stack.back().line << ") " << x <<"\n")
+                                        <<",offset " << call_stack.back().getOffset()\
+                                        << ",line " << call_stack.back().getLine() << ") " << x <<"\n")
 
 
 inline bool isSubtypeOf(runtime::Class* a, runtime::Class* b) {
-    while (a != nullptr) {
-        if (a == b) return true;
-        a = a->getBaseClass();
-    }
-    return false;
+    return a != nullptr && a->isSubclassOf(b);
 }
 
 inline bool isInstanceOf(interop::Instance* instance, runtime::Class* klass) {
-    runtime::Class* ins_class = instance->klass;
+    runtime::Class* ins_class = instance->getClass();
     return isSubtypeOf(ins_class, klass);
 }
 
-class CallEnv;
-
-class ExceptionHandler{
-    struct Handler{
-        CallEnv *stack_frame = nullptr;
-        uint8_t *entry = nullptr;
-        runtime::Class *exception_class = nullptr;
-    };
-    std::stack<Handler> handlers;  
+// 调用栈中的一条记录，只保存固定的几个字段，进出函数时不分配内存
+class CallEnv{
+    runtime::HostedFunction *hosted = nullptr;
+    uint8_t *memory = nullptr;
+    uint8_t *operand_base = nullptr;
 public:
 
-    inline std::optional<Handler> search(runtime::Class *exception_class){
-        while (handlers.size() > 0) {
-            Handler handler = handlers.top();
-            handlers.pop();
-            if (isSubtypeOf(exception_class, handler.exception_class)) {
-                return {handler};
-            }
-        }
-        return {};
-    }
+    // 下一条将要执行的指令。为nullptr时表示函数尚未开始执行，
+    // 由Processor::execute在进入栈帧时翻译字节码并设置
+    const threaded::Instruction *pc = nullptr;
+
+    // memory为栈帧在frame栈上的起点，返回时frame栈恢复到这里。
+    // operand_base为进入函数时(参数已经出栈)操作栈的位置，之上的部分属于该栈帧
+    inline CallEnv(runtime::HostedFunction *hosted, uint8_t *memory, uint8_t *operand_base)
+        : hosted(hosted), memory(memory), operand_base(operand_base){}
 
-    inline void push(runtime::Class *exception_class, CallEnv *stack_frame, uint8_t *entry){
-        Handler handler;
-        handler.exception_class = exception_class;
-        handler.stack_frame = stack_frame;
-        handler.entry = entry;
-        handlers.push(handler);
+    // 正在执行(或调用中)的指令对应的字节码偏移
+    inline uint32_t getOffset() const {
+        if(pc == nullptr || pc == hosted->getCode()->begin()) return 0;
+        return (pc - 1)->offset;
     }
 
-    inline void pop(){
-        handlers.pop();
+    inline uint32_t getLine() const {
+        return hosted->getLineNumberTable()->determineLine(getOffset());
     }
 
+    inline uint8_t *getMemory() const { return memory; }
+    inline uint8_t *getOperandBase() const { return operand_base; }
+    inline runtime::HostedFunction *getHostedFunction() const { return hosted; }
+
 };
 
-class CallEnv{
-    MemoryStack &frame;
-    runtime::HostedFunction *hosted = nullptr;
-    uint8_t *memory = nullptr;
-    std::list<uintptr_t> live_set;
+// 连续存放CallEnv的调用栈。容量在创建时分配，记录的地址在出栈前保持不变，
+// 因此异常处理器与execute可以直接保存指向记录的指针
+class CallStack{
+    CallEnv *records = nullptr,
+            *top = nullptr,
+            *limit = nullptr;
 public:
+    using reverse_iterator = std::reverse_iterator<CallEnv*>;
 
-    uint32_t line;
-
-    uint8_t *ip = nullptr;
-
-    inline CallEnv(runtime::HostedFunction *hosted, std::list<uintptr_t> live_set, uint8_t *memory, MemoryStack &frame)
-        : hosted(hosted), live_set(live_set), memory(memory), ip(hosted->getBlock()), frame(frame){
-
-        if(hosted->getLineNumberTable()->getNumberCount() > 0){
-            line = hosted->getLineNumberTable()->getLineNumber(0).line;
-        }
+    inline explicit CallStack(uint32_t capacity){
+        top = records = (CallEnv*)malloc(capacity * sizeof(CallEnv));
+        limit = records + capacity;
+    }
+    inline ~CallStack(){
+        free(records);
+        records = nullptr;
+    }
 
+    inline CallEnv &push(runtime::HostedFunction *hosted, uint8_t *memory, uint8_t *operand_base){
+        if(top == limit) throw std::runtime_error("call stack overflow");
         LOG(CallEnv,"enter "<<hosted->qualifiedName() << std::endl)
-        
+        return *new(top++) CallEnv(hosted, memory, operand_base);
     }
 
-    inline CallEnv(CallEnv &&x) : frame(x.frame),hosted(x.hosted),memory(x.memory),ip(x.ip){
-        x.hosted = nullptr;
+    inline void pop(){
+        top--;
+        LOG(CallEnv, "exit " << top->getHostedFunction()->qualifiedName() << std::endl)
     }
 
-    inline const std::list<uintptr_t> &getLiveSet(){ return live_set; }
+    inline bool hasRoom(size_t count) const { return (size_t)(limit - top) >= count; }
 
-    inline ~CallEnv(){
-        if(hosted!=nullptr){
-            frame.pop(hosted->getParamMemorySize() + hosted->getLocalMemorySize());
-            LOG(CallEnv, "exit " << hosted->qualifiedName() << std::endl)
-        }
-    }
-
-    inline uint8_t *getMemory() const { return memory; }
-    inline runtime::HostedFunction *getHostedFunction() const { return hosted; }
+    inline CallEnv &back(){ return *(top - 1); }
+    inline size_t size() const { return top - records; }
+    inline bool empty() const { return top == records; }
 
+    inline CallEnv *begin(){ return records; }
+    inline CallEnv *end(){ return top; }
+    inline reverse_iterator rbegin(){ return reverse_iterator(top); }
+    inline reverse_iterator rend(){ return reverse_iterator(records); }
 };
 
-class Processor{
+class Processor : public RootProvider{
     Loader &loader;
 
     MemoryStack operand,frame;
-    ExceptionHandler exception_handler;
-    std::list<CallEnv> call_stack;
+    CallStack call_stack;
     bool fata_error_occur = false;
 
+    // 每个未结束的不回收区域开始时所在的try块的层数(见handlerDepth)。捕获异常时结束在被展开的try中开始的区域
+    std::vector<size_t> nogc_regions;
+
+    // 异常的TraceFrames数组(Long[])的类型，第一次抛出异常时查询
+    runtime::SpecializedArray *trace_frames_array = nullptr;
+
+    // 调用栈上各栈帧当前所在的try块的层数之和
+    size_t handlerDepth(CallEnv *begin, CallEnv *end);
+
+    // 把调用栈记录到异常对象的TraceFrames中，Trace在EB代码读取时才由fillExceptionTrace生成
+    void captureTrace(interop::ProtectedCell &cell);
+
     bool arrayAccessCheck(interop::ArrayInstance *instance, int subscript);
     bool nullPointerCheck(interop::Instance *instance);
     bool optionalParameterCheck(CallEnv &env, uint16_t index);
 
-    template<class T>
-    T consume(){
-        auto r = read<T>(call_stack.back().ip);
-        call_stack.back().ip += sizeof(T);
-        return r;
+    // 不回收区域中的分配超出预留时抛出GCBudgetExceeded
+    void raiseBudgetExceeded();
+    inline bool allocationBudgetCheck(){
+        if(!loader.getGC()->takeBudgetExceeded()) [[likely]] return true;
+        raiseBudgetExceeded();
+        return false;
     }
 
-public:
-    template<class T>
-    void OpAddRoot() {}
-    template<>
-    void OpAddRoot<interop::Instance*>() {
-        loader.getGC()->addRoot(operand.ptrToPeek<interop::Instance*>());
-    }
-    template<>
-    void OpAddRoot<interop::InteriorPointer>() {
-        auto itp = operand.ptrToPeek<interop::InteriorPointer>();
-        loader.getGC()->addRoot((uintptr_t)itp, Reference::fromInterior(itp));
-    }
-    template<>
-    void OpAddRoot<interop::Delegate>(){
-        OpAddRoot<interop::Instance*>();
+    // 栈溢出时创建异常对象也要调用构造函数，各个栈的末尾为此保留一部分，只在raising_overflow时使用
+    static constexpr uint32_t frame_reserve = 64 << 10, operand_reserve = 16 << 10, call_reserve = 256;
+    bool raising_overflow = false;
+
+    // 进入栈帧前检查frame栈与调用栈放得下，否则抛出StackOverflowException
+    inline bool stackCheck(uint32_t frame_size){
+        if(raising_overflow) [[unlikely]] return true;
+        if(frame.hasRoom(frame_size + frame_reserve) && call_stack.hasRoom(call_reserve)) [[likely]] return true;
+        raiseStackOverflow();
+        return false;
     }
+    void raiseStackOverflow();
+
+    // 进入尚未开始执行的栈帧，必要时翻译函数的字节码并检查操作栈放得下。无法翻译时弹出该栈帧，
+    // 在调用者中抛出EvmInternalException(操作栈放不下时为StackOverflowException)并返回false
+    bool prepare(CallEnv &env, const void *const *handler_table);
+    void raiseInternalError(const unicode::string &message);
 
+    void enterVirtual(runtime::VirtualMethod *method, interop::Instance *instance,
+                      threaded::InlineCache *cache, uint32_t receiver_size);
 
+    // 写入引用后通知GC，使老年代中指向新生代的引用能被minorGC找到。静态字段在根集中，不需要
     template<class T>
-    void OpRemoveRoot() {}
-    template<>
-    void OpRemoveRoot<interop::Instance*>() {
-        loader.getGC()->removeRoot(operand.ptrToPeek<interop::Instance*>());
-    }
-    template<>
-    void OpRemoveRoot<interop::InteriorPointer>() {
-        auto itp = operand.ptrToPeek<interop::InteriorPointer>();
-        loader.getGC()->removeRoot((uintptr_t)itp);
-    }
-    template<>
-    void OpRemoveRoot<interop::Delegate>(){
-        OpRemoveRoot<interop::Instance*>();
+    inline void writeBarrier(void *slot){
+        if constexpr (std::is_same_v<T, interop::Instance*>){
+            loader.getGC()->writeBarrier(slot);
+        }
     }
-private:
 
     template<class T>
-    void OpStarg(bool ref){
+    void OpStarg([[maybe_unused]] const threaded::Instruction &inst){
         auto idx = operand.pop<uint16_t>();
-        OpRemoveRoot<T>();
         auto val = operand.pop<T>();
         auto hosted = call_stack.back().getHostedFunction();
         if(hosted->getParameterByIndex(idx)->getKind() == runtime::ParameterKind::Optional){
@@ -197,7 +181,7 @@ private:
     }
 
     template<class T>
-    void OpLdarg(bool ref){
+    void OpLdarg([[maybe_unused]] const threaded::Instruction &inst){
         auto idx = operand.pop<uint16_t>();
         auto hosted = call_stack.back().getHostedFunction();
         if(hosted->getParameterByIndex(idx)->getKind() == runtime::ParameterKind::Optional){
@@ -207,13 +191,11 @@ private:
         auto val = *((T*)(call_stack.back().getMemory() + offset));
         LOG_INST("ldarg." << genericTypeToString<T>() << " " << idx);
         operand.push<T>(val);
-        OpAddRoot<T>();
     }
 
     template<class T>
-    void OpStloc(bool ref){
+    void OpStloc([[maybe_unused]] const threaded::Instruction &inst){
         auto idx = operand.pop<uint16_t>();
-        OpRemoveRoot<T>();
         auto val = operand.pop<T>();
         auto offset = call_stack.back().getHostedFunction()->getLocalOffset(idx);
         auto base = call_stack.back().getMemory();
@@ -223,248 +205,245 @@ private:
     }
 
     template<class T>
-    void OpLdloc(bool ref){
+    void OpLdloc([[maybe_unused]] const threaded::Instruction &inst){
         auto idx = operand.pop<uint16_t>();
         LOG_INST("ldloc." << genericTypeToString<T>() << " " << idx)
         auto offset = call_stack.back().getHostedFunction()->getLocalOffset(idx);
         auto base = call_stack.back().getMemory();
         auto val = *((T*)(base + offset));
         operand.push<T>(val);
-        OpAddRoot<T>();
     }
 
     template<class T>
-    void OpStfld(bool ref){
-        auto tok = consume<token_t>();
-        uint8_t hint = operand.pop<uint8_t>();
-        auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-        LOG_INST("stfld." << genericTypeToString<T>() << " " << fld->qualifiedName())
-        if(hint==1){ // ins
-            OpRemoveRoot<interop::Instance*>();
+    void OpStargi(const threaded::Instruction &inst){
+        auto val = operand.pop<T>();
+        if(inst.a.slot.optional){
+            optionalParameterCheck(call_stack.back(),inst.a.slot.index);
+        }
+        *((T*)(call_stack.back().getMemory() + inst.a.slot.offset)) = val;
+        LOG_INST("stargi." << genericTypeToString<T>() << " " << inst.a.slot.index)
+    }
+
+    template<class T>
+    void OpLdargi(const threaded::Instruction &inst){
+        if(inst.a.slot.optional){
+            optionalParameterCheck(call_stack.back(),inst.a.slot.index);
+        }
+        auto val = *((T*)(call_stack.back().getMemory() + inst.a.slot.offset));
+        LOG_INST("ldargi." << genericTypeToString<T>() << " " << inst.a.slot.index);
+        operand.push<T>(val);
+    }
+
+    template<class T>
+    void OpStloci(const threaded::Instruction &inst){
+        auto val = operand.pop<T>();
+        *((T*)(call_stack.back().getMemory() + inst.a.slot.offset)) = val;
+        LOG_INST("stloci." << genericTypeToString<T>() << " " << inst.a.slot.index)
+    }
+
+    template<class T>
+    void OpLdloci(const threaded::Instruction &inst){
+        LOG_INST("ldloci." << genericTypeToString<T>() << " " << inst.a.slot.index)
+        auto val = *((T*)(call_stack.back().getMemory() + inst.a.slot.offset));
+        operand.push<T>(val);
+    }
+
+    // 字段按自身大小对齐(见layout.h)。除record外长度在编译时已知，memcpy被编译为一次对齐的读写；
+    // 操作栈一侧不保证对齐，因此不直接解引用
+    template<class T>
+    static inline void copyField(uint8_t *dst, const uint8_t *src, uint32_t length){
+        if constexpr (std::is_same_v<T, interop::RecordOpaque>){
+            memcpy(dst, src, length);
+        }
+        else{
+            memcpy(dst, src, sizeof(T));
+        }
+    }
+
+    // hint为字段的访问方式，旧的字节码由操作栈给出，revision 2由指令的立即数给出
+    template<class T>
+    void storeField(const threaded::Instruction &inst, uint8_t hint){
+        auto fld = inst.a.field;
+        LOG_INST("stfld." << genericTypeToString<T>() << " " << inst.b.variable->qualifiedName())
+        if(hint==bytecode::hint_instance){ // ins
             auto ins = operand.pop<interop::Instance*>();
-            OpRemoveRoot<T>();
-            auto val_ptr = operand.popAndGetTop(fld->getLength());
+            auto val_ptr = operand.popAndGetTop(fld.length);
             if (nullPointerCheck(ins)) {
-                auto dst = (uint8_t*)ins + fld->getOffset();
-                memcpy(dst,val_ptr,fld->getOffset());
+                auto dst = (uint8_t*)ins + fld.offset;
+                copyField<T>(dst,val_ptr,fld.length);
+                writeBarrier<T>(dst);
             }        
         }
-        else if(hint==2){// hld
-            OpRemoveRoot<interop::InteriorPointer>();
+        else if(hint==bytecode::hint_handle){// hld
             auto itp = operand.pop<interop::InteriorPointer>();
-            OpRemoveRoot<T>();
-            auto val_ptr = operand.popAndGetTop(fld->getLength());
-            auto dst = itp.ptr + fld->getOffset();
-            memcpy(dst,val_ptr,fld->getLength());
+            auto val_ptr = operand.popAndGetTop(fld.length);
+            auto dst = itp.ptr + fld.offset;
+            copyField<T>(dst,val_ptr,fld.length);
+            writeBarrier<T>(dst);
         }
-        else if(hint==3){// record
+        else if(hint==bytecode::hint_record){// record
             throw "";
         }
     }
 
     template<class T>
-    void OpLdfld(bool ref){
-        auto tok = consume<token_t>();
-        uint8_t hint = operand.pop<uint8_t>();
-        auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-        LOG_INST("ldfld." << genericTypeToString<T>() << " " << fld->qualifiedName())
-        if(hint==1){ // ins
-            OpRemoveRoot<interop::Instance*>();
+    void loadField(const threaded::Instruction &inst, uint8_t hint){
+        auto fld = inst.a.field;
+        LOG_INST("ldfld." << genericTypeToString<T>() << " " << inst.b.variable->qualifiedName())
+        if(hint==bytecode::hint_instance){ // ins
             auto ins = operand.pop<interop::Instance*>();
             if (nullPointerCheck(ins)) {
-                auto ptr = (uint8_t*)ins + fld->getOffset();
-                operand.pushFromPtr(ptr, fld->getLength());
-                OpAddRoot<T>();
+                auto ptr = (uint8_t*)ins + fld.offset;
+                copyField<T>(operand.borrow(fld.length), ptr, fld.length);
             }                    
         }
-        else if(hint==2){ // hld
-            OpRemoveRoot<interop::InteriorPointer>();
+        else if(hint==bytecode::hint_handle){ // hld
             auto itp = operand.pop<interop::InteriorPointer>();
-            auto ptr = itp.ptr + fld->getOffset();
-            operand.pushFromPtr(ptr, fld->getLength());
-            OpAddRoot<T>();
+            auto ptr = itp.ptr + fld.offset;
+            copyField<T>(operand.borrow(fld.length), ptr, fld.length);
         }
-        else if(hint==3){ // record
-            auto record = dynamic_cast<runtime::Record*>(fld->parent);
+        else if(hint==bytecode::hint_record){ // record
+            auto record = static_cast<runtime::Record*>(inst.b.variable->parent);
             auto ptr = operand.popAndGetTop(record->getMemorySize());
-            operand.moveFromPtr(ptr,fld->getLength());
+            operand.moveFromPtr(ptr,fld.length);
         }
     }
 
     template<class T>
-    void OpStsfld(bool ref){
-        auto tok = consume<token_t>();
-        OpRemoveRoot<T>();
+    void OpStfld(const threaded::Instruction &inst){
+        storeField<T>(inst, operand.pop<uint8_t>());
+    }
+
+    template<class T>
+    void OpStfldh(const threaded::Instruction &inst){
+        storeField<T>(inst, inst.hint);
+    }
+
+    template<class T>
+    void OpLdfld(const threaded::Instruction &inst){
+        loadField<T>(inst, operand.pop<uint8_t>());
+    }
+
+    template<class T>
+    void OpLdfldh(const threaded::Instruction &inst){
+        loadField<T>(inst, inst.hint);
+    }
+
+    void loadFieldAddress(const threaded::Instruction &inst, uint8_t hint);
+
+    template<class T>
+    void OpStsfld(const threaded::Instruction &inst){
         auto val = operand.pop<T>();
-        auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-        *((T*)fld->getStaticAddress()) = val;
-        LOG_INST("stsfld." << genericTypeToString<T>() << " " << fld->qualifiedName())
+        *((T*)inst.a.address) = val;
+        LOG_INST("stsfld." << genericTypeToString<T>() << " " << inst.b.variable->qualifiedName())
     }
 
     template<class T>
-    void OpLdsfld(bool ref){
-        auto tok = consume<token_t>();
-        auto fld = (runtime::Variable*)call_stack.back().getHostedFunction()->getTable().query(tok);
-        auto val = *((T*)fld->getStaticAddress());
+    void OpLdsfld(const threaded::Instruction &inst){
+        auto val = *((T*)inst.a.address);
         operand.push<T>(val);
-        OpAddRoot<T>();
-        LOG_INST("ldsfld." << genericTypeToString<T>() << " " << fld->qualifiedName())
+        LOG_INST("ldsfld." << genericTypeToString<T>() << " " << inst.b.variable->qualifiedName())
     }
 
     template<class T>
-    void OpStelem(bool ref){
-        auto tok = consume<token_t>();
+    void OpStelem(const threaded::Instruction &inst){
         auto idx = operand.pop<int32_t>();
-        OpRemoveRoot<interop::Instance*>();
         auto ins = operand.pop<interop::ArrayInstance*>();
-        OpRemoveRoot<T>();
         auto val = operand.pop<T>();
         if (nullPointerCheck((interop::Instance*)ins) & arrayAccessCheck(ins, idx)) {
             auto base = (uint8_t*)ins + sizeof(interop::ArrayInstance);
-            auto element_sym = call_stack.back().getHostedFunction()->getTable().query(tok);
-            *((T*)(base + idx * runtime::getRuntimeSize(element_sym))) = val;
-            LOG_INST("stelem." << genericTypeToString<T>() << " " << element_sym->qualifiedName())
+            *((T*)(base + idx * inst.a.size)) = val;
+            writeBarrier<T>(base + idx * inst.a.size);
+            LOG_INST("stelem." << genericTypeToString<T>() << " " << inst.b.symbol->qualifiedName())
         }
     }
 
     template<class T>
-    void OpStelemr(bool ref){
-        auto tok = consume<token_t>();
-        OpRemoveRoot<T>();
+    void OpStelemr(const threaded::Instruction &inst){
         auto val = operand.pop<T>();    
         auto idx = operand.pop<int32_t>();
-        OpRemoveRoot<interop::Instance*>();
         auto ins = operand.pop<interop::ArrayInstance*>();
         if (nullPointerCheck((interop::Instance*)ins) & arrayAccessCheck(ins, idx)) {
             auto base = (uint8_t*)ins + sizeof(interop::ArrayInstance);
-            auto element_sym = call_stack.back().getHostedFunction()->getTable().query(tok);
-            *((T*)(base + idx * runtime::getRuntimeSize(element_sym))) = val;
-            LOG_INST("stelemr." << genericTypeToString<T>() << " " << element_sym->qualifiedName())
+            *((T*)(base + idx * inst.a.size)) = val;
+            writeBarrier<T>(base + idx * inst.a.size);
+            LOG_INST("stelemr." << genericTypeToString<T>() << " " << inst.b.symbol->qualifiedName())
         }
     }
 
     template<class T>
-    void OpLdelem(bool ref){
-        auto tok = consume<token_t>();
+    void OpLdelem(const threaded::Instruction &inst){
         auto idx = operand.pop<int32_t>();
-        OpRemoveRoot<interop::Instance>();
         auto ins = operand.pop<interop::ArrayInstance*>();
         if (nullPointerCheck((interop::Instance*)ins) & arrayAccessCheck(ins, idx)) {
-            auto element_sym = call_stack.back().getHostedFunction()->getTable().query(tok);
             auto base = (uint8_t*)ins + sizeof(interop::ArrayInstance);
-            auto val = *((T*)(base + idx * runtime::getRuntimeSize(element_sym)));
+            auto val = *((T*)(base + idx * inst.a.size));
             operand.push<T>(val);
-            OpAddRoot<T>();
-            LOG_INST("ldelem." << genericTypeToString<T>() << " " << element_sym->qualifiedName())
+            LOG_INST("ldelem." << genericTypeToString<T>() << " " << inst.b.symbol->qualifiedName())
         }
     }
 
     template<class T>
-    void OpDup(bool ref){
+    void OpDup([[maybe_unused]] const threaded::Instruction &inst){
         auto val = operand.peek<T>();
         operand.push<T>(val);
-        OpAddRoot<T>();
         LOG_INST("dup." << genericTypeToString<T>())
     }
 
     template<class T>
-    void OpPush(bool ref){
-        auto val = consume<T>();
+    void OpPush(const threaded::Instruction &inst){
+        if constexpr (sizeof(T) > sizeof(threaded::Operand)){
+            throw std::invalid_argument("unsupported immediate type");
+        }
+        auto val = inst.a.as<T>();
         operand.push<T>(val);
-        OpAddRoot<T>();
         LOG_INST("push." << genericTypeToString<T>())
     }
 
     template<class T>
-    void OpPop(){
-        OpRemoveRoot<T>();
-        operand.pop<T>();
+    void OpPop([[maybe_unused]] const threaded::Instruction &inst){
+        if constexpr (std::is_same_v<T, interop::RecordOpaque>){
+            operand.pop((int)inst.a.size);
+        }
+        else{
+            operand.pop<T>();
+        }
         LOG_INST("pop." << genericTypeToString<T>());
     }
 
-    template<>
-    void OpPop<interop::RecordOpaque>(){
-        auto tok = consume<token_t>();
-        auto rcd = dynamic_cast<runtime::Record*>(call_stack.back().getHostedFunction()->getTable().query(tok));
-        operand.popAndGetTop(rcd->getMemorySize());
-    }
-
     template<class T>
-    void OpStore(bool ref){
-        OpRemoveRoot<interop::InteriorPointer>();
+    void OpStore([[maybe_unused]] const threaded::Instruction &inst){
         auto itp = operand.pop<interop::InteriorPointer>();
-        OpRemoveRoot<T>();
         auto val = operand.pop<T>();
         *((T*)itp.ptr) = val;
+        writeBarrier<T>(itp.ptr);
         LOG_INST("store." << genericTypeToString<T>())
     }
 
     template<class T>
-    void OpLoad(bool ref){
-        OpRemoveRoot<interop::InteriorPointer>();
+    void OpLoad([[maybe_unused]] const threaded::Instruction &inst){
         auto itp = operand.pop<interop::InteriorPointer>();
         auto val = *((T*)itp.ptr);
         operand.push<T>(val);
-        OpAddRoot<T>();
         LOG_INST("load." << genericTypeToString<T>())
     }
 
-    template<class T>
-    void OpConvert(){
-        auto val = operand.pop<T>();
-        switch (consume<uint8_t>()) {
-            case bytecode::t_i8: 
-                operand.push<int8_t>((uint8_t)val); 
-                LOG_INST("convert." << genericTypeToString<T>() << " int8_t")
-                break;
-            case bytecode::t_i16: 
-                operand.push<int16_t>((int16_t)val); 
-                LOG_INST("convert." << genericTypeToString<T>() << " int16_t")
-                break;
-            case bytecode::t_i32:
-                operand.push<int32_t>((int32_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " int32_t")
-                break;
-            case bytecode::t_i64:
-                operand.push<int64_t>((int64_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " int64_t")
-                break;
-            case bytecode::t_u8: 
-                operand.push<uint8_t>((uint8_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " uint8_t")
-                break;
-            case bytecode::t_u16:
-                operand.push<uint16_t>((uint16_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " uint16_t")
-                break;
-            case bytecode::t_u32:
-                operand.push<uint32_t>((uint32_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " uint32_t")
-                break;
-            case bytecode::t_u64: 
-                operand.push<uint64_t>((uint64_t)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " uint64_t")
-                break;
-            case bytecode::t_f32:
-                operand.push<float>((float)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " float")
-                break;
-            case bytecode::t_f64:
-                operand.push<double>((double)val);
-                LOG_INST("convert." << genericTypeToString<T>() << " double")
-                break;
-        }
+    template<class S, class D>
+    void OpConvert([[maybe_unused]] const threaded::Instruction &inst){
+        auto val = operand.pop<S>();
+        operand.push<D>((D)val);
+        LOG_INST("convert." << genericTypeToString<S>() << " " << genericTypeToString<D>())
     }
 
     template<class T>
-    void OpNeg(){
+    void OpNeg([[maybe_unused]] const threaded::Instruction &inst){
         auto val = operand.pop<T>();
         operand.push<T>(-val);   
         LOG_INST("neg." << genericTypeToString<T>())
     }
 
     template<class T>
-    void OpAdd(){
+    void OpAdd([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<T>(lhs + rhs);
@@ -472,7 +451,7 @@ private:
     }
 
     template<class T>
-    void OpSub(){
+    void OpSub([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<T>(lhs - rhs);
@@ -480,7 +459,7 @@ private:
     }
 
     template<class T>
-    void OpMul(){
+    void OpMul([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<T>(lhs * rhs);
@@ -488,7 +467,7 @@ private:
     }
 
     template<class T>
-    void OpDiv(){
+    void OpDiv([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         LOG_INST("div." << genericTypeToString<T>())
@@ -502,7 +481,7 @@ private:
     }
 
     template<class T>
-    void OpEQ(){
+    void OpEQ([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs == rhs);
@@ -510,7 +489,7 @@ private:
     }
 
     template<class T>
-    void OpNE(){
+    void OpNE([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs != rhs);
@@ -518,7 +497,7 @@ private:
     }
 
     template<class T>
-    void OpLT(){
+    void OpLT([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs < rhs);
@@ -526,7 +505,7 @@ private:
     }
 
     template<class T>
-    void OpGT(){
+    void OpGT([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs > rhs);
@@ -534,7 +513,7 @@ private:
     }
 
     template<class T>
-    void OpLE(){
+    void OpLE([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs <= rhs);
@@ -542,7 +521,7 @@ private:
     }
 
     template<class T>
-    void OpGE(){
+    void OpGE([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<uint8_t>(lhs >= rhs);
@@ -550,7 +529,7 @@ private:
     }
 
     template<class T>
-    void OpMod(){
+    void OpMod([[maybe_unused]] const threaded::Instruction &inst){
         auto rhs = operand.pop<T>();
         auto lhs = operand.pop<T>();
         operand.push<T>(lhs % rhs);
@@ -558,22 +537,47 @@ private:
     }
     
 public:
-    void popArgsFromOperand(runtime::HostedFunction *hosted, uint8_t *frame, std::list<Reference> &live_set);
+    void popArgsFromOperand(runtime::HostedFunction *hosted, uint8_t *frame);
     void invokeStaticMethod(runtime::Method *method);
-    void invokeVirtualMethod(runtime::VirtualMethod *method);
+    // cache为调用点的内联缓存
+    void invokeVirtualMethod(runtime::VirtualMethod *method, threaded::InlineCache *cache);
     void invokeCtor(runtime::Ctor *ctor);
     void invokeMethod(runtime::Method *method);
+    // calldlg调用实例方法，接收者保存在委托中而不在操作栈上
+    void invokeVirtualMethod(runtime::VirtualMethod *method, threaded::InlineCache *cache, interop::Instance *instance);
+    void invokeMethod(runtime::Method *method, interop::Instance *instance);
+
+    // 弹出最顶层的栈帧，frame栈恢复到该栈帧的起点
+    inline void popCallEnv(){
+        frame.restore(call_stack.back().getMemory());
+        call_stack.pop();
+    }
 
     inline Loader &getLoader(){ return loader; }
     inline MemoryStack &getOperand(){ return operand; }
     inline MemoryStack &getFrame(){ return frame; }
-    inline ExceptionHandler &getExceptionHandler(){ return exception_handler; }
-    inline std::list<CallEnv> &getCallStack(){ return call_stack; }
+    inline CallStack &getCallStack(){ return call_stack; }
 
     void handleException(interop::ProtectedCell exception_cell);
+
+    // 由TraceFrames生成异常的Name与Trace字符串，已经生成时不做任何事
+    void fillExceptionTrace(interop::ExceptionInstance *exception);
+
+    // DisableGC/EnableGC。无法预留budget字节时抛出GCBudgetExceeded
+    void enterNoGCRegion(int64_t budget);
+    void exitNoGCRegion();
     void execute(runtime::Method *static_method = nullptr);
 
-    inline Processor(Loader *loader) : loader(*loader), operand(2048), frame(2048){}
+    // 按栈帧的引用表与操作栈的stack map枚举根集
+    void enumerateRoots(std::vector<Reference> &roots)override;
+
+    inline Processor(Loader *loader) : loader(*loader), operand(1 << 20), frame(8 << 20), call_stack(1 << 18){
+        loader->getGC()->addRootProvider(this);
+    }
+
+    inline ~Processor(){
+        loader.getGC()->removeRootProvider(this);
+    }
 };
 
 #endif
\ No newline at end of file
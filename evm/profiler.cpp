@@ -0,0 +1,27 @@
+#include "profiler.h"
+#include "processor.h"
+#include "unicode.h"
+
+void AllocationProfiler::sampleAllocation(runtime::Class *klass, uint64_t bytes){
+    auto &call_stack = processor.getCallStack();
+    current.frames.clear();
+    current.klass = klass;
+    current.truncated = call_stack.size() > max_depth;
+    for(auto itr = call_stack.rbegin(); itr != call_stack.rend() && current.frames.size() < max_depth; itr++){
+        current.frames.emplace_back(itr->getHostedFunction(), itr->getLine());
+    }
+    auto &total = sites[current];
+    total.samples++;
+    total.bytes += bytes;
+}
+
+void AllocationProfiler::writeFolded(std::ostream &out) const {
+    for(auto &[site, total] : sites){
+        if(site.truncated) out << "...;";
+        for(auto itr = site.frames.rbegin(); itr != site.frames.rend(); itr++){
+            out << unicode::toUTF8(itr->first->qualifiedName()) << ":" << itr->second << ";";
+        }
+        out << "new " << unicode::toUTF8(site.klass->qualifiedName()) << " " << total.bytes << "\n";
+    }
+    out.flush();
+}
@@ -0,0 +1,41 @@
+#ifndef EVM_PROFILER
+#define EVM_PROFILER
+#include "gc.h"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+class Processor;
+
+// 分配采样分析。GC每分配约interval字节采样一次，记录分配的类型与调用栈中最内层的max_depth个栈帧(函数与行号)，
+// 相同调用栈的样本合并。退出时按折叠栈格式写出，每行为 外层帧;...;内层帧;类型 估计的字节数，
+// 可以直接交给flamegraph.pl或speedscope
+class AllocationProfiler : public AllocationSampler {
+    static constexpr size_t max_depth = 16;
+
+    struct Site {
+        std::vector<std::pair<runtime::HostedFunction*, uint32_t>> frames;  // 由内向外
+        runtime::Class *klass;
+        bool truncated;
+        auto operator<=>(const Site&) const = default;
+    };
+
+    struct Total {
+        uint64_t samples = 0;
+        uint64_t bytes = 0;
+    };
+
+    Processor &processor;
+    std::map<Site, Total> sites;
+    Site current;
+public:
+    explicit AllocationProfiler(Processor &processor) : processor(processor){}
+
+    void sampleAllocation(runtime::Class *klass, uint64_t bytes) override;
+
+    void writeFolded(std::ostream &out) const;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "loader.h"
 #include "unicode.h"
 #include "ebffi.h"
+#include "layout.h"
 #include <cstddef>
 #include <cstdlib>
 #include <exception>
@@ -51,17 +52,16 @@ namespace runtime {
     }
 
     void Global::complete(){
-        this->static_memory_size = 0;
-        std::list<std::pair<uint32_t,Variable*>> variables;
+        std::vector<Variable*> variables;
         for(auto [_,child] : childern){
-            if(auto variable = dynamic_cast<Variable*>(child)){
-                variables.push_back({static_memory_size,variable});
-                static_memory_size += getRuntimeSize(variable->getType());
-            }
+            if(auto variable = dynamic_cast<Variable*>(child)) variables.push_back(variable);
         }
-        static_memory = (uint8_t*)malloc(static_memory_size);
-        for(auto [offset,variable] : variables){
-            variable->setStaticAddress(static_memory+offset);
+        auto fields = layout::arrange(0, variables);
+        layout::report(this, fields);
+        this->static_memory_size = fields.size;
+        static_memory = (uint8_t*)calloc(static_memory_size, 1);
+        for(auto &slot : fields.slots){
+            slot.variable->setStaticAddress(static_memory + slot.offset);
         }
     }
 
@@ -84,17 +84,16 @@ namespace runtime {
     }
 
     void Module::complete(){
-        this->static_memory_size = 0;
-        std::list<std::pair<uint32_t,Variable*>> variables;
+        std::vector<Variable*> variables;
         for(auto [_,child] : childern){
-            if(auto variable = dynamic_cast<Variable*>(child)){
-                variables.push_back({static_memory_size,variable});
-                static_memory_size += getRuntimeSize(variable->getType());
-            }
+            if(auto variable = dynamic_cast<Variable*>(child)) variables.push_back(variable);
         }
-        static_memory = (uint8_t*)malloc(static_memory_size);
-        for(auto [offset,variable] : variables){
-            variable->setStaticAddress(static_memory+offset);
+        auto fields = layout::arrange(0, variables);
+        layout::report(this, fields);
+        this->static_memory_size = fields.size;
+        static_memory = (uint8_t*)calloc(static_memory_size, 1);
+        for(auto &slot : fields.slots){
+            slot.variable->setStaticAddress(static_memory + slot.offset);
         }
     }
 
@@ -108,26 +107,16 @@ namespace runtime {
             this->instance_ref_offsets = base_class->instance_ref_offsets;
             this->virtual_table_map = base_class->virtual_table_map;
             this->virtual_table = base_class->virtual_table;
+            this->depth = base_class->depth + 1;
+            this->display = base_class->display;
+            this->display.push_back(this);
         }
-        this->static_memory_size = 0;
-        
-        std::list<std::pair<uint32_t,Variable*>> variables;
+        std::vector<Variable*> static_variables, instance_variables;
 
         for(auto [name,child] : childern){
             if(auto variable = dynamic_cast<Variable*>(child)){
-                if(variable->getFlag() & bytecode::flag_static){
-                    variables.push_back({static_memory_size,variable});
-                    static_memory_size += getRuntimeSize(variable->getType());
-                }
-                else{
-                    if(instancesOf<runtime::Class>(variable->getType())){
-                        instance_ref_offsets.push_back(instance_memory_size);
-                    }
-                    auto size = getRuntimeSize(variable->getType());
-                    variable->setOffset(instance_memory_size);
-                    variable->setLength(size);
-                    instance_memory_size += size;
-                }
+                if(variable->getFlag() & bytecode::flag_static) static_variables.push_back(variable);
+                else instance_variables.push_back(variable);
             }
             else if(auto method = dynamic_cast<Method*>(child)){
                 method->complete();
@@ -145,9 +134,31 @@ namespace runtime {
             }
         }
 
-        static_memory = (uint8_t*)malloc(static_memory_size);
-        for(auto [offset,variable] : variables){
-            variable->setStaticAddress(static_memory+offset);
+        // 实例字段接在基类的字段之后，基类末尾的空隙可以被本类的小字段填补
+        auto instance_layout = layout::arrange(instance_memory_size, instance_variables);
+        for(auto &slot : instance_layout.slots){
+            slot.variable->setOffset(slot.offset);
+            slot.variable->setLength(slot.size);
+        }
+        instance_ref_offsets.insert(instance_ref_offsets.end(), instance_layout.ref_offsets.begin(), instance_layout.ref_offsets.end());
+        instance_memory_size = instance_layout.size;
+        layout::report(this, instance_layout, interop::alignObjectSize(instance_memory_size) - instance_memory_size);
+
+        trace_descriptor = TraceDescriptor();
+        trace_descriptor.fixed_size = interop::alignObjectSize(instance_memory_size);
+        auto ref_offsets = instance_ref_offsets;
+        std::sort(ref_offsets.begin(), ref_offsets.end());
+        for(auto offset : ref_offsets){
+            auto &runs = trace_descriptor.runs;
+            if(!runs.empty() && runs.back().offset + runs.back().count * sizeof(void*) == offset) runs.back().count++;
+            else runs.push_back(TraceDescriptor::Run{offset, 1});
+        }
+
+        auto static_layout = layout::arrange(0, static_variables);
+        this->static_memory_size = static_layout.size;
+        static_memory = (uint8_t*)calloc(static_memory_size, 1);
+        for(auto &slot : static_layout.slots){
+            slot.variable->setStaticAddress(static_memory + slot.offset);
         }
     }
 
@@ -159,11 +170,6 @@ namespace runtime {
         return dynamic_cast<Ctor*>(target->second); 
     }
 
-    uint32_t Class::getInstanceMemorySize()const{
-        if(instance_memory_size==-1)throw "";
-        return instance_memory_size;
-    }
-
     uint32_t Class::getStaticMemorySize()const{
         if(static_memory_size==-1)throw "";
         return static_memory_size;
@@ -187,6 +193,10 @@ namespace runtime {
 
     void SpecializedArray::complete(){
         completeFieldAndVFtn(array_base_type);
+        trace_descriptor.is_array = true;
+        trace_descriptor.fixed_size = sizeof(interop::ArrayInstance);
+        trace_descriptor.element_size = getRuntimeSize(&element_type);
+        trace_descriptor.element_is_ref = instancesOf<Class>(&element_type);
     }
 
     std::list<Symbol*> SpecializedArray::getDependencies(){
@@ -194,14 +204,19 @@ namespace runtime {
     }
 
     void Record::complete(){
-        this->record_memory_size = 0;
+        std::vector<Variable*> variables;
         for(auto [_,child] : childern){
-            auto variable = dynamic_cast<Variable*>(child);
-            auto size = getRuntimeSize(variable->getType());
-            variable->setOffset(record_memory_size);
-            variable->setLength(size);
-            record_memory_size += size;
+            variables.push_back(dynamic_cast<Variable*>(child));
+        }
+        auto fields = layout::arrange(0, variables);
+        for(auto &slot : fields.slots){
+            slot.variable->setOffset(slot.offset);
+            slot.variable->setLength(slot.size);
         }
+        // 大小按对齐取整，record数组与相邻的record都保持对齐
+        this->record_alignment = fields.alignment;
+        this->record_memory_size = (fields.size + fields.alignment - 1) / fields.alignment * fields.alignment;
+        layout::report(this, fields, record_memory_size - fields.size);
     }
     
     std::list<Record*> Record::getDependencies(){
@@ -232,6 +247,22 @@ namespace runtime {
     }
 
 
+    void Function::addArgumentMove(ArgumentMove move){
+        for(auto &existing : argument_plan.moves){
+            if(existing.src + existing.length == move.src && existing.dst + existing.length == move.dst){
+                existing.length += move.length;
+                return;
+            }
+            if(move.src + move.length == existing.src && move.dst + move.length == existing.dst){
+                existing.src = move.src;
+                existing.dst = move.dst;
+                existing.length += move.length;
+                return;
+            }
+        }
+        argument_plan.moves.push_back(move);
+    }
+
     void Function::complete(){
         param_memory_size = 0;
 
@@ -241,6 +272,16 @@ namespace runtime {
             stackframe_ref_offsets.push_back(0);
         }
 
+        // 普通参数在栈帧中按与操作栈上相同的顺序(即声明的逆序)连续排列，进入函数时整块拷贝
+        uint32_t normal_begin = param_memory_size, normal_size = 0;
+        for(auto param : params){
+            if(param.flag() & (bytecode::flag_optional | bytecode::flag_paramArray)) continue;
+            if(param.flag() & bytecode::flag_byref) normal_size += sizeof(interop::InteriorPointer);
+            else normal_size += getRuntimeSize(table.query(param.typetoken()));
+        }
+        uint32_t normal_end = normal_begin + normal_size;
+        param_memory_size += normal_size;
+
         uint32_t param_index = 0;
 
         for(auto param : params){
@@ -273,6 +314,11 @@ namespace runtime {
                     stackframe_interior_pointer_offsets.push_back(param_memory_size);
                     param_memory_size += value_range.length;
                 }
+                auto clear_end = value_range.begin + value_range.length;
+                if(!param_clear_ranges.empty() && param_clear_ranges.back().begin + param_clear_ranges.back().length == flag_offset)
+                    param_clear_ranges.back().length = clear_end - param_clear_ranges.back().begin;
+                else
+                    param_clear_ranges.push_back(Range(flag_offset, clear_end - flag_offset));
                 auto optional = new OptionalParameter(name, param_index, eval_kind, type, flag_offset, value_range, this);
                 childern.insert({name,optional});
                 optional_parameters.push_back(optional);
@@ -282,6 +328,7 @@ namespace runtime {
                 auto offset = Range(param_memory_size, sizeof(interop::Instance*));
                 stackframe_ref_offsets.push_back(param_memory_size);
                 param_array = new ParamArrayParameter(name, param_index, EvaluationKind::Byval, type, offset, this);
+                argument_plan.param_array_offset = param_memory_size;
                 param_memory_size += sizeof(interop::Instance*);
             }
             else{
@@ -290,22 +337,29 @@ namespace runtime {
                 if(param.flag() & bytecode::flag_byval){
                     eval_kind = EvaluationKind::Byval;
                     size = getRuntimeSize(type);
-                    if(instancesOf<runtime::Class>(type)){
-                        stackframe_ref_offsets.push_back(param_memory_size);
-                    }
                 }
                 else if(param.flag() & bytecode::flag_byref){
                     eval_kind = EvaluationKind::Byref;
                     size = sizeof(interop::InteriorPointer);
-                    stackframe_interior_pointer_offsets.push_back(param_memory_size);
+                }
+                normal_end -= size;
+                if(eval_kind == EvaluationKind::Byref){
+                    stackframe_interior_pointer_offsets.push_back(normal_end);
+                }
+                else if(instancesOf<runtime::Class>(type)){
+                    stackframe_ref_offsets.push_back(normal_end);
                 }
                 auto name = table.getToken(param.nametoken())->toString();
-                auto offset = Range(param_memory_size, size);
+                auto offset = Range(normal_end, size);
                 normal_parameters.push_back(new NormalParameter(name, param_index, eval_kind, type, offset, this));
-                param_memory_size += size;
+                addArgumentMove(ArgumentMove{normal_end - normal_begin, normal_end, size});
             }
         }
 
+        argument_plan.normal_size = normal_size;
+        argument_plan.has_optional = !optional_parameters.empty();
+        argument_plan.has_param_array = param_array != nullptr;
+
         for(auto optional : optional_parameters){
             childern.insert({optional->name,optional});
         }
@@ -335,9 +389,12 @@ namespace runtime {
                     const google::protobuf::RepeatedPtrField<Backage::ParameterDecl> &params,
                     const google::protobuf::RepeatedPtrField<Backage::LocalIndex> &locals,
                     const google::protobuf::RepeatedPtrField<Backage::LineNumber> &lineNumbers,
+                    const google::protobuf::RepeatedPtrField<Backage::ExceptionEntry> &exceptionEntries,
                     uint32_t return_type_token,
                     uint32_t flag) 
-                    : Function(name, table, flag, params, return_type_token),locals(locals),block(block){
+                    : Function(name, table, flag, params, return_type_token),locals(locals),exception_entries(exceptionEntries),block(block),
+                      function_index(function_table.size()){
+        function_table.push_back(this);
         generateLineTable(lineNumbers);
     }
 
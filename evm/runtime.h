@@ -8,6 +8,7 @@
 #include <string>
 #include <cstdint>
 #include <list>
+#include <vector>
 #include <algorithm>
 #include "bytecode.h"
 #include "backage.pb.h"
@@ -16,6 +17,10 @@
 class FFIEntry;
 class TokenTable;
 
+namespace threaded {
+    class Code;
+}
+
 namespace runtime{
 
     class Method;
@@ -110,10 +115,39 @@ namespace runtime{
             : Scope(name,childern) , table(table){}
     };
 
+    class Class;
+
+    // 对象头通过序号引用类，序号0保留
+    inline std::vector<Class*> class_table{nullptr};
+
+    class HostedFunction;
+
+    // 异常的TraceFrames通过序号引用函数，序号0保留。TraceFrames对EB代码可见，使用前需要检查序号
+    inline std::vector<HostedFunction*> function_table{nullptr};
+
+    // GC扫描对象时使用的描述，在类完成布局时计算，扫描与求对象大小时不需要RTTI
+    struct TraceDescriptor{
+        struct Run{
+            uint32_t offset;
+            uint32_t count;                 // 从offset开始连续的引用槽位数
+        };
+        std::vector<Run> runs;              // 实例字段中的引用，按偏移排序，相邻的槽位合并为一段
+        uint32_t fixed_size = 0;            // 按对象对齐取整的实例大小；数组为元素之前部分的大小
+        uint32_t element_size = 0;          // 数组元素的大小
+        bool is_array = false;              // 大小是否随数组长度变化
+        bool element_is_ref = false;        // 数组元素是否为引用
+    };
+
     class Class : public Scope{
         uint32_t flag;
+        uint32_t class_index;
         Class *base_class = nullptr;
 
+        // Cohen display：从根类到本类的所有祖先，display[i]为深度i的祖先，display[depth]为本类。
+        // 判断子类型时只需比较对方深度处的一项
+        uint32_t depth = 0;
+        std::vector<Class*> display;
+
         uint32_t instance_memory_size = -1;
 
         uint32_t static_memory_size = -1;
@@ -124,27 +158,57 @@ namespace runtime{
 
     protected:
         std::vector<uint32_t> instance_ref_offsets;
+        TraceDescriptor trace_descriptor;
 
     public:
         void completeFieldAndVFtn(Class *base);
         virtual std::list<Symbol*> getDependencies() = 0;
 
         Ctor *getCtor();
-        uint32_t getInstanceMemorySize()const;
+        inline uint32_t getInstanceMemorySize()const{
+            if(instance_memory_size==-1)throw "";
+            return instance_memory_size;
+        }
         uint32_t getStaticMemorySize()const;
 
         inline Class *getBaseClass(){ return base_class; }
 
+        inline uint32_t getDepth() const { return depth; }
+
+        // 本类是否为klass或klass的派生类
+        inline bool isSubclassOf(const Class *klass) const {
+            return klass->depth <= depth && display[klass->depth] == klass;
+        }
+
         inline Method *dispatchMethod(int virtual_method_offset){
             return virtual_table[virtual_method_offset];
         }
 
         inline const std::vector<uint32_t> &getInstanceRefFieldOffsets(){ return instance_ref_offsets; }
+        inline const TraceDescriptor &getTraceDescriptor() const { return trace_descriptor; }
 
         uint32_t getFlag(){ return flag; }
 
+        inline uint32_t getClassIndex()const{ return class_index; }
+
         Class(unicode::string name, const uint32_t flag, std::list<Symbol*> childern)
-            : Scope(name,childern), flag(flag){}
+            : Scope(name,childern), flag(flag), class_index(class_table.size()), display{this}{
+            class_table.push_back(this);
+        }
+    };
+
+
+    // 并行minorGC中线程本地分配缓冲区剩余部分的填充对象，使空间仍能逐个对象遍历。
+    // 8字节的空隙只有对象头，更大的空隙为元素大小1的数组，长度为数组头之后的字节数
+    class FillerClass : public Class{
+    public:
+        std::list<Symbol*> getDependencies()override{ return {}; }
+
+        explicit FillerClass(bool word) : Class(word ? "#filler.word"_utf32 : "#filler"_utf32, bytecode::flag_nothing, {}){
+            trace_descriptor.fixed_size = word ? 8 : 16;
+            trace_descriptor.is_array = !word;
+            trace_descriptor.element_size = word ? 0 : 1;
+        }
     };
 
 
@@ -179,10 +243,12 @@ namespace runtime{
         const Backage::RecordDecl decl;
         TokenTable &table;
         uint32_t record_memory_size = -1;
+        uint32_t record_alignment = 1;
     public:
         void complete()override;
         std::list<Record*> getDependencies();
         uint32_t getMemorySize()const;
+        inline uint32_t getAlignment()const{ return record_alignment; }
         uint32_t getFlag(){return decl.flag();}
 
         Record(unicode::string name, TokenTable &table, const Backage::RecordDecl decl, std::list<Symbol*> childern)
@@ -235,20 +301,18 @@ namespace runtime{
 
     class LineNumberTable{
         std::vector<LineNumber> numbers;
-        inline int determineLineR(int offset,int beg,int end){
-            auto mid = (beg + end) / 2;
-            auto target = numbers[mid];
-            if(offset < target.begin) return determineLineR(offset, beg, mid);
-            else if(offset > target.end) return determineLineR(offset, mid, end);
-            else return target.line;
-        }
     public:
         inline LineNumber &getLineNumber(int index){ return numbers[index]; }
         inline int getNumberCount() const { return numbers.size(); }
         inline int determineLine(int offset){ 
             if(offset<0)throw "";
             if(numbers.size()==0)return 0;
-            return determineLineR(offset, 0, numbers.size()); 
+            // numbers按begin有序，取begin不大于offset的最后一项。offset落在两项之间时不会无限递归
+            auto itr = std::upper_bound(numbers.begin(), numbers.end(), offset, [](int offset, const LineNumber &number){
+                return offset < number.begin;
+            });
+            if(itr == numbers.begin()) return numbers.front().line;
+            return std::prev(itr)->line;
         }
         explicit LineNumberTable(std::vector<LineNumber> num) : numbers(num){}
     };
@@ -264,6 +328,22 @@ namespace runtime{
             : begin(begin), length(length) {}
     };
 
+    // 一次实参拷贝。src是相对于普通参数在操作栈上区域起点的偏移，dst是栈帧中的偏移
+    struct ArgumentMove{
+        uint32_t src = 0;
+        uint32_t dst = 0;
+        uint32_t length = 0;
+    };
+
+    // Function::complete中预先算好的传参方式，由Processor::popArgsFromOperand执行
+    struct ArgumentPlan{
+        uint32_t normal_size = 0;           // 普通参数在操作栈上的总长度
+        std::vector<ArgumentMove> moves;    // 普通参数的拷贝，地址连续的已合并为一次
+        bool has_optional = false;          // 操作栈上有可选参数的个数与(值, OptionalParameter*)
+        bool has_param_array = false;
+        uint32_t param_array_offset = 0;
+    };
+
     class Parameter : public Symbol{
         ParameterKind kind;
         EvaluationKind eval_kind;
@@ -320,6 +400,12 @@ namespace runtime{
         std::vector<uint32_t> stackframe_interior_pointer_offsets;
         uint32_t param_memory_size;
 
+        // 进入函数时需要清零的参数区域，即可选参数的标志与值。其余参数都会被实参覆盖
+        std::vector<Range> param_clear_ranges;
+        ArgumentPlan argument_plan;
+
+        void addArgumentMove(ArgumentMove move);
+
 
         Symbol *return_type = nullptr;
     protected:
@@ -337,6 +423,8 @@ namespace runtime{
         inline const std::vector<uint32_t> &getStackFrameInteriorPointerOffsets(){ return stackframe_interior_pointer_offsets; }
 
         inline int32_t getParamMemorySize() const { return param_memory_size; }
+        inline const std::vector<Range> &getParamClearRanges() const { return param_clear_ranges; }
+        inline const ArgumentPlan &getArgumentPlan() const { return argument_plan; }
         inline const Parameter* getImplicitSelf() const { return implicit_self; }
         inline const Parameter* getParamArray() const { return param_array; }
         inline const std::vector<Parameter*> &getNormalParameters() const { return normal_parameters; }
@@ -366,11 +454,14 @@ namespace runtime{
 
     class HostedFunction : public Function{
         const google::protobuf::RepeatedPtrField<Backage::LocalIndex> locals;
+        const google::protobuf::RepeatedPtrField<Backage::ExceptionEntry> exception_entries;
         uint32_t local_memory_size = 0;
 
         std::vector<uint32_t> local_offsets;
         LineNumberTable *lineNumberTable = nullptr;
         std::string block;
+        threaded::Code *code = nullptr;
+        uint32_t function_index;
 
         void generateLineTable(const google::protobuf::RepeatedPtrField<Backage::LineNumber> &lineNumbers);
 
@@ -379,14 +470,26 @@ namespace runtime{
 
         // localindex 下标从1开始。0为无效
         inline uint32_t getLocalOffset(uint16_t index){ return local_offsets[index-1]; }
+        inline uint16_t getLocalCount() const { return local_offsets.size(); }
 
         inline virtual LineNumberTable *getLineNumberTable(){ return lineNumberTable; }
         inline virtual uint8_t *getBlock(){ return (uint8_t*)block.data(); }
+        inline uint32_t getBlockSize() const { return block.size(); }
+
+        // 编译器写出的异常表。为空时由threaded::translate根据enter/leave求出
+        inline const google::protobuf::RepeatedPtrField<Backage::ExceptionEntry> &getExceptionEntries() const { return exception_entries; }
+
+        // 预解码后的指令序列，在函数第一次被调用时由Processor生成
+        inline threaded::Code *getCode(){ return code; }
+        inline void setCode(threaded::Code *code){ this->code = code; }
+
+        inline uint32_t getFunctionIndex() const { return function_index; }
 
         HostedFunction(unicode::string name,TokenTable &table,const std::string &block,
                     const google::protobuf::RepeatedPtrField<Backage::ParameterDecl> &params,
                     const google::protobuf::RepeatedPtrField<Backage::LocalIndex> &locals,
                     const google::protobuf::RepeatedPtrField<Backage::LineNumber> &lineNumbers,
+                    const google::protobuf::RepeatedPtrField<Backage::ExceptionEntry> &exceptionEntries,
                     uint32_t return_type_token,
                     uint32_t flag);
 
@@ -398,7 +501,7 @@ namespace runtime{
     public:
         uint32_t getFlag(){return decl.flag();}
         Method(unicode::string name, TokenTable &table, const Backage::MethodDecl decl)
-            : HostedFunction(name,table,decl.block(),decl.params(),decl.localindex(),decl.linenumbers(),decl.rettypetoken(),decl.flag()), decl(decl){}
+            : HostedFunction(name,table,decl.block(),decl.params(),decl.localindex(),decl.linenumbers(),decl.exceptionentry(),decl.rettypetoken(),decl.flag()), decl(decl){}
     };
 
     class Ctor : public HostedFunction{
@@ -409,7 +512,7 @@ namespace runtime{
         inline void setClass(Class *klass){ this->klass = klass; }
         uint32_t getFlag(){return decl.flag();}
         Ctor(TokenTable &table, const Backage::CtorDecl decl)
-            : HostedFunction("#ctor"_utf32,table,decl.block(),decl.params(),decl.localindex(),decl.linenumbers(),0,decl.flag()), decl(decl){}
+            : HostedFunction("#ctor"_utf32,table,decl.block(),decl.params(),decl.localindex(),decl.linenumbers(),decl.exceptionentry(),0,decl.flag()), decl(decl){}
     };
 
     class VirtualMethod : public Symbol{
@@ -0,0 +1,1126 @@
+#include "threaded.h"
+#include "runtime.h"
+#include "loader.h"
+#include "interop.h"
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+namespace threaded {
+
+    Instruction *Code::at(uint32_t offset){
+        uint32_t beg = 0, end = instructions.size();
+        while(beg < end){
+            auto mid = (beg + end) / 2;
+            if(instructions[mid].offset < offset) beg = mid + 1;
+            else end = mid;
+        }
+        if(beg == instructions.size() || instructions[beg].offset != offset)
+            throw std::invalid_argument("branch target " + std::to_string(offset) + " is not an instruction boundary");
+        return &instructions[beg];
+    }
+
+    const ExceptionRange *Code::findHandler(const Instruction *inst, runtime::Class *klass, size_t &outer) const {
+        uint32_t index = inst - instructions.data();
+        const ExceptionRange *found = nullptr;
+        outer = 0;
+        for(auto &range : exception_table){
+            if(index < range.begin || index >= range.end) continue;
+            if(found != nullptr) outer++;
+            else if(klass->isSubclassOf(range.klass)) found = &range;
+        }
+        return found;
+    }
+
+    size_t Code::handlerDepth(const Instruction *inst) const {
+        uint32_t index = inst - instructions.data();
+        size_t depth = 0;
+        for(auto &range : exception_table){
+            if(index >= range.begin && index < range.end) depth++;
+        }
+        return depth;
+    }
+
+    void Code::bind(const void *const *handler_table){
+        for(auto &inst : instructions){
+            inst.handler = handler_table[(int)inst.op];
+        }
+        bound = true;
+    }
+
+    class Decoder {
+        uint8_t *beg, *ptr, *end;
+    public:
+        template<class T>
+        T consume(){
+            if(ptr + sizeof(T) > end) throw std::invalid_argument("unexpected end of bytecode");
+            auto r = read<T>(ptr);
+            ptr += sizeof(T);
+            return r;
+        }
+
+        // 解码DataType。record类型在类型字节之后紧跟record的token
+        uint8_t consumeType(Operand *record_token){
+            auto typ = consume<uint8_t>();
+            if(typ == bytecode::t_record){
+                auto tok = consume<token_t>();
+                if(record_token != nullptr) record_token->token = tok;
+            }
+            return typ;
+        }
+
+        uint8_t consumeHint(){
+            auto hint = consume<uint8_t>();
+            if(hint != bytecode::hint_instance && hint != bytecode::hint_handle && hint != bytecode::hint_record)
+                throw std::invalid_argument("invalid field access hint " + std::to_string(hint));
+            return hint;
+        }
+
+        inline bool finished() const { return ptr >= end; }
+        inline uint32_t offset() const { return ptr - beg; }
+
+        Decoder(uint8_t *block, uint32_t size) : beg(block), ptr(block), end(block + size){}
+    };
+
+    // push指令立即数的长度
+    uint32_t immediateSize(uint8_t typ){
+        switch(typ){
+            case bytecode::t_boolean:
+            case bytecode::t_i8:
+            case bytecode::t_u8: return 1;
+            case bytecode::t_i16:
+            case bytecode::t_u16: return 2;
+            case bytecode::t_i32:
+            case bytecode::t_u32:
+            case bytecode::t_f32: return 4;
+            case bytecode::t_i64:
+            case bytecode::t_u64:
+            case bytecode::t_f64:
+            case bytecode::t_ref:
+            case bytecode::t_emconst: return 8;
+            default: throw std::invalid_argument("unsupported immediate type " + std::to_string(typ));
+        }
+    }
+
+    Op quicken(uint8_t code, uint8_t typ){
+        switch((code << 8) | typ){
+            #define EVM_QUICKEN_CASE(op, Handler, suffix, T) \
+                case (bytecode::op << 8) | bytecode::t_##suffix: return Op::op##_##suffix;
+            EVM_QUICKENED_OPS(EVM_QUICKEN_CASE)
+            EVM_QUICKENED_CHECKED_OPS(EVM_QUICKEN_CASE)
+            #undef EVM_QUICKEN_CASE
+            default: throw std::invalid_argument("type " + std::to_string(typ) + " is not valid for bytecode " + std::to_string(code));
+        }
+    }
+
+    Op quickenConvert(uint8_t src, uint8_t dst){
+        switch((src << 8) | dst){
+            #define EVM_QUICKEN_CONVERT_CASE(src, S, dst, D) \
+                case (bytecode::t_##src << 8) | bytecode::t_##dst: return Op::convert_##src##_##dst;
+            EVM_CONVERT_OPS(EVM_QUICKEN_CONVERT_CASE)
+            #undef EVM_QUICKEN_CONVERT_CASE
+            default: throw std::invalid_argument("cannot convert type " + std::to_string(src) + " to " + std::to_string(dst));
+        }
+    }
+
+    template<class T>
+    T *resolveAs(TokenTable &table, token_t token){
+        auto sym = dynamic_cast<T*>(table.query(token));
+        if(sym == nullptr) throw std::invalid_argument("token " + std::to_string(token) + " refers to an unexpected symbol");
+        return sym;
+    }
+
+    // 将指令中的token解析为运行时数据。只在链接时执行，因此可以使用RTTI
+    void resolve(uint8_t code_byte, Instruction &inst, runtime::HostedFunction *hosted, Loader &loader){
+        using namespace runtime;
+        auto &table = hosted->getTable();
+        switch(code_byte){
+            case bytecode::ldsftn:
+            case bytecode::ldftn:
+                inst.a.method = resolveAs<Method>(table, inst.a.token);
+                break;
+            case bytecode::ldvftn:
+                inst.a.virtual_method = resolveAs<VirtualMethod>(table, inst.a.token);
+                break;
+            case bytecode::ldctor:
+                inst.a.ctor = resolveAs<Ctor>(table, inst.a.token);
+                break;
+            case bytecode::ldforeign:
+                inst.a.foreign = resolveAs<ForeignEntry>(table, inst.a.token);
+                break;
+            case bytecode::calldlg:
+                inst.b.symbol = resolveAs<Function>(table, inst.b.token);
+                break;
+            case bytecode::callintrinsic:{
+                auto text = &dynamic_cast<TextToken*>(table.getToken(inst.a.token))->getText();
+                inst.a.u64 = (uint64_t)loader.getInteropAgent()->getInstrinsicByName(*text);
+                inst.b.text = text;
+                break;
+            }
+            case bytecode::ldstr:
+                inst.a.text = &dynamic_cast<TextToken*>(table.getToken(inst.a.token))->getText();
+                break;
+            case bytecode::stfld:
+            case bytecode::ldfld:
+            case bytecode::ldflda:
+            case bytecode::stfldh:
+            case bytecode::ldfldh:
+            case bytecode::ldfldah:{
+                auto fld = resolveAs<Variable>(table, inst.a.token);
+                inst.a.field = FieldSlot{fld->getOffset(), fld->getLength()};
+                inst.b.variable = fld;
+                break;
+            }
+            case bytecode::stloci:
+            case bytecode::ldloci:
+            case bytecode::ldlocai:
+                if(inst.a.slot.index == 0 || inst.a.slot.index > hosted->getLocalCount())
+                    throw std::invalid_argument("local index " + std::to_string(inst.a.slot.index) + " out of range");
+                inst.a.slot.offset = hosted->getLocalOffset(inst.a.slot.index);
+                inst.a.slot.optional = false;
+                break;
+            case bytecode::stargi:
+            case bytecode::ldargi:
+            case bytecode::ldargai:{
+                const Parameter *parameter = nullptr;
+                try{
+                    parameter = hosted->getParameterByIndex(inst.a.slot.index);
+                }
+                catch(const char*){
+                    throw std::invalid_argument("argument index " + std::to_string(inst.a.slot.index) + " out of range");
+                }
+                inst.a.slot.offset = parameter->getOffset();
+                inst.a.slot.optional = parameter->getKind() == ParameterKind::Optional;
+                break;
+            }
+            case bytecode::stsfld:
+            case bytecode::ldsfld:
+            case bytecode::ldsflda:{
+                auto fld = resolveAs<Variable>(table, inst.a.token);
+                inst.a.address = fld->getStaticAddress();
+                inst.b.variable = fld;
+                break;
+            }
+            case bytecode::stelem:
+            case bytecode::stelemr:
+            case bytecode::ldelem:
+            case bytecode::ldelema:{
+                auto element = table.query(inst.a.token);
+                inst.a.u64 = 0;
+                inst.a.size = getRuntimeSize(element);
+                inst.b.symbol = element;
+                break;
+            }
+            case bytecode::newarray:
+                inst.a.array = loader.getSpecilizedArrayPool()->query(table.query(inst.a.token));
+                break;
+            case bytecode::newobj:
+            case bytecode::instanceof:
+            case bytecode::enter:
+            case bytecode::leave:
+                inst.a.klass = resolveAs<Class>(table, inst.a.token);
+                break;
+            case bytecode::castClass:
+                inst.a.klass = resolveAs<Class>(table, inst.a.token);
+                inst.b.klass = resolveAs<Class>(table, inst.b.token);
+                break;
+            case bytecode::packopt:
+                inst.b.symbol = table.query(inst.a.token);
+                break;
+            case bytecode::ldoptinfo:
+                inst.a.option = resolveAs<OptionalParameter>(table, inst.a.token);
+                break;
+            case bytecode::ldenumc:
+                inst.a.constant = resolveAs<EnumConstant>(table, inst.a.token);
+                break;
+            case bytecode::pop:
+                if(inst.type == bytecode::t_record){
+                    auto size = resolveAs<Record>(table, inst.a.token)->getMemorySize();
+                    inst.a.u64 = 0;
+                    inst.a.size = size;
+                }
+                break;
+        }
+    }
+
+    Code *translate(runtime::HostedFunction *hosted, Loader &loader){
+        // 解码失败时释放已生成的部分
+        std::unique_ptr<Code> code(new Code());
+        Decoder decoder(hosted->getBlock(), hosted->getBlockSize());
+        // 跳转目标在所有指令解码完成后才能确定地址，先记录下来
+        std::vector<std::pair<size_t,uint32_t>> branches;
+        std::vector<uint8_t> code_bytes;
+
+        while(!decoder.finished()){
+            Instruction inst;
+            inst.offset = decoder.offset();
+            auto code_byte = decoder.consume<uint8_t>();
+            switch(code_byte){
+                #define EVM_TRANSLATE_NO_OPERAND(x) case bytecode::x: inst.op = Op::x; break;
+                EVM_TRANSLATE_NO_OPERAND(nop)
+                EVM_TRANSLATE_NO_OPERAND(callmethod)
+                EVM_TRANSLATE_NO_OPERAND(callvirtual)
+                EVM_TRANSLATE_NO_OPERAND(callstatic)
+                EVM_TRANSLATE_NO_OPERAND(callforeign)
+                EVM_TRANSLATE_NO_OPERAND(callctor)
+                EVM_TRANSLATE_NO_OPERAND(ldarga)
+                EVM_TRANSLATE_NO_OPERAND(ldloca)
+                EVM_TRANSLATE_NO_OPERAND(testopt)
+                EVM_TRANSLATE_NO_OPERAND(arraylength)
+                EVM_TRANSLATE_NO_OPERAND(ret)
+                EVM_TRANSLATE_NO_OPERAND(ldnothing)
+                EVM_TRANSLATE_NO_OPERAND(throw_)
+                EVM_TRANSLATE_NO_OPERAND(and_)
+                EVM_TRANSLATE_NO_OPERAND(or_)
+                EVM_TRANSLATE_NO_OPERAND(xor_)
+                EVM_TRANSLATE_NO_OPERAND(not_)
+                EVM_TRANSLATE_NO_OPERAND(wrapsftn)
+                EVM_TRANSLATE_NO_OPERAND(wrapvftn)
+                EVM_TRANSLATE_NO_OPERAND(wrapftn)
+                EVM_TRANSLATE_NO_OPERAND(wrapctor)
+                EVM_TRANSLATE_NO_OPERAND(wrapforeign)
+                #undef EVM_TRANSLATE_NO_OPERAND
+
+                #define EVM_TRANSLATE_TOKEN(x) \
+                    case bytecode::x: inst.op = Op::x; inst.a.token = decoder.consume<token_t>(); break;
+                EVM_TRANSLATE_TOKEN(ldsftn)
+                EVM_TRANSLATE_TOKEN(ldvftn)
+                EVM_TRANSLATE_TOKEN(ldftn)
+                EVM_TRANSLATE_TOKEN(ldctor)
+                EVM_TRANSLATE_TOKEN(ldforeign)
+                EVM_TRANSLATE_TOKEN(callintrinsic)
+                EVM_TRANSLATE_TOKEN(ldflda)
+                EVM_TRANSLATE_TOKEN(ldsflda)
+                EVM_TRANSLATE_TOKEN(packopt)
+                EVM_TRANSLATE_TOKEN(ldelema)
+                EVM_TRANSLATE_TOKEN(newarray)
+                EVM_TRANSLATE_TOKEN(instanceof)
+                EVM_TRANSLATE_TOKEN(leave)
+                EVM_TRANSLATE_TOKEN(ldstr)
+                EVM_TRANSLATE_TOKEN(ldoptinfo)
+                EVM_TRANSLATE_TOKEN(ldenumc)
+                EVM_TRANSLATE_TOKEN(newobj)
+                #undef EVM_TRANSLATE_TOKEN
+
+                // <Type>，record类型的token存放在b
+                #define EVM_TRANSLATE_TYPE(x) \
+                    case bytecode::x: \
+                        inst.type = decoder.consumeType(&inst.b); \
+                        inst.op = quicken(code_byte, inst.type); \
+                        break;
+                EVM_TRANSLATE_TYPE(starg)
+                EVM_TRANSLATE_TYPE(ldarg)
+                EVM_TRANSLATE_TYPE(stloc)
+                EVM_TRANSLATE_TYPE(ldloc)
+                EVM_TRANSLATE_TYPE(dup)
+                EVM_TRANSLATE_TYPE(store)
+                EVM_TRANSLATE_TYPE(load)
+                EVM_TRANSLATE_TYPE(add)
+                EVM_TRANSLATE_TYPE(sub)
+                EVM_TRANSLATE_TYPE(mul)
+                EVM_TRANSLATE_TYPE(div)
+                EVM_TRANSLATE_TYPE(mod)
+                EVM_TRANSLATE_TYPE(neg)
+                EVM_TRANSLATE_TYPE(eq)
+                EVM_TRANSLATE_TYPE(ne)
+                EVM_TRANSLATE_TYPE(lt)
+                EVM_TRANSLATE_TYPE(gt)
+                EVM_TRANSLATE_TYPE(le)
+                EVM_TRANSLATE_TYPE(ge)
+                #undef EVM_TRANSLATE_TYPE
+
+                // <Type> u16
+                #define EVM_TRANSLATE_TYPE_INDEX(x) \
+                    case bytecode::x: \
+                        inst.type = decoder.consumeType(&inst.b); \
+                        inst.op = quicken(code_byte, inst.type); \
+                        inst.a.slot.index = decoder.consume<uint16_t>(); \
+                        break;
+                EVM_TRANSLATE_TYPE_INDEX(stargi)
+                EVM_TRANSLATE_TYPE_INDEX(ldargi)
+                EVM_TRANSLATE_TYPE_INDEX(stloci)
+                EVM_TRANSLATE_TYPE_INDEX(ldloci)
+                #undef EVM_TRANSLATE_TYPE_INDEX
+
+                // u16
+                case bytecode::ldargai:
+                case bytecode::ldlocai:
+                    inst.op = code_byte == bytecode::ldargai ? Op::ldargai : Op::ldlocai;
+                    inst.a.slot.index = decoder.consume<uint16_t>();
+                    break;
+
+                // pop.record的大小由record token决定，放在a
+                case bytecode::pop:
+                    inst.type = decoder.consumeType(&inst.a);
+                    inst.op = quicken(code_byte, inst.type);
+                    break;
+
+                // <Type> <Token>
+                #define EVM_TRANSLATE_TYPE_TOKEN(x) \
+                    case bytecode::x: \
+                        inst.type = decoder.consumeType(&inst.b); \
+                        inst.op = quicken(code_byte, inst.type); \
+                        inst.a.token = decoder.consume<token_t>(); \
+                        break;
+                EVM_TRANSLATE_TYPE_TOKEN(stfld)
+                EVM_TRANSLATE_TYPE_TOKEN(ldfld)
+                EVM_TRANSLATE_TYPE_TOKEN(stsfld)
+                EVM_TRANSLATE_TYPE_TOKEN(ldsfld)
+                EVM_TRANSLATE_TYPE_TOKEN(stelem)
+                EVM_TRANSLATE_TYPE_TOKEN(stelemr)
+                EVM_TRANSLATE_TYPE_TOKEN(ldelem)
+                #undef EVM_TRANSLATE_TYPE_TOKEN
+
+                // <Type> <Token> u8
+                case bytecode::stfldh:
+                case bytecode::ldfldh:
+                    inst.type = decoder.consumeType(&inst.b);
+                    inst.op = quicken(code_byte, inst.type);
+                    inst.a.token = decoder.consume<token_t>();
+                    inst.hint = decoder.consumeHint();
+                    break;
+                // <Token> u8
+                case bytecode::ldfldah:
+                    inst.op = Op::ldfldah;
+                    inst.a.token = decoder.consume<token_t>();
+                    inst.hint = decoder.consumeHint();
+                    break;
+
+                case bytecode::push:{
+                    inst.type = decoder.consumeType(nullptr);
+                    inst.op = quicken(code_byte, inst.type);
+                    auto size = immediateSize(inst.type);
+                    for(uint32_t i = 0; i < size; i++){
+                        inst.a.bytes[i] = decoder.consume<uint8_t>();
+                    }
+                    break;
+                }
+                case bytecode::convert:{
+                    inst.type = decoder.consumeType(nullptr);
+                    inst.op = quickenConvert(inst.type, decoder.consumeType(nullptr));
+                    break;
+                }
+                case bytecode::castClass:
+                    inst.op = Op::castClass;
+                    inst.a.token = decoder.consume<token_t>();
+                    inst.b.token = decoder.consume<token_t>();
+                    break;
+                case bytecode::jif:
+                case bytecode::br:
+                    inst.op = code_byte == bytecode::jif ? Op::jif : Op::br;
+                    branches.push_back({code->instructions.size(), decoder.consume<uint32_t>()});
+                    break;
+                case bytecode::calldlg:
+                    // a留给内联缓存，签名的token放在b中
+                    inst.op = Op::calldlg;
+                    inst.b.token = decoder.consume<token_t>();
+                    break;
+                case bytecode::enter:
+                    inst.op = Op::enter;
+                    inst.a.token = decoder.consume<token_t>();
+                    branches.push_back({code->instructions.size(), decoder.consume<uint32_t>()});
+                    break;
+                default:
+                    throw std::invalid_argument("unexpected bytecode " + std::to_string(code_byte)
+                                                + " at offset " + std::to_string(inst.offset));
+            }
+            resolve(code_byte, inst, hosted, loader);
+            if(inst.op == Op::callvirtual || inst.op == Op::calldlg) inst.a.cache = code->newInlineCache();
+            code->instructions.push_back(inst);
+            code_bytes.push_back(code_byte);
+        }
+
+        for(auto [index, target_offset] : branches){
+            auto &inst = code->instructions[index];
+            if(inst.op == Op::enter) inst.b.target = code->at(target_offset);
+            else inst.a.target = code->at(target_offset);
+        }
+
+        analyzeStackMaps(code.get(), hosted, code_bytes);
+        buildExceptionTable(code.get(), hosted);
+        return code.release();
+    }
+
+    namespace {
+        enum class EntryKind : uint8_t { Data, Ref, Interior, Delegate };
+
+        // 抽象操作栈上的一项。symbol与constant是ldftn、ldoptinfo、push等指令压入的已知值，
+        // 用于确定调用的参数布局、可选参数的个数与字段的访问方式
+        struct Entry {
+            uint32_t size;
+            EntryKind kind;
+            runtime::Symbol *symbol = nullptr;
+            bool known = false;
+            uint64_t constant = 0;
+        };
+
+        // 指令在执行时总是抛出异常，如写入record的字段。该路径没有后继
+        struct NoFallthrough {};
+
+        Entry data(uint32_t size){ return Entry{size, EntryKind::Data}; }
+        Entry ref(){ return Entry{sizeof(interop::Instance*), EntryKind::Ref}; }
+        Entry interior(){ return Entry{sizeof(interop::InteriorPointer), EntryKind::Interior}; }
+
+        Entry entryOf(runtime::Symbol *type){
+            if(runtime::instancesOf<runtime::Class>(type)) return ref();
+            return data(runtime::getRuntimeSize(type));
+        }
+
+        class AbstractStack {
+        public:
+            std::vector<Entry> entries;
+
+            void push(Entry entry){ entries.push_back(entry); }
+
+            // 弹出size字节。数据项可以被部分弹出，引用不行
+            void pop(uint32_t size){
+                while(size > 0){
+                    if(entries.empty()) throw std::invalid_argument("operand stack underflow");
+                    auto &top = entries.back();
+                    if(top.size <= size){
+                        size -= top.size;
+                        entries.pop_back();
+                    }
+                    else if(top.kind == EntryKind::Data){
+                        top = data(top.size - size);
+                        size = 0;
+                    }
+                    else throw std::invalid_argument("operand stack layout mismatch");
+                }
+            }
+
+            // 弹出一个恰好为size字节的项并返回，以取得其中的已知值
+            Entry take(uint32_t size){
+                if(!entries.empty() && entries.back().size == size){
+                    auto top = entries.back();
+                    entries.pop_back();
+                    return top;
+                }
+                pop(size);
+                return data(size);
+            }
+
+            template<class T>
+            T *takeSymbol(){
+                auto sym = dynamic_cast<T*>(take(sizeof(void*)).symbol);
+                if(sym == nullptr) throw std::invalid_argument("unknown call target");
+                return sym;
+            }
+
+            uint64_t takeConstant(uint32_t size){
+                auto entry = take(size);
+                if(!entry.known) throw std::invalid_argument("operand is not a constant");
+                return entry.constant;
+            }
+
+            StackMap layout() const {
+                StackMap map;
+                map.height = 0;
+                for(auto &entry : entries){
+                    if(entry.kind == EntryKind::Ref) map.refs.push_back(map.height);
+                    else if(entry.kind == EntryKind::Interior) map.interiors.push_back(map.height);
+                    else if(entry.kind == EntryKind::Delegate) map.refs.push_back(map.height + offsetof(interop::Delegate, instance));
+                    map.height += entry.size;
+                }
+                return map;
+            }
+        };
+
+        bool sameLayout(const StackMap &lhs, const StackMap &rhs){
+            return lhs.height == rhs.height && lhs.refs == rhs.refs && lhs.interiors == rhs.interiors;
+        }
+
+        // 合并来自另一条路径的状态，不同的已知值被丢弃。返回state是否改变
+        bool merge(AbstractStack &state, const AbstractStack &incoming){
+            if(!sameLayout(state.layout(), incoming.layout())) throw std::invalid_argument("inconsistent operand stack");
+            bool changed = false;
+            bool same_entries = state.entries.size() == incoming.entries.size();
+            for(size_t i = 0; i < state.entries.size(); i++){
+                auto &entry = state.entries[i];
+                if(same_entries && entry.size == incoming.entries[i].size
+                    && entry.symbol == incoming.entries[i].symbol
+                    && entry.known == incoming.entries[i].known
+                    && entry.constant == incoming.entries[i].constant) continue;
+                if(entry.symbol != nullptr || entry.known){
+                    entry.symbol = nullptr;
+                    entry.known = false;
+                    entry.constant = 0;
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        EntryKind kindOf(uint8_t typ){
+            if(typ == bytecode::t_ref) return EntryKind::Ref;
+            if(typ == bytecode::t_hdl) return EntryKind::Interior;
+            return EntryKind::Data;
+        }
+
+        // 带类型指令操作的值的大小
+        uint32_t valueSize(uint8_t code_byte, const Instruction &inst, runtime::HostedFunction *hosted){
+            using namespace runtime;
+            switch(code_byte){
+                case bytecode::stfld:
+                case bytecode::ldfld:
+                case bytecode::stfldh:
+                case bytecode::ldfldh:
+                    return inst.a.field.length;
+                case bytecode::stsfld:
+                case bytecode::ldsfld:
+                    return inst.b.variable->getLength();
+                case bytecode::stelem:
+                case bytecode::stelemr:
+                case bytecode::ldelem:
+                    return inst.a.size;
+            }
+            switch(inst.type){
+                case bytecode::t_hdl: return sizeof(interop::InteriorPointer);
+                case bytecode::t_record:
+                    if(code_byte == bytecode::pop) return inst.a.size;
+                    return resolveAs<Record>(hosted->getTable(), inst.b.token)->getMemorySize();
+                default: return immediateSize(inst.type);
+            }
+        }
+
+        Entry valueOf(uint8_t code_byte, const Instruction &inst, runtime::HostedFunction *hosted){
+            return Entry{valueSize(code_byte, inst, hosted), kindOf(inst.type)};
+        }
+
+        uint32_t convertTargetSize(Op op){
+            switch(op){
+                #define EVM_CONVERT_TARGET_SIZE(src, S, dst, D) case Op::convert_##src##_##dst: return sizeof(D);
+                EVM_CONVERT_OPS(EVM_CONVERT_TARGET_SIZE)
+                #undef EVM_CONVERT_TARGET_SIZE
+                default: throw std::invalid_argument("not a convert instruction");
+            }
+        }
+
+        // 与Processor::popArgsFromOperand的顺序一致
+        void popArguments(runtime::Function *fn, AbstractStack &stack){
+            if(fn->getParamArray() != nullptr) stack.pop(sizeof(interop::ArrayInstance*));
+            if(!fn->getOptionalParameters().empty()){
+                auto count = stack.takeConstant(sizeof(uint8_t));
+                while(count--){
+                    auto option = stack.takeSymbol<runtime::OptionalParameter>();
+                    stack.pop(option->getLength());
+                }
+            }
+            for(auto parameter : fn->getNormalParameters()){
+                stack.pop(parameter->getLength());
+            }
+        }
+
+        void pushResult(runtime::Function *fn, AbstractStack &stack){
+            auto type = fn->getReturnType();
+            if(auto pmt = dynamic_cast<runtime::Primitive*>(type)){
+                if(pmt->getKind() == runtime::PrimitiveKind::Void) return;
+            }
+            stack.push(entryOf(type));
+        }
+
+        void callIntrinsic(interop::Intrinsic intrinsic, AbstractStack &stack){
+            using enum interop::Intrinsic;
+            switch(intrinsic){
+                case ItNotInRange: stack.pop(4 * sizeof(int32_t)); stack.push(data(sizeof(uint8_t))); break;
+                case DebugBool: stack.pop(sizeof(uint8_t)); break;
+                case DebugInt: stack.pop(sizeof(int32_t)); break;
+                case DebugLong: stack.pop(sizeof(int64_t)); break;
+                case PutRune: stack.pop(sizeof(uint32_t)); break;
+                case BooleanToString:
+                case ByteToString: stack.pop(sizeof(uint8_t)); stack.push(ref()); break;
+                case ShortToString: stack.pop(sizeof(int16_t)); stack.push(ref()); break;
+                case IntegerToString:
+                case SingleToString: stack.pop(sizeof(int32_t)); stack.push(ref()); break;
+                case LongToString:
+                case DoubleToString: stack.pop(sizeof(int64_t)); stack.push(ref()); break;
+                case DebugObjAddr:
+                case Pin:
+                case Unpin: stack.pop(sizeof(interop::Instance*)); break;
+                case Trap: stack.pop(sizeof(uint32_t)); stack.pop(sizeof(interop::Instance*)); break;
+                case StringToCStr: stack.pop(sizeof(interop::Instance*)); stack.push(ref()); break;
+                case EnableGC: break;
+                case DisableGC: stack.pop(sizeof(int64_t)); break;
+                case AryPtr:
+                case ObjPtr: stack.pop(sizeof(interop::Instance*)); stack.push(data(sizeof(uintptr_t))); break;
+                case RefPtr: stack.pop(sizeof(interop::InteriorPointer)); stack.push(data(sizeof(uintptr_t))); break;
+                case NewPinnedBytes: stack.pop(sizeof(int32_t)); stack.push(ref()); break;
+                case GCStatistic: stack.pop(sizeof(int32_t)); stack.push(data(sizeof(int64_t))); break;
+                case HeapSnapshot: stack.pop(sizeof(interop::Instance*)); stack.push(data(sizeof(uint8_t))); break;
+                case FillExceptionTrace: stack.pop(sizeof(interop::Instance*)); break;
+                default: throw std::invalid_argument("unknown intrinsic");
+            }
+        }
+
+        // 按字段的访问方式弹出对象、句柄或record
+        void popFieldBase(uint8_t hint, const Instruction &inst, AbstractStack &stack){
+            if(hint == bytecode::hint_instance) stack.pop(sizeof(interop::Instance*));
+            else if(hint == bytecode::hint_handle) stack.pop(sizeof(interop::InteriorPointer));
+            else stack.pop(static_cast<runtime::Record*>(inst.b.variable->parent)->getMemorySize());
+        }
+
+        // 模拟一条指令对操作栈的影响，与Processor中对应handler的弹出与压入一致
+        void apply(uint8_t code_byte, const Instruction &inst, runtime::HostedFunction *hosted, AbstractStack &stack){
+            using namespace runtime;
+            switch(code_byte){
+                case bytecode::ldsftn:
+                case bytecode::ldftn:
+                case bytecode::ldvftn:
+                case bytecode::ldctor:
+                case bytecode::ldforeign:
+                case bytecode::ldoptinfo:{
+                    auto entry = data(sizeof(void*));
+                    switch(code_byte){
+                        case bytecode::ldsftn:
+                        case bytecode::ldftn: entry.symbol = inst.a.method; break;
+                        case bytecode::ldvftn: entry.symbol = inst.a.virtual_method; break;
+                        case bytecode::ldctor: entry.symbol = inst.a.ctor; break;
+                        case bytecode::ldforeign: entry.symbol = inst.a.foreign; break;
+                        default: entry.symbol = inst.a.option; break;
+                    }
+                    stack.push(entry);
+                    break;
+                }
+                case bytecode::callmethod:{
+                    auto fn = stack.takeSymbol<Method>();
+                    popArguments(fn, stack);
+                    stack.pop(sizeof(interop::Instance*));
+                    pushResult(fn, stack);
+                    break;
+                }
+                case bytecode::callvirtual:{
+                    auto fn = stack.takeSymbol<VirtualMethod>()->getSelfImpl();
+                    popArguments(fn, stack);
+                    stack.pop(sizeof(interop::Instance*));
+                    pushResult(fn, stack);
+                    break;
+                }
+                case bytecode::callstatic:{
+                    auto fn = stack.takeSymbol<Method>();
+                    popArguments(fn, stack);
+                    pushResult(fn, stack);
+                    break;
+                }
+                case bytecode::callctor:{
+                    auto fn = stack.takeSymbol<Ctor>();
+                    popArguments(fn, stack);
+                    stack.pop(sizeof(interop::Instance*));
+                    break;
+                }
+                case bytecode::callforeign:{
+                    auto fn = stack.takeSymbol<ForeignEntry>();
+                    for(auto parameter : fn->getNormalParameters()){
+                        stack.pop(parameter->getLength());
+                    }
+                    pushResult(fn, stack);
+                    break;
+                }
+                case bytecode::callintrinsic:
+                    callIntrinsic((interop::Intrinsic)inst.a.u64, stack);
+                    break;
+                case bytecode::calldlg:{
+                    // 弹出的实参与压入的结果由委托声明的签名决定，与委托由哪条wrap指令创建无关。
+                    // 实例方法的接收者保存在委托中，不在操作栈上
+                    auto signature = static_cast<runtime::Function*>(inst.b.symbol);
+                    stack.pop(sizeof(interop::Delegate));
+                    popArguments(signature, stack);
+                    if(dynamic_cast<Ctor*>(signature) == nullptr) pushResult(signature, stack);
+                    break;
+                }
+                case bytecode::ldarga:
+                case bytecode::ldloca:
+                    stack.pop(sizeof(uint16_t));
+                    stack.push(interior());
+                    break;
+                case bytecode::ldargai:
+                case bytecode::ldlocai:
+                case bytecode::ldsflda:
+                    stack.push(interior());
+                    break;
+                case bytecode::ldflda:
+                    popFieldBase(stack.takeConstant(sizeof(uint8_t)), inst, stack);
+                    stack.push(interior());
+                    break;
+                case bytecode::ldfldah:
+                    popFieldBase(inst.hint, inst, stack);
+                    stack.push(interior());
+                    break;
+                case bytecode::packopt:
+                    stack.push(data(sizeof(token_t)));
+                    break;
+                case bytecode::testopt:{
+                    auto count = stack.takeConstant(sizeof(uint8_t));
+                    stack.pop(count * sizeof(uint16_t));
+                    stack.push(data(sizeof(uint8_t)));
+                    break;
+                }
+                case bytecode::ldenumc:
+                    stack.push(data(sizeof(runtime::EnumConstant*)));
+                    break;
+                case bytecode::ldelema:
+                    stack.pop(sizeof(int32_t));
+                    stack.pop(sizeof(interop::ArrayInstance*));
+                    stack.push(interior());
+                    break;
+                case bytecode::newarray:
+                    stack.pop(sizeof(int32_t));
+                    stack.push(ref());
+                    break;
+                case bytecode::arraylength:
+                    stack.pop(sizeof(interop::ArrayInstance*));
+                    stack.push(data(sizeof(int32_t)));
+                    break;
+                case bytecode::jif:
+                    stack.pop(sizeof(uint8_t));
+                    break;
+                case bytecode::ldnothing:
+                case bytecode::ldstr:
+                case bytecode::newobj:
+                    stack.push(ref());
+                    break;
+                case bytecode::castClass:
+                    stack.pop(sizeof(interop::Instance*));
+                    stack.push(ref());
+                    break;
+                case bytecode::instanceof:
+                    stack.pop(sizeof(interop::Instance*));
+                    stack.push(data(sizeof(uint8_t)));
+                    break;
+                case bytecode::throw_:
+                    stack.pop(sizeof(interop::Instance*));
+                    break;
+                case bytecode::and_:
+                case bytecode::or_:
+                case bytecode::xor_:
+                    stack.pop(sizeof(uint8_t));
+                    stack.pop(sizeof(uint8_t));
+                    stack.push(data(sizeof(uint8_t)));
+                    break;
+                case bytecode::not_:
+                    stack.pop(sizeof(uint8_t));
+                    stack.push(data(sizeof(bool)));
+                    break;
+                case bytecode::wrapsftn:
+                case bytecode::wrapctor:
+                case bytecode::wrapforeign:
+                case bytecode::wrapftn:
+                case bytecode::wrapvftn:
+                    if(code_byte == bytecode::wrapftn || code_byte == bytecode::wrapvftn){
+                        stack.pop(sizeof(interop::Instance*));
+                    }
+                    stack.pop(sizeof(void*));
+                    stack.push(Entry{sizeof(interop::Delegate), EntryKind::Delegate});
+                    break;
+
+                case bytecode::starg:
+                case bytecode::stloc:
+                    stack.pop(sizeof(uint16_t));
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    break;
+                case bytecode::ldarg:
+                case bytecode::ldloc:
+                    stack.pop(sizeof(uint16_t));
+                    stack.push(valueOf(code_byte, inst, hosted));
+                    break;
+                case bytecode::stargi:
+                case bytecode::stloci:
+                case bytecode::stsfld:
+                case bytecode::pop:
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    break;
+                case bytecode::ldargi:
+                case bytecode::ldloci:
+                case bytecode::ldsfld:
+                    stack.push(valueOf(code_byte, inst, hosted));
+                    break;
+                case bytecode::stfld:
+                case bytecode::stfldh:{
+                    auto hint = code_byte == bytecode::stfld ? stack.takeConstant(sizeof(uint8_t)) : inst.hint;
+                    // 写入record的字段在执行时抛出异常
+                    if(hint == bytecode::hint_record) throw NoFallthrough{};
+                    popFieldBase(hint, inst, stack);
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    break;
+                }
+                case bytecode::ldfld:
+                case bytecode::ldfldh:{
+                    auto hint = code_byte == bytecode::ldfld ? stack.takeConstant(sizeof(uint8_t)) : inst.hint;
+                    popFieldBase(hint, inst, stack);
+                    stack.push(valueOf(code_byte, inst, hosted));
+                    break;
+                }
+                case bytecode::stelem:
+                    stack.pop(sizeof(int32_t));
+                    stack.pop(sizeof(interop::ArrayInstance*));
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    break;
+                case bytecode::stelemr:
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    stack.pop(sizeof(int32_t));
+                    stack.pop(sizeof(interop::ArrayInstance*));
+                    break;
+                case bytecode::ldelem:
+                    stack.pop(sizeof(int32_t));
+                    stack.pop(sizeof(interop::ArrayInstance*));
+                    stack.push(valueOf(code_byte, inst, hosted));
+                    break;
+                case bytecode::dup:{
+                    auto value = valueOf(code_byte, inst, hosted);
+                    if(!stack.entries.empty() && stack.entries.back().size == value.size) value = stack.entries.back();
+                    stack.push(value);
+                    break;
+                }
+                case bytecode::push:{
+                    auto value = valueOf(code_byte, inst, hosted);
+                    value.known = true;
+                    value.constant = inst.a.u64;
+                    stack.push(value);
+                    break;
+                }
+                case bytecode::store:
+                    stack.pop(sizeof(interop::InteriorPointer));
+                    stack.pop(valueSize(code_byte, inst, hosted));
+                    break;
+                case bytecode::load:
+                    stack.pop(sizeof(interop::InteriorPointer));
+                    stack.push(valueOf(code_byte, inst, hosted));
+                    break;
+                case bytecode::add:
+                case bytecode::sub:
+                case bytecode::mul:
+                case bytecode::div:
+                case bytecode::mod:{
+                    auto value = valueOf(code_byte, inst, hosted);
+                    stack.pop(value.size);
+                    stack.pop(value.size);
+                    stack.push(value);
+                    break;
+                }
+                case bytecode::neg:{
+                    auto value = valueOf(code_byte, inst, hosted);
+                    stack.pop(value.size);
+                    stack.push(value);
+                    break;
+                }
+                case bytecode::eq:
+                case bytecode::ne:
+                case bytecode::lt:
+                case bytecode::gt:
+                case bytecode::le:
+                case bytecode::ge:{
+                    auto size = valueSize(code_byte, inst, hosted);
+                    stack.pop(size);
+                    stack.pop(size);
+                    stack.push(data(sizeof(uint8_t)));
+                    break;
+                }
+                case bytecode::convert:
+                    stack.pop(immediateSize(inst.type));
+                    stack.push(data(convertTargetSize(inst.op)));
+                    break;
+            }
+        }
+    }
+
+    void analyzeStackMaps(Code *code, runtime::HostedFunction *hosted, const std::vector<uint8_t> &code_bytes){
+        auto count = code->instructions.size();
+        std::vector<std::optional<AbstractStack>> states(count);
+        std::vector<uint32_t> worklist;
+
+        auto flow = [&](uint32_t target, const AbstractStack &state){
+            // 最后一条指令之后没有可执行的指令
+            if(target >= count) return;
+            auto &existing = states[target];
+            if(!existing.has_value()){
+                existing = state;
+                worklist.push_back(target);
+            }
+            else{
+                try{
+                    if(merge(existing.value(), state)) worklist.push_back(target);
+                }
+                catch(const std::invalid_argument &e){
+                    throw std::invalid_argument(std::string(e.what()) + " at offset " + std::to_string(code->instructions[target].offset));
+                }
+            }
+        };
+
+        // 异常表中的try块起点流向其catch块，与enter相同
+        std::multimap<uint32_t, uint32_t> handlers;
+        for(auto &entry : hosted->getExceptionEntries()){
+            handlers.emplace(code->at(entry.offset()) - code->begin(), code->at(entry.target()) - code->begin());
+        }
+
+        if(count > 0) flow(0, AbstractStack());
+        while(!worklist.empty()){
+            auto index = worklist.back();
+            worklist.pop_back();
+            auto &inst = code->instructions[index];
+            auto code_byte = code_bytes[index];
+            AbstractStack stack = states[index].value();
+            auto [first, last] = handlers.equal_range(index);
+            for(auto iter = first; iter != last; iter++){
+                auto handler = stack;
+                handler.push(ref());
+                flow(iter->second, handler);
+            }
+            try{
+                apply(code_byte, inst, hosted, stack);
+            }
+            catch(NoFallthrough){
+                continue;
+            }
+            catch(const std::invalid_argument &e){
+                throw std::invalid_argument(std::string(e.what()) + " at offset " + std::to_string(inst.offset));
+            }
+
+            switch(code_byte){
+                case bytecode::br:
+                    flow(inst.a.target - code->begin(), stack);
+                    break;
+                case bytecode::jif:
+                    flow(index + 1, stack);
+                    flow(inst.a.target - code->begin(), stack);
+                    break;
+                case bytecode::enter:{
+                    flow(index + 1, stack);
+                    // 捕获异常时操作栈恢复到enter执行时的高度，再压入异常对象
+                    auto handler = stack;
+                    handler.push(ref());
+                    flow(inst.b.target - code->begin(), handler);
+                    break;
+                }
+                case bytecode::ret:
+                case bytecode::throw_:
+                    break;
+                default:
+                    flow(index + 1, stack);
+            }
+        }
+
+        // 除总是抛出异常的指令之后的路径外每条可达的指令都已分析，没有stack map的指令不会被执行
+        code->stack_maps.resize(count);
+        for(size_t i = 0; i < count; i++){
+            if(states[i].has_value()) code->stack_maps[i] = states[i]->layout();
+            code->max_height = std::max(code->max_height, code->stack_maps[i].height);
+        }
+    }
+
+    namespace {
+        // enter指令打开的try块。同一条enter在不同的外层try块中执行时是不同的节点
+        struct TryNode {
+            int32_t parent;
+            uint32_t enter;
+            uint32_t depth;
+        };
+    }
+
+    void buildExceptionTable(Code *code, runtime::HostedFunction *hosted){
+        auto count = code->instructions.size();
+        // 捕获时恢复的高度取try块起点的stack map。try语句总是从空的操作栈开始，无法确定时取0
+        auto heightAt = [&](uint32_t index){
+            auto height = index < count ? code->stack_maps[index].height : UINT32_MAX;
+            return height == UINT32_MAX ? 0 : height;
+        };
+        auto indexOf = [&](uint32_t offset) -> uint32_t {
+            if(offset == hosted->getBlockSize()) return count;
+            return code->at(offset) - code->begin();
+        };
+
+        auto &entries = hosted->getExceptionEntries();
+        if(entries.size() > 0){
+            for(auto &entry : entries){
+                ExceptionRange range;
+                range.begin = indexOf(entry.offset());
+                range.end = indexOf(entry.offset() + entry.length());
+                range.klass = resolveAs<runtime::Class>(hosted->getTable(), entry.typetoken());
+                range.entry = code->at(entry.target());
+                range.height = heightAt(range.begin);
+                code->exception_table.push_back(range);
+            }
+            return;
+        }
+
+        // states[i]为指令i所在的最内层try块，-1为不在try块中，-2为不可达
+        std::vector<TryNode> nodes;
+        std::map<std::pair<int32_t, uint32_t>, int32_t> node_of;
+        std::vector<int32_t> states(count, -2);
+        std::vector<uint32_t> worklist;
+
+        auto depthOf = [&](int32_t node){ return node < 0 ? 0 : nodes[node].depth; };
+        auto meet = [&](int32_t a, int32_t b){
+            while(a != b){
+                auto da = depthOf(a), db = depthOf(b);
+                if(da >= db) a = nodes[a].parent;
+                if(db >= da) b = nodes[b].parent;
+            }
+            return a;
+        };
+        auto flow = [&](uint32_t target, int32_t state){
+            if(target >= count) return;
+            auto &existing = states[target];
+            auto merged = existing == -2 ? state : meet(existing, state);
+            if(merged != existing){
+                existing = merged;
+                worklist.push_back(target);
+            }
+        };
+
+        if(count > 0) flow(0, -1);
+        while(!worklist.empty()){
+            auto index = worklist.back();
+            worklist.pop_back();
+            auto &inst = code->instructions[index];
+            auto state = states[index];
+            switch(inst.op){
+                case Op::enter:{
+                    auto key = std::make_pair(state, index);
+                    auto itr = node_of.find(key);
+                    if(itr == node_of.end()){
+                        itr = node_of.insert({key, (int32_t)nodes.size()}).first;
+                        nodes.push_back(TryNode{state, index, depthOf(state) + 1});
+                    }
+                    flow(index + 1, itr->second);
+                    flow(inst.b.target - code->begin(), state);
+                    break;
+                }
+                case Op::leave:
+                    flow(index + 1, state < 0 ? -1 : nodes[state].parent);
+                    break;
+                case Op::br:
+                    flow(inst.a.target - code->begin(), state);
+                    break;
+                case Op::jif:
+                    flow(index + 1, state);
+                    flow(inst.a.target - code->begin(), state);
+                    break;
+                case Op::ret:
+                case Op::throw_:
+                    break;
+                default:
+                    flow(index + 1, state);
+            }
+        }
+
+        // 每个节点覆盖的指令按连续的区间写入异常表，深的节点在前
+        std::vector<std::pair<uint32_t, ExceptionRange>> ranges;
+        std::vector<size_t> open(nodes.size(), SIZE_MAX);
+        for(uint32_t index = 0; index < count; index++){
+            for(auto node = states[index]; node >= 0; node = nodes[node].parent){
+                if(open[node] != SIZE_MAX && ranges[open[node]].second.end == index){
+                    ranges[open[node]].second.end = index + 1;
+                    continue;
+                }
+                auto &enter = code->instructions[nodes[node].enter];
+                open[node] = ranges.size();
+                ranges.push_back({nodes[node].depth, ExceptionRange{index, index + 1, enter.a.klass, enter.b.target, heightAt(nodes[node].enter)}});
+            }
+        }
+        std::stable_sort(ranges.begin(), ranges.end(), [](auto &lhs, auto &rhs){ return lhs.first > rhs.first; });
+        for(auto &[depth, range] : ranges) code->exception_table.push_back(range);
+    }
+}
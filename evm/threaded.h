@@ -0,0 +1,270 @@
+#ifndef EVM_THREADED
+#define EVM_THREADED
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include "bytecode.h"
+#include "unicode.h"
+
+class Loader;
+
+namespace runtime {
+    class Symbol;
+    class Class;
+    class SpecializedArray;
+    class Variable;
+    class Method;
+    class VirtualMethod;
+    class Ctor;
+    class ForeignEntry;
+    class OptionalParameter;
+    class EnumConstant;
+    class HostedFunction;
+}
+
+namespace threaded {
+
+    // 预解码指令集。每条字节码在函数第一次被调用时翻译为一条Instruction，
+    // 之后由Processor::execute通过computed goto直接跳转到handler执行。
+    // 不带类型的指令
+    #define EVM_THREADED_OPS(X) \
+        X(nop) \
+        X(ldsftn) X(ldvftn) X(ldftn) X(ldctor) X(ldforeign) \
+        X(callmethod) X(callvirtual) X(callstatic) X(callforeign) X(callintrinsic) X(callctor) X(calldlg) \
+        X(ldarga) X(ldloca) X(ldargai) X(ldlocai) \
+        X(ldflda) X(ldfldah) X(ldsflda) \
+        X(packopt) X(testopt) X(ldoptinfo) X(ldenumc) \
+        X(ldelema) X(newarray) X(arraylength) \
+        X(jif) X(br) X(ret) \
+        X(ldnothing) X(ldstr) \
+        X(castClass) X(instanceof) X(newobj) \
+        X(throw_) X(enter) X(leave) \
+        X(and_) X(or_) X(xor_) X(not_) \
+        X(wrapsftn) X(wrapvftn) X(wrapftn) X(wrapctor) X(wrapforeign)
+
+    // 带类型的指令在翻译时被特化(quicken)为单一类型的指令，如add.i32 -> add_i32，
+    // 执行时不再检查类型字节。X(op, Handler, suffix, T)，Handler为Processor中对应的模板
+    #define EVM_INTEGRAL_TYPES(X, op, Handler) \
+        X(op, Handler, boolean, uint8_t) \
+        X(op, Handler, i8, int8_t) X(op, Handler, i16, int16_t) \
+        X(op, Handler, i32, int32_t) X(op, Handler, i64, int64_t) \
+        X(op, Handler, u8, uint8_t) X(op, Handler, u16, uint16_t) \
+        X(op, Handler, u32, uint32_t) X(op, Handler, u64, uint64_t)
+
+    #define EVM_ARITHMETIC_TYPES(X, op, Handler) \
+        EVM_INTEGRAL_TYPES(X, op, Handler) \
+        X(op, Handler, f32, float) X(op, Handler, f64, double)
+
+    #define EVM_ORD_TYPES(X, op, Handler) \
+        EVM_ARITHMETIC_TYPES(X, op, Handler) \
+        X(op, Handler, emconst, void*) X(op, Handler, ref, interop::Instance*)
+
+    #define EVM_ALL_TYPES(X, op, Handler) \
+        EVM_ORD_TYPES(X, op, Handler) \
+        X(op, Handler, hdl, interop::InteriorPointer) X(op, Handler, record, interop::RecordOpaque)
+
+    // 不会引发异常或切换栈帧的特化指令
+    #define EVM_QUICKENED_OPS(X) \
+        EVM_ALL_TYPES(X, stloc, OpStloc) EVM_ALL_TYPES(X, ldloc, OpLdloc) \
+        EVM_ALL_TYPES(X, stloci, OpStloci) EVM_ALL_TYPES(X, ldloci, OpLdloci) \
+        EVM_ALL_TYPES(X, stsfld, OpStsfld) EVM_ALL_TYPES(X, ldsfld, OpLdsfld) \
+        EVM_ALL_TYPES(X, dup, OpDup) EVM_ORD_TYPES(X, push, OpPush) EVM_ALL_TYPES(X, pop, OpPop) \
+        EVM_ALL_TYPES(X, store, OpStore) EVM_ALL_TYPES(X, load, OpLoad) \
+        EVM_ARITHMETIC_TYPES(X, add, OpAdd) EVM_ARITHMETIC_TYPES(X, sub, OpSub) \
+        EVM_ARITHMETIC_TYPES(X, mul, OpMul) EVM_INTEGRAL_TYPES(X, mod, OpMod) \
+        EVM_ARITHMETIC_TYPES(X, neg, OpNeg) \
+        EVM_ORD_TYPES(X, eq, OpEQ) EVM_ORD_TYPES(X, ne, OpNE) \
+        EVM_ARITHMETIC_TYPES(X, lt, OpLT) EVM_ARITHMETIC_TYPES(X, gt, OpGT) \
+        EVM_ARITHMETIC_TYPES(X, le, OpLE) EVM_ARITHMETIC_TYPES(X, ge, OpGE)
+
+    // 可能引发异常的特化指令，执行后需要重新取得当前栈帧
+    #define EVM_QUICKENED_CHECKED_OPS(X) \
+        EVM_ALL_TYPES(X, starg, OpStarg) EVM_ALL_TYPES(X, ldarg, OpLdarg) \
+        EVM_ALL_TYPES(X, stargi, OpStargi) EVM_ALL_TYPES(X, ldargi, OpLdargi) \
+        EVM_ALL_TYPES(X, stfld, OpStfld) EVM_ALL_TYPES(X, ldfld, OpLdfld) \
+        EVM_ALL_TYPES(X, stfldh, OpStfldh) EVM_ALL_TYPES(X, ldfldh, OpLdfldh) \
+        EVM_ALL_TYPES(X, stelem, OpStelem) EVM_ALL_TYPES(X, stelemr, OpStelemr) \
+        EVM_ALL_TYPES(X, ldelem, OpLdelem) \
+        EVM_ARITHMETIC_TYPES(X, div, OpDiv)
+
+    // convert按源类型与目标类型特化，X(src, S, dst, D)
+    #define EVM_CONVERT_FROM(X, src, S) \
+        X(src, S, i8, int8_t) X(src, S, i16, int16_t) \
+        X(src, S, i32, int32_t) X(src, S, i64, int64_t) \
+        X(src, S, u8, uint8_t) X(src, S, u16, uint16_t) \
+        X(src, S, u32, uint32_t) X(src, S, u64, uint64_t) \
+        X(src, S, f32, float) X(src, S, f64, double)
+
+    #define EVM_CONVERT_OPS(X) \
+        EVM_CONVERT_FROM(X, boolean, uint8_t) \
+        EVM_CONVERT_FROM(X, i8, int8_t) EVM_CONVERT_FROM(X, i16, int16_t) \
+        EVM_CONVERT_FROM(X, i32, int32_t) EVM_CONVERT_FROM(X, i64, int64_t) \
+        EVM_CONVERT_FROM(X, u8, uint8_t) EVM_CONVERT_FROM(X, u16, uint16_t) \
+        EVM_CONVERT_FROM(X, u32, uint32_t) EVM_CONVERT_FROM(X, u64, uint64_t) \
+        EVM_CONVERT_FROM(X, f32, float) EVM_CONVERT_FROM(X, f64, double)
+
+    enum class Op : uint16_t {
+        #define EVM_THREADED_ENUM(op) op,
+        #define EVM_QUICKENED_ENUM(op, Handler, suffix, T) op##_##suffix,
+        #define EVM_CONVERT_ENUM(src, S, dst, D) convert_##src##_##dst,
+        EVM_THREADED_OPS(EVM_THREADED_ENUM)
+        EVM_QUICKENED_OPS(EVM_QUICKENED_ENUM)
+        EVM_QUICKENED_CHECKED_OPS(EVM_QUICKENED_ENUM)
+        EVM_CONVERT_OPS(EVM_CONVERT_ENUM)
+        #undef EVM_THREADED_ENUM
+        #undef EVM_QUICKENED_ENUM
+        #undef EVM_CONVERT_ENUM
+        count
+    };
+
+    struct Instruction;
+
+    // callvirtual与calldlg调用点的内联缓存，记录接收者的类(class_table中的序号)与虚函数对应的实现及其栈帧大小。
+    // 调用点见过的组合超过capacity个后成为megamorphic，不再查找与记录，直接查虚函数表
+    struct InlineCache {
+        static constexpr uint32_t capacity = 4;
+        struct Entry {
+            uint32_t class_index;
+            uint32_t frame_size;                // target的参数与局部变量的总长度
+            runtime::VirtualMethod *method;     // calldlg每次调用的虚函数可能不同，一并作为键
+            runtime::Method *target;
+        };
+        Entry entries[capacity];
+        uint32_t count = 0;                     // 为capacity + 1时表示megamorphic
+
+        inline const Entry *lookup(uint32_t class_index, runtime::VirtualMethod *method) const {
+            for(uint32_t i = 0; i < count && i < capacity; i++){
+                if(entries[i].class_index == class_index && entries[i].method == method) return &entries[i];
+            }
+            return nullptr;
+        }
+
+        inline void record(uint32_t class_index, runtime::VirtualMethod *method, runtime::Method *target, uint32_t frame_size){
+            if(count < capacity) entries[count++] = Entry{class_index, frame_size, method, target};
+            else count = capacity + 1;
+        }
+
+        inline bool isMegamorphic() const { return count > capacity; }
+    };
+
+    // 实例字段在对象(或record)中的偏移与长度
+    struct FieldSlot {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // 参数或局部变量在栈帧中的位置
+    struct FrameSlot {
+        uint32_t offset;
+        uint16_t index;
+        uint16_t optional;              // 是否为可选参数，读写前需要检查是否已传入
+    };
+
+    // 指令的操作数。token在链接时被解析为对应的运行时数据，执行时不再查询TokenTable
+    union Operand {
+        uint64_t u64;
+        token_t token;
+        uint32_t size;                  // 数组元素或record的大小
+        const Instruction *target;
+        FieldSlot field;
+        FrameSlot slot;
+        uint8_t *address;               // 静态字段地址
+        const unicode::string *text;    // ldstr的字符串或intrinsic的名称
+        runtime::Symbol *symbol;
+        runtime::Class *klass;
+        runtime::SpecializedArray *array;
+        runtime::Variable *variable;
+        runtime::Method *method;
+        runtime::VirtualMethod *virtual_method;
+        runtime::Ctor *ctor;
+        runtime::ForeignEntry *foreign;
+        runtime::OptionalParameter *option;
+        runtime::EnumConstant *constant;
+        InlineCache *cache;
+        uint8_t bytes[8];
+
+        template<class T>
+        inline T as() const {
+            T t{};
+            memcpy(&t, bytes, sizeof(T) < sizeof(Operand) ? sizeof(T) : sizeof(Operand));
+            return t;
+        }
+    };
+
+    struct Instruction {
+        const void *handler = nullptr;  // computed goto的跳转地址，由Code::bind填充
+        Op op = Op::nop;
+        uint8_t type = 0;               // 特化前指令携带的类型字节，没有则为0
+        uint8_t hint = 0;               // ldfldh/stfldh/ldfldah的访问方式
+        uint32_t offset = 0;            // 对应的原始字节码偏移，用于行号与调试输出
+        Operand a{0}, b{0};
+    };
+
+    // 指令执行前栈帧在操作栈上部分的布局，偏移相对于栈帧在操作栈上的起点。
+    // GC时由此得到操作栈上的引用，执行时不需要额外记录
+    struct StackMap {
+        uint32_t height = UINT32_MAX;       // 操作栈高度，指令不可达时为UINT32_MAX
+        std::vector<uint32_t> refs;         // interop::Instance*
+        std::vector<uint32_t> interiors;    // interop::InteriorPointer
+    };
+
+    // 异常表的一项，覆盖序号在[begin, end)内的指令。同一条指令被多项覆盖时内层的在前
+    struct ExceptionRange {
+        uint32_t begin;
+        uint32_t end;
+        runtime::Class *klass;
+        const Instruction *entry;           // catch块的第一条指令
+        uint32_t height;                    // 捕获时栈帧在操作栈上的部分恢复到的高度，之后压入异常对象
+    };
+
+    class Code {
+        std::vector<Instruction> instructions;
+        std::vector<ExceptionRange> exception_table;
+        std::vector<StackMap> stack_maps;
+        std::deque<InlineCache> inline_caches;  // deque中元素的地址不变，指令直接保存指针
+        uint32_t max_height = 0;                // 各条指令执行前操作栈的最大高度
+        bool bound = false;
+        friend Code *translate(runtime::HostedFunction *hosted, Loader &loader);
+        friend void analyzeStackMaps(Code *code, runtime::HostedFunction *hosted, const std::vector<uint8_t> &code_bytes);
+        friend void buildExceptionTable(Code *code, runtime::HostedFunction *hosted);
+    public:
+        inline Instruction *begin(){ return instructions.data(); }
+        inline uint32_t size() const { return instructions.size(); }
+
+        inline const StackMap &getStackMap(const Instruction *inst) const { return stack_maps[inst - instructions.data()]; }
+        inline uint32_t getMaxHeight() const { return max_height; }
+
+        inline InlineCache *newInlineCache(){ return &inline_caches.emplace_back(); }
+
+        // 查找inst所在的try块中能捕获klass的最内层一项，outer为覆盖inst的更外层的项数。没有时返回nullptr
+        const ExceptionRange *findHandler(const Instruction *inst, runtime::Class *klass, size_t &outer) const;
+
+        // 覆盖inst的异常表项数，即inst所在的try块的层数
+        size_t handlerDepth(const Instruction *inst) const;
+
+        // 返回字节码偏移offset处的指令，offset不是指令边界时抛出异常
+        Instruction *at(uint32_t offset);
+
+        // 将每条指令的op映射为handler地址
+        void bind(const void *const *handler_table);
+        inline bool isBound() const { return bound; }
+    };
+
+    // 返回带类型指令code在类型typ下的特化指令，组合不合法时抛出异常
+    Op quicken(uint8_t code, uint8_t typ);
+    Op quickenConvert(uint8_t src, uint8_t dst);
+
+    // 解码hosted的字节码块，生成预解码并特化后的指令序列，同时将token解析为运行时数据
+    Code *translate(runtime::HostedFunction *hosted, Loader &loader);
+
+    // 对已解析的指令做抽象解释，求出每条指令执行前操作栈的stack map。code_bytes为每条指令特化前的字节码。
+    // 同一位置不同路径的操作栈布局不一致时抛出std::invalid_argument
+    void analyzeStackMaps(Code *code, runtime::HostedFunction *hosted, const std::vector<uint8_t> &code_bytes);
+
+    // 由函数的ExceptionEntry生成异常表。没有ExceptionEntry时按enter/leave求出每条指令所在的try块，
+    // 多条路径到达同一条指令时取它们共同所在的try块。需要在analyzeStackMaps之后调用
+    void buildExceptionTable(Code *code, runtime::HostedFunction *hosted);
+}
+
+#endif
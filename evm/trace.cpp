@@ -0,0 +1,227 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace trace {
+
+    Level levels[(int)Tag::count] = {};
+
+    namespace {
+
+        const char *tag_names[] = {
+            #define EVM_TRACE_TAG_NAME(tag) #tag,
+            EVM_TRACE_TAGS(EVM_TRACE_TAG_NAME)
+            #undef EVM_TRACE_TAG_NAME
+        };
+
+        // 环形缓冲区中的一个槽位，较长的记录占用多个连续的槽位
+        struct Slot {
+            std::atomic<uint64_t> sequence;
+            uint16_t length;
+            char text[246];
+        };
+
+        // 多生产者单消费者的有界队列。sequence等于pos时槽位可写，等于pos+1时可读
+        class RingBuffer {
+            static constexpr uint64_t capacity = 4096;
+            Slot *slots;
+            alignas(64) std::atomic<uint64_t> enqueue_pos{0};
+            alignas(64) uint64_t dequeue_pos = 0;
+        public:
+            RingBuffer() : slots(new Slot[capacity]){
+                for(uint64_t i = 0; i < capacity; i++){
+                    slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            ~RingBuffer(){
+                delete[] slots;
+            }
+
+            // 一次占用记录所需的全部槽位，使多个线程的长记录不会交错。缓冲区空间不足时返回false
+            bool push(const char *text, size_t length){
+                uint64_t count = (length + sizeof(Slot::text) - 1) / sizeof(Slot::text);
+                if(count == 0) return true;
+                // 超过整个缓冲区的记录被截断
+                if(count > capacity){
+                    count = capacity;
+                    length = capacity * sizeof(Slot::text);
+                }
+                auto pos = enqueue_pos.load(std::memory_order_relaxed);
+                while(true){
+                    // 消费者按顺序释放槽位，最后一个槽位可写时之前的槽位也都可写
+                    auto &last = slots[(pos + count - 1) & (capacity - 1)];
+                    auto seq = last.sequence.load(std::memory_order_acquire);
+                    auto diff = (int64_t)seq - (int64_t)(pos + count - 1);
+                    if(diff == 0){
+                        if(enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)){
+                            for(uint64_t i = 0; i < count; i++){
+                                auto &slot = slots[(pos + i) & (capacity - 1)];
+                                auto offset = i * sizeof(Slot::text);
+                                slot.length = std::min(length - offset, sizeof(Slot::text));
+                                memcpy(slot.text, text + offset, slot.length);
+                                slot.sequence.store(pos + i + 1, std::memory_order_release);
+                            }
+                            return true;
+                        }
+                    }
+                    else if(diff < 0){
+                        return false;
+                    }
+                    else{
+                        pos = enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            // 取出一条记录追加到out，缓冲区为空时返回false。只由写出线程调用
+            bool pop(std::string &out){
+                auto &slot = slots[dequeue_pos & (capacity - 1)];
+                if(slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) return false;
+                out.append(slot.text, slot.length);
+                slot.sequence.store(dequeue_pos + capacity, std::memory_order_release);
+                dequeue_pos++;
+                return true;
+            }
+        };
+
+        class Writer {
+            RingBuffer ring;
+            std::ofstream file;
+            std::ostream *output = &std::clog;
+            std::thread thread;
+            std::atomic<bool> running{false};
+
+            void drain(std::string &batch){
+                while(batch.size() < 65536 && ring.pop(batch));
+            }
+
+            void loop(){
+                std::string batch;
+                while(running.load(std::memory_order_acquire)){
+                    batch.clear();
+                    drain(batch);
+                    if(batch.empty()){
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    else{
+                        output->write(batch.data(), batch.size());
+                    }
+                }
+                do{
+                    batch.clear();
+                    drain(batch);
+                    output->write(batch.data(), batch.size());
+                }while(!batch.empty());
+                output->flush();
+            }
+        public:
+            void setOutput(const std::string &path){
+                file.open(path);
+                if(!file.is_open()) throw std::invalid_argument("cannot open trace file '" + path + "'");
+                output = &file;
+            }
+
+            void start(){
+                if(running.load()) return;
+                running.store(true, std::memory_order_release);
+                thread = std::thread([this]{ loop(); });
+            }
+
+            void stop(){
+                if(!running.load()) return;
+                running.store(false, std::memory_order_release);
+                thread.join();
+            }
+
+            void write(const std::string &text){
+                // 没有写出线程时直接同步输出
+                if(!running.load(std::memory_order_acquire)){
+                    output->write(text.data(), text.size());
+                    return;
+                }
+                // 缓冲区已满时等待写出线程，而不是丢弃记录
+                while(!ring.push(text.data(), text.size())){
+                    std::this_thread::yield();
+                }
+            }
+
+            ~Writer(){
+                stop();
+            }
+        };
+
+        Writer writer;
+
+        thread_local std::ostringstream stream;
+
+        std::string trim(const std::string &str){
+            auto beg = str.find_first_not_of(" \t");
+            if(beg == std::string::npos) return "";
+            auto end = str.find_last_not_of(" \t");
+            return str.substr(beg, end - beg + 1);
+        }
+
+        Level parseLevel(const std::string &str){
+            if(str == "off" || str == "0") return Level::off;
+            if(str == "info" || str == "1") return Level::info;
+            if(str == "verbose" || str == "2") return Level::verbose;
+            throw std::invalid_argument("unknown trace level '" + str + "'");
+        }
+    }
+
+    void configure(const std::string &spec){
+        std::stringstream items(spec);
+        std::string item;
+        while(std::getline(items, item, ',')){
+            item = trim(item);
+            if(item.empty()) continue;
+            auto sep = item.find('=');
+            auto name = trim(item.substr(0, sep));
+            auto level = sep == std::string::npos ? Level::info : parseLevel(trim(item.substr(sep + 1)));
+            if(name == "all"){
+                for(auto &l : levels) l = level;
+                continue;
+            }
+            int i = 0;
+            while(i < (int)Tag::count && name != tag_names[i]) i++;
+            if(i == (int)Tag::count) throw std::invalid_argument("unknown trace tag '" + name + "'");
+            levels[i] = level;
+        }
+    }
+
+    void setOutput(const std::string &path){
+        writer.setOutput(path);
+    }
+
+    void start(){
+        for(auto level : levels){
+            if(level != Level::off){
+                writer.start();
+                return;
+            }
+        }
+    }
+
+    void stop(){
+        writer.stop();
+    }
+
+    std::ostream &begin(Tag tag){
+        stream.str("");
+        stream.clear();
+        stream << std::left << std::setw(20) << std::setfill('.') << std::string("[") + tag_names[(int)tag] + "]";
+        return stream;
+    }
+
+    void commit(){
+        writer.write(stream.str());
+    }
+}
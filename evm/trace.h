@@ -0,0 +1,71 @@
+#ifndef EVM_TRACE_H
+#define EVM_TRACE_H
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+// 调试输出。每个tag有独立的输出级别，由 --trace 或环境变量 EVM_TRACE 在运行时选择，
+// 例如 --trace Loader,MinorGC=verbose 或 EVM_TRACE=all=info。
+// 未开启的tag只需比较一次级别，输出写入无锁的环形缓冲区，由后台线程异步写出。
+// 编译时不定义 EVM_TRACE 则所有输出点被完全移除。
+
+namespace trace {
+
+    #define EVM_TRACE_TAGS(X) \
+        X(Args) X(Loader) X(CallEnv) X(Instruction) X(MinorGC) \
+        X(PutRune) X(IterInRangeIntrinsic)
+
+    enum class Tag : uint8_t {
+        #define EVM_TRACE_TAG_ENUM(tag) tag,
+        EVM_TRACE_TAGS(EVM_TRACE_TAG_ENUM)
+        #undef EVM_TRACE_TAG_ENUM
+        count
+    };
+
+    enum class Level : uint8_t {
+        off = 0,
+        info = 1,       // 每个事件一行，如函数进入、退出与指令执行
+        verbose = 2     // 额外输出高频的细节，如每次分配与对象移动
+    };
+
+    extern Level levels[(int)Tag::count];
+
+    inline bool enabled(Tag tag, Level level){
+        return levels[(int)tag] >= level;
+    }
+
+    // 解析形如 tag[=level],tag[=level] 的配置，tag为all时作用于所有tag。
+    // level可以是off/info/verbose或0-2，省略时为info。格式错误时抛出std::invalid_argument
+    void configure(const std::string &spec);
+
+    // 设置输出文件，默认输出到std::clog。需要在start之前调用
+    void setOutput(const std::string &path);
+
+    // 有tag开启时启动后台写出线程
+    void start();
+
+    // 写出缓冲区中剩余的记录并结束后台线程
+    void stop();
+
+    // 开始一条记录，返回当前线程的格式化流，已写入tag前缀
+    std::ostream &begin(Tag tag);
+
+    // 将begin之后写入的内容放入环形缓冲区
+    void commit();
+}
+
+#ifdef EVM_TRACE
+    #define LOG_AT(tag, level, x) \
+        if(::trace::enabled(::trace::Tag::tag, ::trace::Level::level)) [[unlikely]] { \
+            ::trace::begin(::trace::Tag::tag) << x; \
+            ::trace::commit(); \
+        }
+#else
+    #define LOG_AT(tag, level, x)
+#endif
+
+#define LOG(tag, x) LOG_AT(tag, info, x)
+#define LOG_VERBOSE(tag, x) LOG_AT(tag, verbose, x)
+
+#endif
@@ -5,10 +5,12 @@
 #include <codecvt>
 #include <locale>
 #include "bytecode.h"
+#include "trace.h"
 
 class MemoryStack{
     uint8_t *stack = nullptr,
-            *top = nullptr;
+            *top = nullptr,
+            *limit = nullptr;
 public:
 
     template<class T>
@@ -45,6 +47,12 @@ public:
         return read<T>(top - sizeof(T));
     }
 
+    // 读取栈顶之下depth字节处的值，不弹出
+    template<class T>
+    inline T peekBelow(uint32_t depth){
+        return read<T>(top - depth - sizeof(T));
+    }
+
     template<class T>
     inline T *ptrToPeek(){
         return (T*)(top - sizeof(T));
@@ -67,6 +75,12 @@ public:
 
     inline MemoryStack(uint32_t size){
         top = stack = (uint8_t*)malloc(size);
+        limit = stack + size;
+    }
+
+    // push与borrow不检查边界，调用者在进入栈帧时检查整个栈帧放得下
+    inline bool hasRoom(size_t count) const {
+        return (size_t)(limit - top) >= count;
     }
     inline ~MemoryStack(){
         free(stack);
@@ -76,6 +90,15 @@ public:
     inline uint8_t *base(){
         return stack;
     }
+
+    inline uint8_t *getTop(){
+        return top;
+    }
+
+    // 丢弃position之上的内容
+    inline void restore(uint8_t *position){
+        top = position;
+    }
 };
 
 
@@ -107,11 +130,4 @@ GENERIC_TYPE_DEBUG(interop::InteriorPointer)
 GENERIC_TYPE_DEBUG(interop::RecordOpaque)
 #undef GENERIC_TYPE_DEBUG
 
-#define DEBUG
-#ifdef DEBUG
-    #define LOG(tag,x) std::clog<<std::left<<std::setw(20)<<std::setfill('.')<<std::string("["#tag) + "]"<<x;std::clog.flush();
-#else
-    #define LOG(tag,x)
-#endif
-
 #endif
\ No newline at end of file
@@ -1,5 +1,5 @@
-from asyncio import subprocess
 import os
+import subprocess
 import sys
 
 ebc_path = ""
@@ -11,5 +11,29 @@ def compile(target,build_path):
     return False
 
 
-def run(target_path):
-    subprocess.run([evm_path,target_path,"-p",core_folder])
+# 测试程序开头的 "// env: NAME=VALUE ..." 注释给出运行时附加的环境变量，可以有多行，
+# 如 "// env: EVM_GC_THREADS=4" 使该程序由并行minorGC运行
+def environment_of(source_path):
+    env = {}
+    with open(source_path, encoding="utf-8") as source:
+        for line in source:
+            line = line.strip()
+            if not line.startswith("// env:"):
+                break
+            for item in line[len("// env:"):].split():
+                name, _, value = item.partition("=")
+                env[name] = value
+    return env
+
+
+def run(target_path, source_path=None):
+    env = dict(os.environ)
+    if source_path is not None:
+        env.update(environment_of(source_path))
+    return subprocess.run([evm_path,target_path,"-p",core_folder], env=env, capture_output=True, text=True)
+
+
+# 程序以<terminate>结束且没有输出failed时通过
+def passed(output):
+    lines = output.splitlines()
+    return len(lines) > 0 and lines[-1] == "<terminate>" and not any(line.startswith("failed") for line in lines)
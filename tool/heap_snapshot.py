@@ -0,0 +1,164 @@
+# 分析evm写出的堆快照(--heap-snapshot、SIGUSR2、内存不足或GC.WriteHeapSnapshot)
+# 用法: python heap_snapshot.py <snapshot> [--top N]
+# 输出按类统计的对象数与字节数、各类对象支配的字节数，以及保留最多内存的对象到根的支配路径
+import argparse
+import struct
+import sys
+
+ROOT = 0    # 虚拟根节点，指向所有根
+
+
+def read_snapshot(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    pos = 0
+
+    def take(fmt):
+        nonlocal pos
+        values = struct.unpack_from('<' + fmt, data, pos)
+        pos += struct.calcsize('<' + fmt)
+        return values
+
+    if data[:8] != b'EVMHEAP\0':
+        sys.exit('not an evm heap snapshot: ' + path)
+    pos = 8
+    version, = take('I')
+    if version != 1:
+        sys.exit('unsupported snapshot version %d' % version)
+
+    classes = {}
+    class_count, = take('I')
+    for _ in range(class_count):
+        index, length = take('II')
+        classes[index] = data[pos:pos + length].decode('utf-8')
+        pos += length
+
+    root_count, = take('I')
+    roots = list(take('%dQ' % root_count))
+
+    # 对象编号从1开始，0为虚拟根
+    addresses = [0]
+    klass = [0]
+    size = [0]
+    refs = [[]]
+    object_count, = take('Q')
+    for _ in range(object_count):
+        address, class_index, object_size, ref_count = take('QIII')
+        addresses.append(address)
+        klass.append(class_index)
+        size.append(object_size)
+        refs.append(list(take('%dQ' % ref_count)))
+
+    index_of = {address: i for i, address in enumerate(addresses) if i != ROOT}
+    # 指向快照之外的地址(如未被GC管理的常量)被忽略
+    edges = [[index_of[a] for a in targets if a in index_of] for targets in refs]
+    edges[ROOT] = list(dict.fromkeys(index_of[a] for a in roots if a in index_of))
+    return classes, klass, size, edges
+
+
+def reverse_postorder(edges):
+    order = []
+    visited = [False] * len(edges)
+    visited[ROOT] = True
+    stack = [(ROOT, iter(edges[ROOT]))]
+    while stack:
+        node, children = stack[-1]
+        for child in children:
+            if not visited[child]:
+                visited[child] = True
+                stack.append((child, iter(edges[child])))
+                break
+        else:
+            stack.pop()
+            order.append(node)
+    order.reverse()
+    return order
+
+
+def dominators(edges):
+    # Cooper, Harvey, Kennedy: A Simple, Fast Dominance Algorithm
+    order = reverse_postorder(edges)
+    rank = [-1] * len(edges)
+    for i, node in enumerate(order):
+        rank[node] = i
+    preds = [[] for _ in edges]
+    for node in order:
+        for child in edges[node]:
+            preds[child].append(node)
+
+    idom = [-1] * len(edges)
+    idom[ROOT] = ROOT
+
+    def intersect(a, b):
+        while a != b:
+            while rank[a] > rank[b]:
+                a = idom[a]
+            while rank[b] > rank[a]:
+                b = idom[b]
+        return a
+
+    changed = True
+    while changed:
+        changed = False
+        for node in order[1:]:
+            new_idom = -1
+            for pred in preds[node]:
+                if idom[pred] == -1:
+                    continue
+                new_idom = pred if new_idom == -1 else intersect(pred, new_idom)
+            if idom[node] != new_idom:
+                idom[node] = new_idom
+                changed = True
+    return order, idom
+
+
+def retained_sizes(order, idom, size):
+    retained = list(size)
+    for node in reversed(order):
+        if node != ROOT:
+            retained[idom[node]] += retained[node]
+    return retained
+
+
+def main():
+    parser = argparse.ArgumentParser(description='analyze an evm heap snapshot')
+    parser.add_argument('snapshot')
+    parser.add_argument('--top', type=int, default=20, help='number of rows in each report')
+    args = parser.parse_args()
+
+    classes, klass, size, edges = read_snapshot(args.snapshot)
+    order, idom = dominators(edges)
+    retained = retained_sizes(order, idom, size)
+    name = lambda node: classes.get(klass[node], '#%d' % klass[node])
+
+    # 同类对象互相支配时(如链表节点)只计最外层的对象，避免重复计算
+    histogram = {}
+    for node in order[1:]:
+        entry = histogram.setdefault(klass[node], [0, 0, 0])
+        entry[0] += 1
+        entry[1] += size[node]
+        if idom[node] == ROOT or klass[idom[node]] != klass[node]:
+            entry[2] += retained[node]
+
+    total = sum(size)
+    print('%d objects, %d bytes, %d roots' % (len(order) - 1, total, len(edges[ROOT])))
+    print()
+    print('%-40s %10s %12s %12s' % ('class', 'count', 'shallow', 'retained'))
+    rows = sorted(histogram.items(), key=lambda item: item[1][1], reverse=True)
+    for class_index, (count, shallow, kept) in rows[:args.top]:
+        print('%-40s %10d %12d %12d' % (classes.get(class_index, '#%d' % class_index), count, shallow, kept))
+
+    print()
+    print('largest retainers and their dominator paths to the roots')
+    top = sorted(order[1:], key=lambda node: retained[node], reverse=True)[:args.top]
+    for node in top:
+        path = []
+        current = node
+        while current != ROOT:
+            path.append(name(current))
+            current = idom[current]
+        print('%12d  %s' % (retained[node], ' <- '.join(path + ['<root>'])))
+
+
+if __name__ == '__main__':
+    main()